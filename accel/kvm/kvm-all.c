@@ -49,6 +49,7 @@
 #include "kvm-cpus.h"
 #include "system/dirtylimit.h"
 #include "qemu/range.h"
+#include "block/thread-pool.h"
 
 #include "hw/boards.h"
 #include "system/stats.h"
@@ -773,9 +774,13 @@ static bool kvm_slot_get_dirty_log(KVMState *s, KVMSlot *slot)
     return ret == 0;
 }
 
-/* Should be with all slots_lock held for the address spaces. */
+/*
+ * Should be with all slots_lock held for the address spaces.  @atomic is
+ * true if other threads may be updating the same bitmaps concurrently.
+ */
 static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
-                                     uint32_t slot_id, uint64_t offset)
+                                     uint32_t slot_id, uint64_t offset,
+                                     bool atomic)
 {
     KVMMemoryListener *kml;
     KVMSlot *mem;
@@ -792,7 +797,11 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    if (atomic) {
+        set_bit_atomic(offset, mem->dirty_bmap);
+    } else {
+        set_bit(offset, mem->dirty_bmap);
+    }
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -829,7 +838,8 @@ static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
  * Should be with all slots_lock held for the address spaces.  It returns the
  * dirty page we've collected on this dirty ring.
  */
-static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu,
+                                        bool atomic)
 {
     struct kvm_dirty_gfn *dirty_gfns = cpu->kvm_dirty_gfns, *cur;
     uint32_t ring_size = s->kvm_dirty_ring_size;
@@ -853,7 +863,7 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
             break;
         }
         kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
-                                 cur->offset);
+                                 cur->offset, atomic);
         dirty_gfn_set_collected(cur);
         trace_kvm_dirty_ring_page(cpu->cpu_index, fetch, cur->offset);
         fetch++;
@@ -865,6 +875,115 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     return count;
 }
 
+/* vCPUs whose rings are harvested by each reaper worker */
+#define KVM_DIRTY_RING_REAP_SHARD 32
+
+typedef struct KVMDirtyRingReapShard {
+    KVMState *s;
+    CPUState **cpus;
+    unsigned int nr_cpus;
+    uint64_t total;
+} KVMDirtyRingReapShard;
+
+static int kvm_dirty_ring_reap_shard(void *opaque)
+{
+    KVMDirtyRingReapShard *shard = opaque;
+    unsigned int i;
+
+    for (i = 0; i < shard->nr_cpus; i++) {
+        shard->total += kvm_dirty_ring_reap_one(shard->s, shard->cpus[i],
+                                                true);
+    }
+    return 0;
+}
+
+/*
+ * Harvest the rings of all vCPUs.  With many vCPUs, they are split in
+ * shards that are harvested concurrently by the thread pool of the
+ * reaper.  The workers run on behalf of the caller, which holds the
+ * slots_lock until all of them are done; since rings of different vCPUs
+ * can report pages in the same bitmap word, they update the dirty
+ * bitmaps atomically.
+ */
+static uint64_t kvm_dirty_ring_reap_all(KVMState *s)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    g_autofree KVMDirtyRingReapShard *shards = NULL;
+    g_autofree CPUState **cpus = NULL;
+    unsigned int nr_cpus = 0, nr_shards, per_shard, i;
+    uint64_t total = 0;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        nr_cpus++;
+    }
+
+    nr_shards = MIN(DIV_ROUND_UP(nr_cpus, KVM_DIRTY_RING_REAP_SHARD),
+                    r->max_workers);
+    if (nr_shards <= 1) {
+        CPU_FOREACH(cpu) {
+            total += kvm_dirty_ring_reap_one(s, cpu, false);
+        }
+        return total;
+    }
+
+    /* The vCPU list cannot change, the caller holds the BQL */
+    cpus = g_new(CPUState *, nr_cpus);
+    i = 0;
+    CPU_FOREACH(cpu) {
+        cpus[i++] = cpu;
+    }
+
+    if (!r->pool) {
+        r->pool = thread_pool_new();
+    }
+
+    per_shard = DIV_ROUND_UP(nr_cpus, nr_shards);
+    shards = g_new0(KVMDirtyRingReapShard, nr_shards);
+    for (i = 0; i < nr_shards; i++) {
+        assert(i * per_shard < nr_cpus);
+        shards[i].s = s;
+        shards[i].cpus = cpus + i * per_shard;
+        shards[i].nr_cpus = MIN(per_shard, nr_cpus - i * per_shard);
+        if (i) {
+            thread_pool_submit_immediate(r->pool, kvm_dirty_ring_reap_shard,
+                                         &shards[i], NULL);
+        }
+    }
+
+    /* Take the first shard for ourselves */
+    kvm_dirty_ring_reap_shard(&shards[0]);
+    thread_pool_wait(r->pool);
+
+    for (i = 0; i < nr_shards; i++) {
+        total += shards[i].total;
+    }
+    return total;
+}
+
+static void kvm_dirty_ring_account_reap(KVMState *s, uint64_t total,
+                                        int64_t ns)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    uint64_t us = ns / 1000;
+    int bucket = us ? 64 - clz64(us) : 0;
+
+    bucket = MIN(bucket, KVM_DIRTY_RING_REAP_HIST_SIZE - 1);
+    stat64_add(&r->pages, total);
+    stat64_add(&r->latency[bucket], 1);
+}
+
+uint64_t kvm_dirty_ring_reap_stats(uint64_t *latency)
+{
+    struct KVMDirtyRingReaper *r = &kvm_state->reaper;
+    int i;
+
+    for (i = 0; i < KVM_DIRTY_RING_REAP_HIST_SIZE; i++) {
+        latency[i] = stat64_get(&r->latency[i]);
+    }
+    return stat64_get(&r->pages);
+}
+
 /* Must be with slots_lock held */
 static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 {
@@ -875,11 +994,9 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
     stamp = get_clock();
 
     if (cpu) {
-        total = kvm_dirty_ring_reap_one(s, cpu);
+        total = kvm_dirty_ring_reap_one(s, cpu, false);
     } else {
-        CPU_FOREACH(cpu) {
-            total += kvm_dirty_ring_reap_one(s, cpu);
-        }
+        total = kvm_dirty_ring_reap_all(s);
     }
 
     if (total) {
@@ -890,6 +1007,7 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
     stamp = get_clock() - stamp;
 
     if (total) {
+        kvm_dirty_ring_account_reap(s, total, stamp);
         trace_kvm_dirty_ring_reap(total, stamp / 1000);
     }
 
@@ -3900,6 +4018,40 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->reaper.max_workers;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator "
+                   "has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (!value) {
+        error_setg(errp, "dirty-ring-reapers must be at least 1");
+        return;
+    }
+
+    s->reaper.max_workers = value;
+}
+
 static char *kvm_get_device(Object *obj,
                             Error **errp G_GNUC_UNUSED)
 {
@@ -3945,6 +4097,7 @@ static void kvm_accel_instance_init(Object *obj)
     /* KVM dirty ring is by default off */
     s->kvm_dirty_ring_size = 0;
     s->kvm_dirty_ring_with_bitmap = false;
+    s->reaper.max_workers = 8;
     s->kvm_eager_split_size = 0;
     s->notify_vmexit = NOTIFY_VMEXIT_OPTION_RUN;
     s->notify_window = 0;
@@ -3993,6 +4146,12 @@ static void kvm_accel_class_init(ObjectClass *oc, const void *data)
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 
+    object_class_property_add(oc, "dirty-ring-reapers", "uint32",
+        kvm_get_dirty_ring_reapers, kvm_set_dirty_ring_reapers,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-reapers",
+        "Maximum number of threads harvesting the KVM dirty rings (default: 8)");
+
     object_class_property_add_str(oc, "device", kvm_get_device, kvm_set_device);
     object_class_property_set_description(oc, "device",
         "Path to the device node to use (default: /dev/kvm)");
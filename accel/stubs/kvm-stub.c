@@ -125,6 +125,12 @@ uint32_t kvm_dirty_ring_size(void)
     return 0;
 }
 
+uint64_t kvm_dirty_ring_reap_stats(uint64_t *latency)
+{
+    memset(latency, 0, KVM_DIRTY_RING_REAP_HIST_SIZE * sizeof(*latency));
+    return 0;
+}
+
 bool kvm_hwpoisoned_mem(void)
 {
     return false;
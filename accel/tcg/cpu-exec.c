@@ -193,6 +193,7 @@ static bool tb_lookup_cmp(const void *p, const void *d)
 
 static TranslationBlock *tb_htable_lookup(CPUState *cpu, TCGTBCPUState s)
 {
+    TranslationBlock *tb, **l2;
     tb_page_addr_t phys_pc;
     struct tb_desc desc;
     uint32_t h;
@@ -206,7 +207,18 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu, TCGTBCPUState s)
     desc.page_addr0 = phys_pc;
     h = tb_hash_func(phys_pc, (s.cflags & CF_PCREL ? 0 : s.pc),
                      s.flags, s.cs_base, s.cflags);
-    return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+
+    l2 = &cpu->tb_jmp_cache->l2[tb_l2_cache_hash_func(h)];
+    tb = qatomic_read(l2);
+    if (tb && tb_lookup_cmp(tb, &desc)) {
+        return tb;
+    }
+
+    tb = qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+    if (tb) {
+        qatomic_set(l2, tb);
+    }
+    return tb;
 }
 
 /**
@@ -218,7 +230,8 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu, TCGTBCPUState s)
  * @cflags: CF_* flags
  *
  * Look up a translation block inside the QHT using @pc, @cs_base, @flags and
- * @cflags. Uses @cpu's tb_jmp_cache. Might cause an exception, so have a
+ * @cflags. Uses @cpu's tb_jmp_cache, first by virtual and then by physical
+ * PC, before falling back to the QHT. Might cause an exception, so have a
  * longjmp destination ready.
  *
  * Returns: an existing translation block or NULL.
@@ -284,8 +284,10 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
     desc->vindex = 0;
+    desc->lindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
+    memset(desc->laddr, -1, sizeof(desc->laddr));
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUState *cpu, int mmu_idx,
@@ -329,6 +331,7 @@ void tlb_init(CPUState *cpu)
 
     /* All tlbs are initialized flushed. */
     cpu->neg.tlb.c.dirty = 0;
+    cpu->neg.tlb.c.pending = g_new0(TLBFlushPending, 1);
 
     for (i = 0; i < NB_MMU_MODES; i++) {
         tlb_mmu_init(&cpu->neg.tlb.d[i], &cpu->neg.tlb.f[i], now);
@@ -340,6 +343,7 @@ void tlb_destroy(CPUState *cpu)
     int i;
 
     qemu_spin_destroy(&cpu->neg.tlb.c.lock);
+    g_free(cpu->neg.tlb.c.pending);
     for (i = 0; i < NB_MMU_MODES; i++) {
         CPUTLBDesc *desc = &cpu->neg.tlb.d[i];
         CPUTLBDescFast *fast = &cpu->neg.tlb.f[i];
@@ -349,24 +353,44 @@ void tlb_destroy(CPUState *cpu)
     }
 }
 
-/* flush_all_helper: run fn across all cpus
- *
- * If the wait flag is set then the src cpu's helper will be queued as
- * "safe" work and the loop exited creating a synchronisation point
- * where all queued work will be finished before execution starts
- * again.
+/*
+ * A flush of @len bytes at @addr, comparing @bits of the address,
+ * from the tlbs indicated by @idxmap.  When @bits is smaller than
+ * TARGET_PAGE_BITS, @addr and @len are ignored and each mmu_idx
+ * is flushed entirely.
  */
-static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
-                             run_on_cpu_data d)
-{
-    CPUState *cpu;
+typedef struct {
+    vaddr addr;
+    vaddr len;
+    uint16_t idxmap;
+    uint16_t bits;
+} TLBFlushRangeData;
 
-    CPU_FOREACH(cpu) {
-        if (cpu != src) {
-            async_run_on_cpu(cpu, fn, d);
-        }
-    }
-}
+/*
+ * Past this many distinct pending ranges, the pending flush of a cpu
+ * degrades to a full flush of every mmu_idx involved.
+ */
+#define TLB_FLUSH_PENDING_MAX 16
+
+/*
+ * Flushes requested by other cpus and not yet applied.  They are
+ * coalesced here and drained at once by the next queued work item,
+ * rather than queueing one work item per request.
+ * Protected by tlb_c.lock.
+ */
+typedef struct TLBFlushPending {
+    /* mmu_idx to flush entirely; no range below includes them */
+    uint16_t full_idxmap;
+    /* a drain is queued with async_run_on_cpu or async_safe_run_on_cpu */
+    bool queued;
+    /* a drain is queued with async_safe_run_on_cpu */
+    bool queued_safe;
+    unsigned n_range;
+    TLBFlushRangeData range[TLB_FLUSH_PENDING_MAX];
+} TLBFlushPending;
+
+static void tlb_flush_all_cpus_synced_pending(CPUState *src_cpu,
+                                              const TLBFlushRangeData *d);
 
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
@@ -424,12 +448,11 @@ void tlb_flush(CPUState *cpu)
 
 void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, uint16_t idxmap)
 {
-    const run_on_cpu_func fn = tlb_flush_by_mmuidx_async_work;
+    TLBFlushRangeData d = { .idxmap = idxmap };
 
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
-    async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    tlb_flush_all_cpus_synced_pending(src_cpu, &d);
 }
 
 void tlb_flush_all_cpus_synced(CPUState *src_cpu)
@@ -555,50 +578,6 @@ static void tlb_flush_page_by_mmuidx_async_0(CPUState *cpu,
     tb_jmp_cache_clear_page(cpu, addr);
 }
 
-/**
- * tlb_flush_page_by_mmuidx_async_1:
- * @cpu: cpu on which to flush
- * @data: encoded addr + idxmap
- *
- * Helper for tlb_flush_page_by_mmuidx and friends, called through
- * async_run_on_cpu.  The idxmap parameter is encoded in the page
- * offset of the target_ptr field.  This limits the set of mmu_idx
- * that can be passed via this method.
- */
-static void tlb_flush_page_by_mmuidx_async_1(CPUState *cpu,
-                                             run_on_cpu_data data)
-{
-    vaddr addr_and_idxmap = data.target_ptr;
-    vaddr addr = addr_and_idxmap & TARGET_PAGE_MASK;
-    uint16_t idxmap = addr_and_idxmap & ~TARGET_PAGE_MASK;
-
-    tlb_flush_page_by_mmuidx_async_0(cpu, addr, idxmap);
-}
-
-typedef struct {
-    vaddr addr;
-    uint16_t idxmap;
-} TLBFlushPageByMMUIdxData;
-
-/**
- * tlb_flush_page_by_mmuidx_async_2:
- * @cpu: cpu on which to flush
- * @data: allocated addr + idxmap
- *
- * Helper for tlb_flush_page_by_mmuidx and friends, called through
- * async_run_on_cpu.  The addr+idxmap parameters are stored in a
- * TLBFlushPageByMMUIdxData structure that has been allocated
- * specifically for this helper.  Free the structure when done.
- */
-static void tlb_flush_page_by_mmuidx_async_2(CPUState *cpu,
-                                             run_on_cpu_data data)
-{
-    TLBFlushPageByMMUIdxData *d = data.host_ptr;
-
-    tlb_flush_page_by_mmuidx_async_0(cpu, d->addr, d->idxmap);
-    g_free(d);
-}
-
 void tlb_flush_page_by_mmuidx(CPUState *cpu, vaddr addr, uint16_t idxmap)
 {
     tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%" PRIx16 "\n", addr, idxmap);
@@ -620,41 +599,17 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                               vaddr addr,
                                               uint16_t idxmap)
 {
-    tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%"PRIx16"\n", addr, idxmap);
-
-    /* This should already be page aligned */
-    addr &= TARGET_PAGE_MASK;
+    TLBFlushRangeData d = {
+        /* This should already be page aligned */
+        .addr = addr & TARGET_PAGE_MASK,
+        .len = TARGET_PAGE_SIZE,
+        .idxmap = idxmap,
+        .bits = target_long_bits(),
+    };
 
-    /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
-     */
-    if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-        async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                              RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-    } else {
-        CPUState *dst_cpu;
-        TLBFlushPageByMMUIdxData *d;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
+    tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%"PRIx16"\n", addr, idxmap);
 
-        d = g_new(TLBFlushPageByMMUIdxData, 1);
-        d->addr = addr;
-        d->idxmap = idxmap;
-        async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
-                              RUN_ON_CPU_HOST_PTR(d));
-    }
+    tlb_flush_all_cpus_synced_pending(src_cpu, &d);
 }
 
 void tlb_flush_page_all_cpus_synced(CPUState *src, vaddr addr)
@@ -712,13 +667,6 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
     }
 }
 
-typedef struct {
-    vaddr addr;
-    vaddr len;
-    uint16_t idxmap;
-    uint16_t bits;
-} TLBFlushRangeData;
-
 static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
                                               TLBFlushRangeData d)
 {
@@ -757,12 +705,151 @@ static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
     }
 }
 
-static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
-                                              run_on_cpu_data data)
+/*
+ * Add @d to the pending flushes @p, merging it with a pending range
+ * of the same kind that it overlaps or abuts.
+ */
+static void tlb_flush_pending_add_locked(TLBFlushPending *p,
+                                         const TLBFlushRangeData *d)
 {
-    TLBFlushRangeData *d = data.host_ptr;
-    tlb_flush_range_by_mmuidx_async_0(cpu, *d);
-    g_free(d);
+    uint16_t idxmap = d->idxmap & ~p->full_idxmap;
+    vaddr end = d->addr + d->len;
+    unsigned i, j;
+
+    if (idxmap == 0) {
+        return;
+    }
+
+    if (d->bits < TARGET_PAGE_BITS) {
+        p->full_idxmap |= idxmap;
+        /* Drop the parts of the pending ranges that are now redundant. */
+        for (i = j = 0; i < p->n_range; i++) {
+            p->range[i].idxmap &= ~idxmap;
+            if (p->range[i].idxmap) {
+                p->range[j++] = p->range[i];
+            }
+        }
+        p->n_range = j;
+        return;
+    }
+
+    for (i = 0; i < p->n_range; i++) {
+        TLBFlushRangeData *r = &p->range[i];
+        vaddr r_end = r->addr + r->len;
+
+        /* Ranges that wrap around the address space are never merged. */
+        if (r->idxmap == idxmap && r->bits == d->bits &&
+            end > d->addr && r_end > r->addr &&
+            d->addr <= r_end && r->addr <= end) {
+            r->addr = MIN(r->addr, d->addr);
+            r->len = MAX(r_end, end) - r->addr;
+            return;
+        }
+    }
+
+    if (p->n_range == TLB_FLUSH_PENDING_MAX) {
+        for (i = 0; i < p->n_range; i++) {
+            p->full_idxmap |= p->range[i].idxmap;
+        }
+        p->full_idxmap |= idxmap;
+        p->n_range = 0;
+        return;
+    }
+
+    p->range[p->n_range] = *d;
+    p->range[p->n_range].idxmap = idxmap;
+    p->n_range++;
+}
+
+/*
+ * Apply all flushes pending for @cpu.  @data is nonzero when called
+ * as safe work, i.e. for the cpu that requested a synced flush.
+ */
+static void tlb_flush_pending_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    TLBFlushPending *p = cpu->neg.tlb.c.pending;
+    TLBFlushRangeData range[TLB_FLUSH_PENDING_MAX];
+    uint16_t full_idxmap;
+    unsigned i, n;
+
+    assert_cpu_is_self(cpu);
+
+    qemu_spin_lock(&cpu->neg.tlb.c.lock);
+    full_idxmap = p->full_idxmap;
+    n = p->n_range;
+    memcpy(range, p->range, n * sizeof(range[0]));
+    p->full_idxmap = 0;
+    p->n_range = 0;
+    p->queued = false;
+    if (data.host_int) {
+        p->queued_safe = false;
+    }
+    qemu_spin_unlock(&cpu->neg.tlb.c.lock);
+
+    if (full_idxmap) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(full_idxmap));
+    }
+    for (i = 0; i < n; i++) {
+        if (range[i].len == TARGET_PAGE_SIZE &&
+            range[i].bits >= target_long_bits()) {
+            tlb_flush_page_by_mmuidx_async_0(cpu, range[i].addr,
+                                             range[i].idxmap);
+        } else {
+            tlb_flush_range_by_mmuidx_async_0(cpu, range[i]);
+        }
+    }
+}
+
+/*
+ * Record @d as pending on @cpu, and make sure that a drain is queued.
+ * For the source of a synced flush, the drain is queued as safe work:
+ * this creates the synchronisation point where all queued work will be
+ * finished before execution starts again.  A work item that is already
+ * queued and has not started yet will see @d, so further requests in a
+ * burst only cost a lock round trip.
+ */
+static void tlb_flush_queue(CPUState *cpu, const TLBFlushRangeData *d,
+                            bool safe)
+{
+    TLBFlushPending *p = cpu->neg.tlb.c.pending;
+    bool queue;
+
+    qemu_spin_lock(&cpu->neg.tlb.c.lock);
+    tlb_flush_pending_add_locked(p, d);
+    queue = safe ? !p->queued_safe : !p->queued;
+    if (queue) {
+        p->queued = true;
+        p->queued_safe |= safe;
+        qatomic_set(&cpu->neg.tlb.c.issued_flush_count,
+                    cpu->neg.tlb.c.issued_flush_count + 1);
+    } else {
+        qatomic_set(&cpu->neg.tlb.c.coalesced_flush_count,
+                    cpu->neg.tlb.c.coalesced_flush_count + 1);
+    }
+    qemu_spin_unlock(&cpu->neg.tlb.c.lock);
+
+    if (queue) {
+        if (safe) {
+            async_safe_run_on_cpu(cpu, tlb_flush_pending_async_work,
+                                  RUN_ON_CPU_HOST_INT(1));
+        } else {
+            async_run_on_cpu(cpu, tlb_flush_pending_async_work,
+                             RUN_ON_CPU_HOST_INT(0));
+        }
+    }
+}
+
+static void tlb_flush_all_cpus_synced_pending(CPUState *src_cpu,
+                                              const TLBFlushRangeData *d)
+{
+    CPUState *dst_cpu;
+
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            tlb_flush_queue(dst_cpu, d, false);
+        }
+    }
+    tlb_flush_queue(src_cpu, d, true);
 }
 
 void tlb_flush_range_by_mmuidx(CPUState *cpu, vaddr addr,
@@ -808,8 +895,7 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                                uint16_t idxmap,
                                                unsigned bits)
 {
-    TLBFlushRangeData d, *p;
-    CPUState *dst_cpu;
+    TLBFlushRangeData d;
 
     /* If no page bits are significant, this devolves to tlb_flush. */
     if (bits < TARGET_PAGE_BITS) {
@@ -831,18 +917,7 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
-    CPU_FOREACH(dst_cpu) {
-        if (dst_cpu != src_cpu) {
-            p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
-        }
-    }
-
-    p = g_memdup(&d, sizeof(d));
-    async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_1,
-                          RUN_ON_CPU_HOST_PTR(p));
+    tlb_flush_all_cpus_synced_pending(src_cpu, &d);
 }
 
 void tlb_flush_page_bits_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
@@ -972,6 +1047,45 @@ static void tlb_set_dirty(CPUState *cpu, vaddr addr)
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 }
 
+/*
+ * Remember the translation for the whole large page containing @addr,
+ * for use by large_tlb_hit.  This is only done if tlb_fill reported
+ * that the page is uniform.  Since tlb_add_large_page covers the same
+ * page, flushing any part of it flushes the table as well.
+ */
+static void tlb_add_large_page_full(CPUState *cpu, int mmu_idx, vaddr addr,
+                                    uint64_t size, CPUTLBEntryFull *full)
+{
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+    vaddr lp_mask = ~(vaddr)(size - 1);
+    vaddr lp_addr = addr & lp_mask;
+    unsigned lidx;
+
+    /*
+     * Only a page that is contiguous and has uniform permissions can be
+     * shared; pages that must be refilled on every write cannot be.
+     */
+    if (!full->lg_page_uniform || (full->prot & PAGE_WRITE_INV)) {
+        return;
+    }
+
+    for (lidx = 0; lidx < CPU_LTLB_SIZE; lidx++) {
+        if (desc->laddr[lidx] == lp_addr && desc->lmask[lidx] == lp_mask) {
+            break;
+        }
+    }
+    if (lidx == CPU_LTLB_SIZE) {
+        lidx = desc->lindex++ % CPU_LTLB_SIZE;
+    }
+
+    desc->laddr[lidx] = lp_addr;
+    desc->lmask[lidx] = lp_mask;
+    desc->lfulltlb[lidx] = *full;
+    desc->lfulltlb[lidx].phys_addr =
+        (full->phys_addr & TARGET_PAGE_MASK) -
+        ((addr & TARGET_PAGE_MASK) - lp_addr);
+}
+
 /* Our TLB does not support large pages, so remember the area covered by
    large pages and trigger a full TLB flush if these are invalidated.  */
 static void tlb_add_large_page(CPUState *cpu, int mmu_idx,
@@ -1043,6 +1157,7 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
     } else {
         sz = (hwaddr)1 << full->lg_page_size;
         tlb_add_large_page(cpu, mmu_idx, addr, sz);
+        tlb_add_large_page_full(cpu, mmu_idx, addr, sz, full);
     }
     addr_page = addr & TARGET_PAGE_MASK;
     paddr_page = full->phys_addr & TARGET_PAGE_MASK;
@@ -1334,6 +1449,40 @@ static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
     return false;
 }
 
+/*
+ * Return true if ADDR is within a large page remembered from a previous
+ * tlb_fill, and its small page has been entered into the main tlb
+ * without calling tlb_fill again.  Everything that depends on the small
+ * page (memory region, dirty tracking, watchpoints) is still computed
+ * by tlb_set_page_full.
+ */
+static bool large_tlb_hit(CPUState *cpu, size_t mmu_idx,
+                          MMUAccessType access_type, vaddr addr)
+{
+    static const int access_prot[] = {
+        [MMU_DATA_LOAD] = PAGE_READ,
+        [MMU_DATA_STORE] = PAGE_WRITE,
+        [MMU_INST_FETCH] = PAGE_EXEC,
+    };
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+    size_t lidx;
+
+    assert_cpu_is_self(cpu);
+    for (lidx = 0; lidx < CPU_LTLB_SIZE; ++lidx) {
+        vaddr lp_mask = desc->lmask[lidx];
+
+        if ((addr & lp_mask) == desc->laddr[lidx] &&
+            (desc->lfulltlb[lidx].prot & access_prot[access_type])) {
+            CPUTLBEntryFull full = desc->lfulltlb[lidx];
+
+            full.phys_addr += (addr & ~lp_mask) & TARGET_PAGE_MASK;
+            tlb_set_page_full(cpu, mmu_idx, addr, &full);
+            return true;
+        }
+    }
+    return false;
+}
+
 static void notdirty_write(CPUState *cpu, vaddr mem_vaddr, unsigned size,
                            CPUTLBEntryFull *full, uintptr_t retaddr)
 {
@@ -1373,7 +1522,8 @@ static int probe_access_internal(CPUState *cpu, vaddr addr,
     CPUTLBEntryFull *full;
 
     if (!tlb_hit_page(tlb_addr, page_addr)) {
-        if (!victim_tlb_hit(cpu, mmu_idx, index, access_type, page_addr)) {
+        if (!victim_tlb_hit(cpu, mmu_idx, index, access_type, page_addr) &&
+            !large_tlb_hit(cpu, mmu_idx, access_type, addr)) {
             if (!tlb_fill_align(cpu, addr, access_type, mmu_idx,
                                 0, fault_size, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
@@ -1654,7 +1804,8 @@ static bool mmu_lookup1(CPUState *cpu, MMULookupPageData *data, MemOp memop,
     /* If the TLB entry is for a different page, reload and try again.  */
     if (!tlb_hit(tlb_addr, addr)) {
         if (!victim_tlb_hit(cpu, mmu_idx, index, access_type,
-                            addr & TARGET_PAGE_MASK)) {
+                            addr & TARGET_PAGE_MASK) &&
+            !large_tlb_hit(cpu, mmu_idx, access_type, addr)) {
             tlb_fill_align(cpu, addr, access_type, mmu_idx,
                            memop, data->size, false, ra);
             maybe_resized = true;
@@ -1828,7 +1979,8 @@ static void *atomic_mmu_lookup(CPUState *cpu, vaddr addr, MemOpIdx oi,
     tlb_addr = tlb_addr_write(tlbe);
     if (!tlb_hit(tlb_addr, addr)) {
         if (!victim_tlb_hit(cpu, mmu_idx, index, MMU_DATA_STORE,
-                            addr & TARGET_PAGE_MASK)) {
+                            addr & TARGET_PAGE_MASK) &&
+            !large_tlb_hit(cpu, mmu_idx, MMU_DATA_STORE, addr)) {
             tlb_fill_align(cpu, addr, MMU_DATA_STORE, mmu_idx,
                            mop, size, false, retaddr);
             did_tlb_fill = true;
@@ -137,6 +137,13 @@ G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 #endif /* CONFIG_USER_ONLY */
 
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
+
+/*
+ * Make room in the code buffer by evicting its oldest region, or by
+ * flushing everything if no region can be evicted.  Like tb_flush(),
+ * this runs in an exclusive context.
+ */
+void tb_evict(CPUState *cpu);
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr);
 
 #endif
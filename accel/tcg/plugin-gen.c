@@ -218,6 +218,89 @@ static void gen_mem_cb(struct qemu_plugin_regular_cb *cb,
     tcg_temp_free_i32(cpu_index);
 }
 
+static TCGv_ptr gen_mem_buffer_ptr(struct qemu_plugin_mem_buffer *buf)
+{
+    qemu_plugin_u64 count = { .score = buf->score, .offset = 0 };
+
+    return gen_plugin_u64_ptr(count);
+}
+
+/*
+ * Append a record to the buffer of the current vCPU. The buffer is
+ * drained before the instruction starts (see gen_mem_append_check),
+ * so there is no call here. If the instruction does more accesses than
+ * were counted, the extra records go to a spare slot past the end of the
+ * buffer and are counted as dropped.
+ */
+static void gen_mem_append_cb(struct qemu_plugin_mem_append_cb *cb,
+                              qemu_plugin_meminfo_t meminfo, TCGv_i64 addr)
+{
+    TCGv_ptr ptr = gen_mem_buffer_ptr(cb->buf);
+    TCGv_ptr rec = tcg_temp_ebb_new_ptr();
+    TCGv_i64 idx = tcg_temp_ebb_new_i64();
+    TCGv_i64 off = tcg_temp_ebb_new_i64();
+    TCGv_i64 full = tcg_temp_ebb_new_i64();
+    TCGv_i64 dropped = tcg_temp_ebb_new_i64();
+    TCGv_i64 nr_records = tcg_constant_i64(cb->buf->nr_records);
+    intptr_t base = 2 * sizeof(uint64_t);
+
+    tcg_gen_ld_i64(idx, ptr, 0);
+    tcg_gen_setcond_i64(TCG_COND_GEU, full, idx, nr_records);
+    tcg_gen_umin_i64(idx, idx, nr_records);
+    tcg_gen_shli_i64(off, idx, ctz32(sizeof(qemu_plugin_mem_record)));
+    tcg_gen_trunc_i64_ptr(rec, off);
+    tcg_gen_add_ptr(rec, rec, ptr);
+
+    tcg_gen_st_i64(addr, rec, base + offsetof(qemu_plugin_mem_record, vaddr));
+    tcg_gen_st_i32(tcg_constant_i32(meminfo), rec,
+                   base + offsetof(qemu_plugin_mem_record, info));
+    tcg_gen_st_i32(tcg_constant_i32(cb->tag), rec,
+                   base + offsetof(qemu_plugin_mem_record, tag));
+
+    tcg_gen_addi_i64(idx, idx, 1);
+    tcg_gen_sub_i64(idx, idx, full);
+    tcg_gen_st_i64(idx, ptr, 0);
+
+    tcg_gen_ld_i64(dropped, ptr, sizeof(uint64_t));
+    tcg_gen_add_i64(dropped, dropped, full);
+    tcg_gen_st_i64(dropped, ptr, sizeof(uint64_t));
+
+    tcg_temp_free_i64(dropped);
+    tcg_temp_free_i64(full);
+    tcg_temp_free_i64(off);
+    tcg_temp_free_i64(idx);
+    tcg_temp_free_ptr(rec);
+    tcg_temp_free_ptr(ptr);
+}
+
+/*
+ * Drain the buffer if the @n_records appends of the next instruction
+ * might not fit. This happens at the start of the instruction because
+ * the memory callbacks are injected in the middle of guest code, where
+ * we cannot branch.
+ */
+static void gen_mem_append_check(struct qemu_plugin_mem_append_cb *cb,
+                                 size_t n_records)
+{
+    size_t nr_records = cb->buf->nr_records;
+    TCGv_ptr ptr = gen_mem_buffer_ptr(cb->buf);
+    TCGv_i64 val = tcg_temp_ebb_new_i64();
+    TCGLabel *after_cb = gen_new_label();
+
+    tcg_gen_ld_i64(val, ptr, 0);
+    tcg_gen_brcondi_i64(TCG_COND_LEU, val,
+                        nr_records - MIN(n_records, nr_records), after_cb);
+    TCGv_i32 cpu_index = gen_cpu_index();
+    tcg_gen_call2(qemu_plugin_vcpu_mem_buffer_drain, cb->info, NULL,
+                  tcgv_i32_temp(cpu_index),
+                  tcgv_ptr_temp(tcg_constant_ptr(cb->buf)));
+    tcg_temp_free_i32(cpu_index);
+    gen_set_label(after_cb);
+
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+}
+
 static void inject_cb(struct qemu_plugin_dyn_cb *cb)
 
 {
@@ -255,11 +338,59 @@ static void inject_mem_cb(struct qemu_plugin_dyn_cb *cb,
             inject_cb(cb);
         }
         break;
+    case PLUGIN_CB_INLINE_MEM_APPEND:
+        if (rw & cb->mem_append.rw) {
+            gen_mem_append_cb(&cb->mem_append, meminfo, addr);
+        }
+        break;
     default:
         g_assert_not_reached();
     }
 }
 
+/* Count the memory callbacks of the instruction that starts after @op */
+static size_t plugin_count_mem_cbs(TCGOp *op)
+{
+    size_t n = 0;
+
+    for (op = QTAILQ_NEXT(op, link);
+         op && op->opc != INDEX_op_insn_start;
+         op = QTAILQ_NEXT(op, link)) {
+        n += op->opc == INDEX_op_plugin_mem_cb;
+    }
+    return n;
+}
+
+static void inject_mem_append_checks(struct qemu_plugin_insn *insn,
+                                     TCGOp *op)
+{
+    const GArray *cbs = insn->mem_cbs;
+    size_t i, n, n_append = 0, n_mem;
+
+    for (i = 0, n = (cbs ? cbs->len : 0); i < n; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+        n_append += cb->type == PLUGIN_CB_INLINE_MEM_APPEND;
+    }
+    if (!n_append) {
+        return;
+    }
+
+    /* Accesses done by helpers append out of line, and drain on their own */
+    n_mem = plugin_count_mem_cbs(op);
+    if (!n_mem) {
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        struct qemu_plugin_dyn_cb *cb =
+            &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+        if (cb->type == PLUGIN_CB_INLINE_MEM_APPEND) {
+            gen_mem_append_check(&cb->mem_append, n_mem * n_append);
+        }
+    }
+}
+
 static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
 {
     TCGOp *op, *next;
@@ -336,6 +467,7 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                     inject_cb(
                         &g_array_index(cbs, struct qemu_plugin_dyn_cb, i));
                 }
+                inject_mem_append_checks(insn, op);
                 break;
 
             default:
@@ -15,6 +15,9 @@
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
 
+#define TB_L2_CACHE_BITS 14
+#define TB_L2_CACHE_SIZE (1 << TB_L2_CACHE_BITS)
+
 /*
  * Invalidated in parallel; all accesses to 'tb' must be atomic.
  * A valid entry is read/written by a single CPU, therefore there is
@@ -28,6 +31,20 @@ typedef struct CPUJumpCache {
         TranslationBlock *tb;
         vaddr pc;
     } array[TB_JMP_CACHE_SIZE];
+    /*
+     * Second level, indexed by the tb_hash_func() hash of the physical
+     * lookup key, so that misses in 'array' can be served without
+     * touching the buckets of the shared tb_ctx.htable.  The full key
+     * is compared on every hit, which also rejects CF_INVALID TBs.
+     * Entries are cleared by do_tb_phys_invalidate() on any CPU, and
+     * wholesale under exclusive context on tb_flush() and eviction.
+     */
+    TranslationBlock *l2[TB_L2_CACHE_SIZE];
 } CPUJumpCache;
 
+static inline unsigned int tb_l2_cache_hash_func(uint32_t h)
+{
+    return h & (TB_L2_CACHE_SIZE - 1);
+}
+
 #endif /* ACCEL_TCG_TB_JMP_CACHE_H */
@@ -756,6 +756,16 @@ static void tb_remove(TranslationBlock *tb)
 }
 #endif /* CONFIG_USER_ONLY */
 
+/* Call with all CPUs stopped, e.g. from a safe work item. */
+static void tb_l2_cache_flush(CPUState *cpu)
+{
+    CPUJumpCache *jc = cpu->tb_jmp_cache;
+
+    if (jc) {
+        memset(jc->l2, 0, sizeof(jc->l2));
+    }
+}
+
 /* flush all the translation blocks */
 static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 {
@@ -770,6 +780,7 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 
     CPU_FOREACH(cpu) {
         tcg_flush_jmp_cache(cpu);
+        tb_l2_cache_flush(cpu);
     }
 
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
@@ -876,10 +887,20 @@ static inline void tb_jmp_unlink(TranslationBlock *dest)
     qemu_spin_unlock(&dest->jmp_lock);
 }
 
-static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
+static void tb_jmp_cache_inval_tb(TranslationBlock *tb, uint32_t hash)
 {
+    unsigned int l2_hash = tb_l2_cache_hash_func(hash);
     CPUState *cpu;
 
+    /* The second level is keyed by physical address, even for CF_PCREL */
+    CPU_FOREACH(cpu) {
+        CPUJumpCache *jc = cpu->tb_jmp_cache;
+
+        if (qatomic_read(&jc->l2[l2_hash]) == tb) {
+            qatomic_set(&jc->l2[l2_hash], NULL);
+        }
+    }
+
     if (tb_cflags(tb) & CF_PCREL) {
         /* A TB may be at any virtual address */
         CPU_FOREACH(cpu) {
@@ -903,7 +924,8 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
  * In !user-mode, if @rm_from_page_list is set, call with the TB's pages'
  * locks held.
  */
-static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
+static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list,
+                                  bool inval_jmp_cache)
 {
     uint32_t h;
     tb_page_addr_t phys_pc;
@@ -930,7 +952,9 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     }
 
     /* remove the TB from the hash list */
-    tb_jmp_cache_inval_tb(tb);
+    if (inval_jmp_cache) {
+        tb_jmp_cache_inval_tb(tb, h);
+    }
 
     /* suppress this TB from the two jump lists */
     tb_remove_from_jmp_list(tb, 0);
@@ -946,7 +970,7 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
 static void tb_phys_invalidate__locked(TranslationBlock *tb)
 {
     qemu_thread_jit_write();
-    do_tb_phys_invalidate(tb, true);
+    do_tb_phys_invalidate(tb, true, true);
     qemu_thread_jit_execute();
 }
 
@@ -958,10 +982,74 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 {
     if (page_addr == -1 && tb_page_addr0(tb) != -1) {
         tb_lock_pages(tb);
-        do_tb_phys_invalidate(tb, true);
+        do_tb_phys_invalidate(tb, true, true);
         tb_unlock_pages(tb);
     } else {
-        do_tb_phys_invalidate(tb, false);
+        do_tb_phys_invalidate(tb, false, true);
+    }
+}
+
+/*
+ * Invalidate a TB whose region is being evicted.  The jump caches are
+ * flushed once for the whole region by the caller.
+ */
+static void tb_evict_invalidate(TranslationBlock *tb)
+{
+    if (tb_page_addr0(tb) == -1) {
+        /* One-shot TBs are never linked or added to the QHT */
+        return;
+    }
+    tb_lock_pages(tb);
+    do_tb_phys_invalidate(tb, true, false);
+    tb_unlock_pages(tb);
+}
+
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_flush_count)
+{
+    ssize_t nb_tbs = -1;
+
+    mmap_lock();
+    /*
+     * If another CPU has already made room, or flushed everything,
+     * just retry.
+     */
+    if (tb_ctx.tb_flush_count != tb_flush_count.host_int ||
+        tcg_region_has_free()) {
+        mmap_unlock();
+        return;
+    }
+
+    qemu_thread_jit_write();
+    nb_tbs = tcg_region_evict(tb_evict_invalidate);
+    qemu_thread_jit_execute();
+    if (nb_tbs >= 0) {
+        CPU_FOREACH(cpu) {
+            tcg_flush_jmp_cache(cpu);
+            tb_l2_cache_flush(cpu);
+        }
+        qatomic_inc(&tb_ctx.tb_evict_count);
+        qatomic_set(&tb_ctx.tb_evict_tb_count,
+                    tb_ctx.tb_evict_tb_count + nb_tbs);
+    }
+    mmap_unlock();
+
+    /* Every region is in use by some TCG context; fall back to a flush. */
+    if (nb_tbs < 0) {
+        do_tb_flush(cpu, tb_flush_count);
+    }
+}
+
+void tb_evict(CPUState *cpu)
+{
+    if (tcg_enabled()) {
+        unsigned tb_flush_count = qatomic_read(&tb_ctx.tb_flush_count);
+
+        if (cpu_in_serial_context(cpu)) {
+            do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(tb_flush_count));
+        } else {
+            async_safe_run_on_cpu(cpu, do_tb_evict,
+                                  RUN_ON_CPU_HOST_INT(tb_flush_count));
+        }
     }
 }
 
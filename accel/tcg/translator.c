@@ -19,6 +19,7 @@
 #include "tcg/tcg-op-common.h"
 #include "internal-common.h"
 #include "disas/disas.h"
+#include "tcg/perf.h"
 #include "tb-internal.h"
 
 static void set_can_do_io(DisasContextBase *db, bool val)
@@ -119,6 +120,25 @@ bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
     return translator_is_same_page(db, dest);
 }
 
+/* Count executions of the block for -tbprof. */
+static void gen_tb_exec_count(DisasContextBase *db)
+{
+    uint64_t *count = perf_tbprof_counter(db->pc_first,
+                                          tb_page_addr0(db->tb));
+    TCGv_i64 val;
+    TCGv_ptr ptr;
+
+    if (!count) {
+        return;
+    }
+
+    ptr = tcg_constant_ptr(count);
+    val = tcg_temp_new_i64();
+    tcg_gen_ld_i64(val, ptr, 0);
+    tcg_gen_addi_i64(val, val, 1);
+    tcg_gen_st_i64(val, ptr, 0);
+}
+
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
                      vaddr pc, void *host_pc, const TranslatorOps *ops,
                      DisasContextBase *db)
@@ -148,6 +168,7 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
 
     /* Start translating.  */
     icount_start_insn = gen_tb_start(db, cflags);
+    gen_tb_exec_count(db);
     ops->tb_start(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
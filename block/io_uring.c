@@ -12,6 +12,9 @@
 #include <liburing.h>
 #include "block/aio.h"
 #include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "qemu/bitmap.h"
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
@@ -26,6 +29,20 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Number of slots in each ring's fixed file table */
+#define MAX_FIXED_FILES 64
+
+/* Kernel limits for the fixed buffer table */
+#define MAX_FIXED_BUFS 16384
+#define MAX_FIXED_BUF_SIZE (1 * GiB)
+
+/* One slot of the fixed buffer table, for lookups by address */
+typedef struct LuringFixedSlot {
+    uintptr_t start;
+    uintptr_t end;
+    unsigned index;
+} LuringFixedSlot;
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -34,6 +51,12 @@ typedef struct LuringAIOCB {
     bool is_read;
     QSIMPLEQ_ENTRY(LuringAIOCB) next;
 
+    /* Original request, used to prepare the sqe again on resubmission */
+    int fd;
+    uint64_t offset;
+    int type;
+    BdrvRequestFlags flags;
+
     /*
      * Buffered reads may require resubmission, see
      * luring_resubmit_short_read().
@@ -58,8 +81,420 @@ struct LuringState {
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /*
+     * Fixed file table.  Slots are filled on first use of an fd and
+     * emptied by luring_unregister_fd() from the main loop thread, which
+     * is why they are read and written with atomics.
+     */
+    bool has_fixed_files;
+    int fixed_fds[MAX_FIXED_FILES];
+
+    /*
+     * Fixed buffer table.  Slots are filled and emptied by
+     * luring_register_buf() and luring_unregister_buf() from the main
+     * loop thread, and fixed_bufs_ok tells which ones are filled.
+     * fixed_bufs is a sorted copy of the filled slots for the home
+     * thread, refreshed when bufs_generation is out of date.
+     */
+    bool has_fixed_bufs;
+    unsigned long *fixed_bufs_ok;
+    unsigned bufs_generation;
+    LuringFixedSlot *fixed_bufs;
+    unsigned nr_fixed_bufs;
+
+    QLIST_ENTRY(LuringState) next;
 };
 
+typedef struct LuringFixedBuf {
+    void *host;
+    size_t size;
+    unsigned refcnt;
+    /* Range of the fixed buffer table, empty if the table was full */
+    unsigned first_slot;
+    unsigned nr_slots;
+} LuringFixedBuf;
+
+/*
+ * Memory registered through luring_register_buf().  Each buffer takes a
+ * range of slots in the fixed buffer table of every ring, so registering
+ * or unregistering it leaves the other buffers alone.
+ *
+ * @lock protects the list of rings and their fixed file tables, and is
+ * held while the rings pin memory.  @bufs_lock protects the rest; it is
+ * only held briefly, so that rings are not stalled while memory is being
+ * pinned.  Take @lock first if both are needed.
+ */
+static struct {
+    QemuMutex lock;
+    QLIST_HEAD(, LuringState) rings;
+
+    QemuMutex bufs_lock;
+    GArray *bufs;               /* LuringFixedBuf */
+    unsigned long *used_slots;
+    unsigned bufs_generation;
+} luring_fixed;
+
+static void __attribute__((__constructor__)) luring_fixed_init(void)
+{
+    qemu_mutex_init(&luring_fixed.lock);
+    QLIST_INIT(&luring_fixed.rings);
+    qemu_mutex_init(&luring_fixed.bufs_lock);
+    luring_fixed.bufs = g_array_new(false, false, sizeof(LuringFixedBuf));
+    luring_fixed.used_slots = bitmap_new(MAX_FIXED_BUFS);
+}
+
+/*
+ * Fill the slots of @buf in the fixed buffer table of @s, or empty them
+ * if @fill is false.  Called with luring_fixed.lock held.
+ */
+static void luring_update_fixed_bufs(LuringState *s, LuringFixedBuf *buf,
+                                     bool fill)
+{
+#ifdef HAVE_IO_URING_REGISTER_BUFFERS_SPARSE
+    g_autofree struct iovec *iovs = NULL;
+    unsigned i;
+    int ret;
+
+    if (!s->has_fixed_bufs || !buf->nr_slots) {
+        return;
+    }
+
+    iovs = g_new0(struct iovec, buf->nr_slots);
+
+    if (fill) {
+        for (i = 0; i < buf->nr_slots; i++) {
+            size_t off = (size_t)i * MAX_FIXED_BUF_SIZE;
+
+            iovs[i].iov_base = buf->host + off;
+            iovs[i].iov_len = MIN(buf->size - off, MAX_FIXED_BUF_SIZE);
+        }
+    } else {
+        bitmap_test_and_clear_atomic(s->fixed_bufs_ok, buf->first_slot,
+                                     buf->nr_slots);
+    }
+
+    /* Pins or unpins the memory; requests in flight keep the old pages */
+    ret = io_uring_register_buffers_update_tag(&s->ring, buf->first_slot,
+                                               iovs, NULL, buf->nr_slots);
+    trace_luring_update_buffers(s, buf->first_slot, buf->nr_slots, fill, ret);
+
+    if (fill && ret == (int)buf->nr_slots) {
+        bitmap_set_atomic(s->fixed_bufs_ok, buf->first_slot, buf->nr_slots);
+    }
+#endif
+}
+
+void luring_register_buf(void *host, size_t size)
+{
+    LuringFixedBuf buf = {
+        .host = host,
+        .size = size,
+        .refcnt = 1,
+        .nr_slots = DIV_ROUND_UP(size, MAX_FIXED_BUF_SIZE),
+    };
+    LuringState *s;
+    unsigned i;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    WITH_QEMU_LOCK_GUARD(&luring_fixed.bufs_lock) {
+        for (i = 0; i < luring_fixed.bufs->len; i++) {
+            LuringFixedBuf *b = &g_array_index(luring_fixed.bufs,
+                                               LuringFixedBuf, i);
+            if (b->host == host && b->size == size) {
+                b->refcnt++;
+                return;
+            }
+        }
+
+        buf.first_slot = bitmap_find_next_zero_area(luring_fixed.used_slots,
+                                                    MAX_FIXED_BUFS, 0,
+                                                    buf.nr_slots, 0);
+        if (buf.first_slot + buf.nr_slots > MAX_FIXED_BUFS) {
+            /* Requests on this memory use vectored I/O */
+            buf.first_slot = 0;
+            buf.nr_slots = 0;
+        }
+        bitmap_set(luring_fixed.used_slots, buf.first_slot, buf.nr_slots);
+    }
+
+    QLIST_FOREACH(s, &luring_fixed.rings, next) {
+        luring_update_fixed_bufs(s, &buf, true);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&luring_fixed.bufs_lock) {
+        g_array_append_val(luring_fixed.bufs, buf);
+        qatomic_set(&luring_fixed.bufs_generation,
+                    luring_fixed.bufs_generation + 1);
+    }
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+    LuringFixedBuf buf;
+    LuringState *s;
+    unsigned i;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+
+    WITH_QEMU_LOCK_GUARD(&luring_fixed.bufs_lock) {
+        for (i = 0; i < luring_fixed.bufs->len; i++) {
+            LuringFixedBuf *b = &g_array_index(luring_fixed.bufs,
+                                               LuringFixedBuf, i);
+            if (b->host == host && b->size == size) {
+                break;
+            }
+        }
+        if (i == luring_fixed.bufs->len) {
+            return;
+        }
+        buf = g_array_index(luring_fixed.bufs, LuringFixedBuf, i);
+        if (--g_array_index(luring_fixed.bufs, LuringFixedBuf, i).refcnt) {
+            return;
+        }
+        g_array_remove_index_fast(luring_fixed.bufs, i);
+        qatomic_set(&luring_fixed.bufs_generation,
+                    luring_fixed.bufs_generation + 1);
+    }
+
+    /*
+     * Requests prepared before the rings noticed fail with EFAULT once the
+     * slots are empty, and are then submitted again without a fixed buffer.
+     */
+    QLIST_FOREACH(s, &luring_fixed.rings, next) {
+        luring_update_fixed_bufs(s, &buf, false);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&luring_fixed.bufs_lock) {
+        bitmap_clear(luring_fixed.used_slots, buf.first_slot, buf.nr_slots);
+    }
+}
+
+/*
+ * Drop @fd from the fixed file table of every ring.  This must be called
+ * before @fd is closed, and while no request can be submitted on it: the
+ * ring keeps a reference to the open file, and with it any OFD locks, for
+ * as long as the fd is in its table.
+ */
+void luring_unregister_fd(int fd)
+{
+    LuringState *s;
+    int i;
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+    QLIST_FOREACH(s, &luring_fixed.rings, next) {
+        for (i = 0; i < MAX_FIXED_FILES; i++) {
+            if (qatomic_read(&s->fixed_fds[i]) == fd) {
+                int empty = -1;
+
+                io_uring_register_files_update(&s->ring, i, &empty, 1);
+                qatomic_set(&s->fixed_fds[i], -1);
+            }
+        }
+    }
+}
+
+/*
+ * Return the fixed file slot for @fd, registering it if needed, or -1 if
+ * the table is full or unavailable.
+ */
+static int luring_fixed_file(LuringState *s, int fd)
+{
+    int i, free_slot = -1;
+    int ret;
+
+    if (!s->has_fixed_files) {
+        return -1;
+    }
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        int slot_fd = qatomic_read(&s->fixed_fds[i]);
+
+        if (slot_fd == fd) {
+            return i;
+        }
+        if (slot_fd == -1 && free_slot == -1) {
+            free_slot = i;
+        }
+    }
+    if (free_slot == -1) {
+        return -1;
+    }
+
+    QEMU_LOCK_GUARD(&luring_fixed.lock);
+    ret = io_uring_register_files_update(&s->ring, free_slot, &fd, 1);
+    trace_luring_register_file(s, fd, free_slot, ret);
+    if (ret != 1) {
+        return -1;
+    }
+    qatomic_set(&s->fixed_fds[free_slot], fd);
+    return free_slot;
+}
+
+static gint luring_fixed_slot_cmp(gconstpointer a, gconstpointer b)
+{
+    const LuringFixedSlot *sa = a, *sb = b;
+
+    if (sa->start == sb->start) {
+        return 0;
+    }
+    return sa->start < sb->start ? -1 : 1;
+}
+
+/*
+ * Bring the copy of the fixed buffer table of @s up to date.  This only
+ * copies the table; the memory was pinned by luring_register_buf().
+ */
+static void luring_refresh_fixed_bufs(LuringState *s)
+{
+    GArray *slots = g_array_new(false, false, sizeof(LuringFixedSlot));
+    unsigned i, j;
+
+    qemu_mutex_lock(&luring_fixed.bufs_lock);
+    for (i = 0; i < luring_fixed.bufs->len; i++) {
+        LuringFixedBuf *b = &g_array_index(luring_fixed.bufs,
+                                           LuringFixedBuf, i);
+
+        for (j = 0; j < b->nr_slots; j++) {
+            size_t off = (size_t)j * MAX_FIXED_BUF_SIZE;
+            LuringFixedSlot slot = {
+                .start = (uintptr_t)b->host + off,
+                .end = (uintptr_t)b->host + MIN(b->size, off +
+                                                MAX_FIXED_BUF_SIZE),
+                .index = b->first_slot + j,
+            };
+
+            if (test_bit(slot.index, s->fixed_bufs_ok)) {
+                g_array_append_val(slots, slot);
+            }
+        }
+    }
+    s->bufs_generation = luring_fixed.bufs_generation;
+    qemu_mutex_unlock(&luring_fixed.bufs_lock);
+
+    g_array_sort(slots, luring_fixed_slot_cmp);
+    g_free(s->fixed_bufs);
+    s->nr_fixed_bufs = slots->len;
+    s->fixed_bufs = (LuringFixedSlot *)g_array_free(slots, false);
+}
+
+/*
+ * Return the index of the fixed buffer that contains all of @qiov, or -1.
+ * Only single-element vectors qualify, because READ_FIXED and WRITE_FIXED
+ * take a plain buffer.
+ */
+static int luring_fixed_buf(LuringState *s, QEMUIOVector *qiov)
+{
+    uintptr_t start, end;
+    unsigned lo = 0, hi = s->nr_fixed_bufs;
+    LuringFixedSlot *slot;
+
+    if (!qiov || qiov->niov != 1) {
+        return -1;
+    }
+
+    start = (uintptr_t)qiov->iov[0].iov_base;
+    end = start + qiov->iov[0].iov_len;
+
+    /* Find the last buffer that starts at or before @start */
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        if (s->fixed_bufs[mid].start <= start) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return -1;
+    }
+
+    slot = &s->fixed_bufs[lo - 1];
+    if (end > slot->end) {
+        return -1;
+    }
+    return slot->index;
+}
+
+/**
+ * luring_prep_sqe:
+ * @s: AIO state
+ * @luringcb: AIO control block
+ * @fixed_buf: whether a fixed buffer may be used
+ *
+ * Fill in luringcb->sqeq from the original request.  The image fd is
+ * always looked up in the fixed file table, whose slots stay stable while
+ * requests are in flight.  A fixed buffer slot can be emptied while the
+ * request waits, so resubmitted requests do not use one.
+ */
+static void luring_prep_sqe(LuringState *s, LuringAIOCB *luringcb,
+                            bool fixed_buf)
+{
+    struct io_uring_sqe *sqes = &luringcb->sqeq;
+    QEMUIOVector *qiov = luringcb->qiov;
+    uint64_t offset = luringcb->offset;
+    BdrvRequestFlags flags = luringcb->flags;
+    int type = luringcb->type;
+    int file_index = luring_fixed_file(s, luringcb->fd);
+    int fd = file_index >= 0 ? file_index : luringcb->fd;
+    int buf_index = -1;
+
+    if (fixed_buf && (type == QEMU_AIO_READ || type == QEMU_AIO_WRITE)) {
+        buf_index = luring_fixed_buf(s, qiov);
+    }
+
+    switch (type) {
+    case QEMU_AIO_WRITE:
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, qiov->iov[0].iov_base,
+                                      qiov->iov[0].iov_len, offset,
+                                      buf_index);
+#ifdef HAVE_IO_URING_PREP_WRITEV2
+            sqes->rw_flags = (flags & BDRV_REQ_FUA) ? RWF_DSYNC : 0;
+#else
+            assert(flags == 0);
+#endif
+            break;
+        }
+#ifdef HAVE_IO_URING_PREP_WRITEV2
+    {
+        int luring_flags = (flags & BDRV_REQ_FUA) ? RWF_DSYNC : 0;
+        io_uring_prep_writev2(sqes, fd, qiov->iov, qiov->niov, offset,
+                              luring_flags);
+    }
+#else
+        assert(flags == 0);
+        io_uring_prep_writev(sqes, fd, qiov->iov, qiov->niov, offset);
+#endif
+        break;
+    case QEMU_AIO_ZONE_APPEND:
+        io_uring_prep_writev(sqes, fd, qiov->iov, qiov->niov, offset);
+        break;
+    case QEMU_AIO_READ:
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, qiov->iov[0].iov_base,
+                                     qiov->iov[0].iov_len, offset,
+                                     buf_index);
+            break;
+        }
+        io_uring_prep_readv(sqes, fd, qiov->iov, qiov->niov, offset);
+        break;
+    case QEMU_AIO_FLUSH:
+        io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
+        break;
+    default:
+        fprintf(stderr, "%s: invalid AIO request type, aborting 0x%x.\n",
+                        __func__, type);
+        abort();
+    }
+    if (file_index >= 0) {
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
+    io_uring_sqe_set_data(sqes, luringcb);
+}
+
 /**
  * luring_resubmit:
  *
@@ -68,6 +503,10 @@ struct LuringState {
  */
 static void luring_resubmit(LuringState *s, LuringAIOCB *luringcb)
 {
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED ||
+        luringcb->sqeq.opcode == IORING_OP_WRITE_FIXED) {
+        luring_prep_sqe(s, luringcb, false);
+    }
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
     s->io_q.in_queue++;
 }
@@ -101,7 +540,10 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
                       remaining);
 
     /* Update sqe */
-    luringcb->sqeq.off += nread;
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        luring_prep_sqe(s, luringcb, false);
+    }
+    luringcb->sqeq.off = luringcb->offset + luringcb->total_read;
     luringcb->sqeq.addr = (uintptr_t)luringcb->resubmit_qiov.iov;
     luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
 
@@ -184,6 +626,14 @@ static void luring_process_completions(LuringState *s)
                 luring_resubmit(s, luringcb);
                 continue;
             }
+
+            /* The fixed buffer was unregistered after the sqe was prepared */
+            if (ret == -EFAULT &&
+                (luringcb->sqeq.opcode == IORING_OP_READ_FIXED ||
+                 luringcb->sqeq.opcode == IORING_OP_WRITE_FIXED)) {
+                luring_resubmit(s, luringcb);
+                continue;
+            }
         } else if (!luringcb->qiov) {
             goto end;
         } else if (total_bytes == luringcb->qiov->size) {
@@ -325,52 +775,20 @@ static void luring_deferred_fn(void *opaque)
 
 /**
  * luring_do_submit:
- * @fd: file descriptor for I/O
  * @luringcb: AIO control block
  * @s: AIO state
- * @offset: offset for request
- * @type: type of request
  *
  * Fetches sqes from ring, adds to pending queue and preps them
  *
  */
-static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
-                            uint64_t offset, int type, BdrvRequestFlags flags)
+static int luring_do_submit(LuringAIOCB *luringcb, LuringState *s)
 {
     int ret;
-    struct io_uring_sqe *sqes = &luringcb->sqeq;
 
-    switch (type) {
-    case QEMU_AIO_WRITE:
-#ifdef HAVE_IO_URING_PREP_WRITEV2
-    {
-        int luring_flags = (flags & BDRV_REQ_FUA) ? RWF_DSYNC : 0;
-        io_uring_prep_writev2(sqes, fd, luringcb->qiov->iov,
-                              luringcb->qiov->niov, offset, luring_flags);
+    if (s->bufs_generation != qatomic_read(&luring_fixed.bufs_generation)) {
+        luring_refresh_fixed_bufs(s);
     }
-#else
-        assert(flags == 0);
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
-#endif
-        break;
-    case QEMU_AIO_ZONE_APPEND:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
-        break;
-    case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
-        break;
-    case QEMU_AIO_FLUSH:
-        io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
-        break;
-    default:
-        fprintf(stderr, "%s: invalid AIO request type, aborting 0x%x.\n",
-                        __func__, type);
-        abort();
-    }
-    io_uring_sqe_set_data(sqes, luringcb);
+    luring_prep_sqe(s, luringcb, true);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
     s->io_q.in_queue++;
@@ -400,10 +818,14 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
         .ret        = -EINPROGRESS,
         .qiov       = qiov,
         .is_read    = (type == QEMU_AIO_READ),
+        .fd         = fd,
+        .offset     = offset,
+        .type       = type,
+        .flags      = flags,
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type, flags);
+    ret = luring_do_submit(&luringcb, s);
 
     if (ret < 0) {
         return ret;
@@ -434,7 +856,7 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
 
 LuringState *luring_init(Error **errp)
 {
-    int rc;
+    int rc, i;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
 
@@ -448,13 +870,43 @@ LuringState *luring_init(Error **errp)
     }
 
     ioq_init(&s->io_q);
+
+    /* Start with an empty fixed file table; kernels before 5.5 refuse it */
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        s->fixed_fds[i] = -1;
+    }
+    rc = io_uring_register_files(ring, s->fixed_fds, MAX_FIXED_FILES);
+    s->has_fixed_files = (rc == 0);
+
+    /* Likewise, an empty fixed buffer table needs Linux 5.19 */
+    s->fixed_bufs_ok = bitmap_new(MAX_FIXED_BUFS);
+#ifdef HAVE_IO_URING_REGISTER_BUFFERS_SPARSE
+    rc = io_uring_register_buffers_sparse(ring, MAX_FIXED_BUFS);
+    s->has_fixed_bufs = (rc == 0);
+#endif
+
+    qemu_mutex_lock(&luring_fixed.lock);
+    for (i = 0; i < luring_fixed.bufs->len; i++) {
+        /* bufs only changes with lock held */
+        luring_update_fixed_bufs(s, &g_array_index(luring_fixed.bufs,
+                                                   LuringFixedBuf, i), true);
+    }
+    luring_refresh_fixed_bufs(s);
+    QLIST_INSERT_HEAD(&luring_fixed.rings, s, next);
+    qemu_mutex_unlock(&luring_fixed.lock);
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
+    qemu_mutex_lock(&luring_fixed.lock);
+    QLIST_REMOVE(s, next);
+    qemu_mutex_unlock(&luring_fixed.lock);
+
     io_uring_queue_exit(&s->ring);
+    g_free(s->fixed_bufs_ok);
+    g_free(s->fixed_bufs);
     trace_luring_cleanup_state(s);
     g_free(s);
 }
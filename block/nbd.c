@@ -34,6 +34,7 @@
 #include "qemu/option.h"
 #include "qemu/cutils.h"
 #include "qemu/main-loop.h"
+#include "qemu/error-report.h"
 
 #include "qapi/qapi-visit-sockets.h"
 #include "qobject/qstring.h"
@@ -52,12 +53,24 @@
 #define COOKIE_TO_INDEX(cookie) ((cookie) - 1)
 #define INDEX_TO_COOKIE(index)  ((index) + 1)
 
+/* Maximum value of the multi-conn option */
+#define MAX_NBD_CONNECTIONS 16
+
+/* Granularity of the read cache */
+#define NBD_CACHE_CHUNK_SIZE    (64 * KiB)
+
 typedef struct {
     Coroutine *coroutine;
     uint64_t offset;        /* original offset of the request */
     bool receiving;         /* sleeping in the yield in nbd_receive_replies */
 } NBDClientRequest;
 
+typedef struct NBDCacheChunk {
+    int64_t offset;         /* -1 if the chunk is unused */
+    uint8_t *buf;
+    QTAILQ_ENTRY(NBDCacheChunk) next;
+} NBDCacheChunk;
+
 typedef enum NBDClientState {
     NBD_CLIENT_CONNECTING_WAIT,
     NBD_CLIENT_CONNECTING_NOWAIT,
@@ -65,7 +78,16 @@ typedef enum NBDClientState {
     NBD_CLIENT_QUIT
 } NBDClientState;
 
-typedef struct BDRVNBDState {
+typedef struct BDRVNBDState BDRVNBDState;
+
+/*
+ * One connection to the server.  Each request is sent and completed on a
+ * single connection, which reconnects independently of the others.
+ */
+typedef struct NBDConnection {
+    BDRVNBDState *s;
+    unsigned index;
+
     QIOChannel *ioc; /* The current I/O channel */
     NBDExportInfo info;
 
@@ -90,6 +112,27 @@ typedef struct BDRVNBDState {
     CoMutex receive_mutex;
     NBDReply reply;
 
+    NBDClientConnection *conn;
+} NBDConnection;
+
+struct BDRVNBDState {
+    /*
+     * Export information, as negotiated on the first connection.  The
+     * other connections must agree with it.
+     */
+    NBDExportInfo info;
+
+    /*
+     * Requests are spread round robin over the first @nb_active_conns of
+     * the @nb_conns connections; there can only be more than one if the
+     * server advertises NBD_FLAG_CAN_MULTI_CONN.  If it stops doing so
+     * after a reconnect, @nb_active_conns drops to 1.
+     */
+    NBDConnection *conns;
+    unsigned nb_conns;
+    unsigned nb_active_conns; /* atomic */
+    unsigned next_conn; /* atomic */
+
     QEMUTimer *open_timer;
 
     BlockDriverState *bs;
@@ -97,6 +140,7 @@ typedef struct BDRVNBDState {
     /* Connection parameters */
     uint32_t reconnect_delay;
     uint32_t open_timeout;
+    uint32_t multi_conn;
     SocketAddress *saddr;
     char *export;
     char *tlscredsid;
@@ -105,22 +149,111 @@ typedef struct BDRVNBDState {
     char *x_dirty_bitmap;
     bool alloc_depth;
 
-    NBDClientConnection *conn;
-} BDRVNBDState;
+    /*
+     * Read cache, allocated if @cache_size is not zero.  See
+     * nbd_cache_co_preadv().  Writes from other clients of the export
+     * do not invalidate it, so it is only used (@cache_enabled) if the
+     * export is read-only or @cache_exclusive says no one else writes.
+     */
+    uint64_t cache_size;
+    uint64_t max_read_ahead;
+    bool cache_exclusive;
+    bool cache_enabled;
+    uint8_t *cache_buf;
+
+    /* Protects the fields below */
+    CoMutex cache_lock;
+    NBDCacheChunk *cache_chunks;
+    int cache_nb_chunks;
+    GHashTable *cache_map;  /* offset -> NBDCacheChunk */
+    QTAILQ_HEAD(, NBDCacheChunk) cache_lru; /* least recently used first */
+    /* Incremented on every invalidation, so racing reads are not cached */
+    uint64_t cache_gen;
+    /* Sequential read detection */
+    int64_t read_ahead_next;
+    uint64_t read_ahead_size;
+    /* Statistics */
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t cache_read_ahead_bytes;
+};
 
 static void nbd_yank(void *opaque);
+static void coroutine_fn nbd_cache_invalidate(BDRVNBDState *s, int64_t offset,
+                                              int64_t bytes);
+
+static int nbd_cache_init(BDRVNBDState *s, Error **errp)
+{
+    int i;
+
+    qemu_co_mutex_init(&s->cache_lock);
+    QTAILQ_INIT(&s->cache_lru);
+    s->read_ahead_next = -1;
+
+    if (!s->cache_size) {
+        return 0;
+    }
+
+    if (DIV_ROUND_UP(s->cache_size, NBD_CACHE_CHUNK_SIZE) > INT_MAX ||
+        s->cache_size > SIZE_MAX - NBD_CACHE_CHUNK_SIZE) {
+        error_setg(errp, "cache-size %" PRIu64 " is too large", s->cache_size);
+        return -EINVAL;
+    }
+
+    s->cache_nb_chunks = DIV_ROUND_UP(s->cache_size, NBD_CACHE_CHUNK_SIZE);
+    s->cache_buf = g_try_malloc((size_t)s->cache_nb_chunks *
+                                NBD_CACHE_CHUNK_SIZE);
+    if (!s->cache_buf) {
+        error_setg(errp, "Could not allocate %" PRIu64 " bytes of read cache",
+                   s->cache_size);
+        s->cache_nb_chunks = 0;
+        return -ENOMEM;
+    }
+
+    s->cache_chunks = g_new(NBDCacheChunk, s->cache_nb_chunks);
+    s->cache_map = g_hash_table_new(g_int64_hash, g_int64_equal);
+    for (i = 0; i < s->cache_nb_chunks; i++) {
+        s->cache_chunks[i].offset = -1;
+        s->cache_chunks[i].buf = s->cache_buf + i * NBD_CACHE_CHUNK_SIZE;
+        QTAILQ_INSERT_TAIL(&s->cache_lru, &s->cache_chunks[i], next);
+    }
+
+    /* Read-ahead must not evict what it has just read */
+    s->max_read_ahead = MIN(s->max_read_ahead,
+                            QEMU_ALIGN_DOWN(s->cache_size / 2,
+                                            NBD_CACHE_CHUNK_SIZE));
+    return 0;
+}
+
+static void nbd_cache_cleanup(BDRVNBDState *s)
+{
+    g_clear_pointer(&s->cache_map, g_hash_table_destroy);
+    g_clear_pointer(&s->cache_chunks, g_free);
+    g_clear_pointer(&s->cache_buf, g_free);
+    s->cache_nb_chunks = 0;
+}
 
 static void nbd_clear_bdrvstate(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    unsigned i;
 
-    nbd_client_connection_release(s->conn);
-    s->conn = NULL;
+    for (i = 0; i < s->nb_conns; i++) {
+        NBDConnection *c = &s->conns[i];
+
+        nbd_client_connection_release(c->conn);
+        c->conn = NULL;
+
+        /* Must not leave timers behind that would access freed data */
+        assert(!c->reconnect_delay_timer);
+        qemu_mutex_destroy(&c->requests_lock);
+    }
+    g_clear_pointer(&s->conns, g_free);
+    s->nb_conns = 0;
 
     yank_unregister_instance(BLOCKDEV_YANK_INSTANCE(bs->node_name));
 
     /* Must not leave timers behind that would access freed data */
-    assert(!s->reconnect_delay_timer);
     assert(!s->open_timer);
 
     object_unref(OBJECT(s->tlscreds));
@@ -134,9 +267,10 @@ static void nbd_clear_bdrvstate(BlockDriverState *bs)
     s->tlshostname = NULL;
     g_free(s->x_dirty_bitmap);
     s->x_dirty_bitmap = NULL;
+    nbd_cache_cleanup(s);
 }
 
-/* Called with s->receive_mutex taken.  */
+/* Called with c->receive_mutex taken.  */
 static bool coroutine_fn nbd_recv_coroutine_wake_one(NBDClientRequest *req)
 {
     if (req->receiving) {
@@ -148,89 +282,88 @@ static bool coroutine_fn nbd_recv_coroutine_wake_one(NBDClientRequest *req)
     return false;
 }
 
-static void coroutine_fn nbd_recv_coroutines_wake(BDRVNBDState *s)
+static void coroutine_fn nbd_recv_coroutines_wake(NBDConnection *c)
 {
     int i;
 
-    QEMU_LOCK_GUARD(&s->receive_mutex);
+    QEMU_LOCK_GUARD(&c->receive_mutex);
     for (i = 0; i < MAX_NBD_REQUESTS; i++) {
-        if (nbd_recv_coroutine_wake_one(&s->requests[i])) {
+        if (nbd_recv_coroutine_wake_one(&c->requests[i])) {
             return;
         }
     }
 }
 
-/* Called with s->requests_lock held.  */
-static void coroutine_fn nbd_channel_error_locked(BDRVNBDState *s, int ret)
+/* Called with c->requests_lock held.  */
+static void coroutine_fn nbd_channel_error_locked(NBDConnection *c, int ret)
 {
-    if (s->state == NBD_CLIENT_CONNECTED) {
-        qio_channel_shutdown(s->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+    if (c->state == NBD_CLIENT_CONNECTED) {
+        qio_channel_shutdown(c->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
     }
 
     if (ret == -EIO) {
-        if (s->state == NBD_CLIENT_CONNECTED) {
-            s->state = s->reconnect_delay ? NBD_CLIENT_CONNECTING_WAIT :
-                                            NBD_CLIENT_CONNECTING_NOWAIT;
+        if (c->state == NBD_CLIENT_CONNECTED) {
+            c->state = c->s->reconnect_delay ? NBD_CLIENT_CONNECTING_WAIT :
+                                               NBD_CLIENT_CONNECTING_NOWAIT;
         }
     } else {
-        s->state = NBD_CLIENT_QUIT;
+        c->state = NBD_CLIENT_QUIT;
     }
 }
 
-static void coroutine_fn nbd_channel_error(BDRVNBDState *s, int ret)
+static void coroutine_fn nbd_channel_error(NBDConnection *c, int ret)
 {
-    QEMU_LOCK_GUARD(&s->requests_lock);
-    nbd_channel_error_locked(s, ret);
+    QEMU_LOCK_GUARD(&c->requests_lock);
+    nbd_channel_error_locked(c, ret);
 }
 
-static void reconnect_delay_timer_del(BDRVNBDState *s)
+static void reconnect_delay_timer_del(NBDConnection *c)
 {
-    if (s->reconnect_delay_timer) {
-        timer_free(s->reconnect_delay_timer);
-        s->reconnect_delay_timer = NULL;
+    if (c->reconnect_delay_timer) {
+        timer_free(c->reconnect_delay_timer);
+        c->reconnect_delay_timer = NULL;
     }
 }
 
 static void reconnect_delay_timer_cb(void *opaque)
 {
-    BDRVNBDState *s = opaque;
+    NBDConnection *c = opaque;
 
-    reconnect_delay_timer_del(s);
-    WITH_QEMU_LOCK_GUARD(&s->requests_lock) {
-        if (s->state != NBD_CLIENT_CONNECTING_WAIT) {
+    reconnect_delay_timer_del(c);
+    WITH_QEMU_LOCK_GUARD(&c->requests_lock) {
+        if (c->state != NBD_CLIENT_CONNECTING_WAIT) {
             return;
         }
-        s->state = NBD_CLIENT_CONNECTING_NOWAIT;
+        c->state = NBD_CLIENT_CONNECTING_NOWAIT;
     }
-    nbd_co_establish_connection_cancel(s->conn);
+    nbd_co_establish_connection_cancel(c->conn);
 }
 
-static void reconnect_delay_timer_init(BDRVNBDState *s, uint64_t expire_time_ns)
+static void reconnect_delay_timer_init(NBDConnection *c,
+                                       uint64_t expire_time_ns)
 {
-    assert(!s->reconnect_delay_timer);
-    s->reconnect_delay_timer = aio_timer_new(bdrv_get_aio_context(s->bs),
+    assert(!c->reconnect_delay_timer);
+    c->reconnect_delay_timer = aio_timer_new(bdrv_get_aio_context(c->s->bs),
                                              QEMU_CLOCK_REALTIME,
                                              SCALE_NS,
-                                             reconnect_delay_timer_cb, s);
-    timer_mod(s->reconnect_delay_timer, expire_time_ns);
+                                             reconnect_delay_timer_cb, c);
+    timer_mod(c->reconnect_delay_timer, expire_time_ns);
 }
 
-static void nbd_teardown_connection(BlockDriverState *bs)
+static void nbd_teardown_connection(NBDConnection *c)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
-
-    assert(!s->in_flight);
+    assert(!c->in_flight);
 
-    if (s->ioc) {
-        qio_channel_shutdown(s->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
-        yank_unregister_function(BLOCKDEV_YANK_INSTANCE(s->bs->node_name),
-                                 nbd_yank, s->bs);
-        object_unref(OBJECT(s->ioc));
-        s->ioc = NULL;
+    if (c->ioc) {
+        qio_channel_shutdown(c->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+        yank_unregister_function(BLOCKDEV_YANK_INSTANCE(c->s->bs->node_name),
+                                 nbd_yank, c);
+        object_unref(OBJECT(c->ioc));
+        c->ioc = NULL;
     }
 
-    WITH_QEMU_LOCK_GUARD(&s->requests_lock) {
-        s->state = NBD_CLIENT_QUIT;
+    WITH_QEMU_LOCK_GUARD(&c->requests_lock) {
+        c->state = NBD_CLIENT_QUIT;
     }
 }
 
@@ -245,8 +378,13 @@ static void open_timer_del(BDRVNBDState *s)
 static void open_timer_cb(void *opaque)
 {
     BDRVNBDState *s = opaque;
+    unsigned i;
 
-    nbd_co_establish_connection_cancel(s->conn);
+    for (i = 0; i < s->nb_conns; i++) {
+        if (s->conns[i].conn) {
+            nbd_co_establish_connection_cancel(s->conns[i].conn);
+        }
+    }
     open_timer_del(s);
 }
 
@@ -260,13 +398,13 @@ static void open_timer_init(BDRVNBDState *s, uint64_t expire_time_ns)
     timer_mod(s->open_timer, expire_time_ns);
 }
 
-static bool nbd_client_will_reconnect(BDRVNBDState *s)
+static bool nbd_client_will_reconnect(NBDConnection *c)
 {
     /*
      * Called only after a socket error, so this is not performance sensitive.
      */
-    QEMU_LOCK_GUARD(&s->requests_lock);
-    return s->state == NBD_CLIENT_CONNECTING_WAIT;
+    QEMU_LOCK_GUARD(&c->requests_lock);
+    return c->state == NBD_CLIENT_CONNECTING_WAIT;
 }
 
 /*
@@ -298,6 +436,10 @@ nbd_handle_updated_info(BlockDriverState *bs, Error **errp)
         }
     }
 
+    /* The export may have become writable since the last connection */
+    s->cache_enabled = s->cache_nb_chunks &&
+        (s->cache_exclusive || (s->info.flags & NBD_FLAG_READ_ONLY));
+
     if (s->info.flags & NBD_FLAG_SEND_FUA) {
         bs->supported_write_flags = BDRV_REQ_FUA;
         bs->supported_zero_flags |= BDRV_REQ_FUA;
@@ -315,131 +457,226 @@ nbd_handle_updated_info(BlockDriverState *bs, Error **errp)
     return 0;
 }
 
+static bool nbd_info_equal(const NBDExportInfo *a, const NBDExportInfo *b)
+{
+    return a->size == b->size && a->flags == b->flags &&
+        a->base_allocation == b->base_allocation &&
+        a->min_block == b->min_block && a->max_block == b->max_block;
+}
+
+/*
+ * Secondary connections must see the same export as the first one, or
+ * requests would behave differently depending on the connection they are
+ * sent on.
+ */
+static int nbd_check_secondary_info(NBDConnection *c, Error **errp)
+{
+    BDRVNBDState *s = c->s;
+
+    if (c->index >= qatomic_read(&s->nb_active_conns)) {
+        error_setg(errp, "NBD connection %u is no longer used", c->index);
+        return -EINVAL;
+    }
+
+    if (!nbd_info_equal(&c->info, &s->info)) {
+        error_setg(errp, "NBD connection %u: export does not match the "
+                   "first connection", c->index);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/*
+ * Stop using the secondary connections.  Requests in flight on them fail,
+ * and are sent again on the first connection.
+ */
+static void coroutine_fn nbd_drop_secondaries(BDRVNBDState *s)
+{
+    unsigned i, n = qatomic_xchg(&s->nb_active_conns, 1);
+
+    if (n > 1) {
+        trace_nbd_client_multi_conn_unsupported(n);
+    }
+    for (i = 1; i < n; i++) {
+        NBDConnection *c = &s->conns[i];
+
+        nbd_channel_error(c, -EINVAL);
+        if (c->conn) {
+            nbd_co_establish_connection_cancel(c->conn);
+        }
+    }
+}
+
+/*
+ * Called when the first connection has reconnected, with the export
+ * information it negotiated in @s->info.  Connected secondaries that saw
+ * a different export reconnect, so that they are checked again; all of
+ * them are dropped if the server no longer allows multiple connections.
+ */
+static void coroutine_fn nbd_update_secondaries(BDRVNBDState *s)
+{
+    unsigned i, n = qatomic_read(&s->nb_active_conns);
+
+    if (!(s->info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        nbd_drop_secondaries(s);
+        return;
+    }
+
+    for (i = 1; i < n; i++) {
+        NBDConnection *c = &s->conns[i];
+
+        WITH_QEMU_LOCK_GUARD(&c->requests_lock) {
+            if (c->state == NBD_CLIENT_CONNECTED &&
+                !nbd_info_equal(&c->info, &s->info)) {
+                nbd_channel_error_locked(c, -EIO);
+            }
+        }
+    }
+}
+
 int coroutine_fn nbd_co_do_establish_connection(BlockDriverState *bs,
+                                                unsigned int index,
                                                 bool blocking, Error **errp)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnection *c = &s->conns[index];
     int ret;
     IO_CODE();
 
     assert_bdrv_graph_readable();
-    assert(!s->ioc);
+    assert(!c->ioc);
 
-    s->ioc = nbd_co_establish_connection(s->conn, &s->info, blocking, errp);
-    if (!s->ioc) {
+    c->ioc = nbd_co_establish_connection(c->conn, &c->info, blocking, errp);
+    if (!c->ioc) {
         return -ECONNREFUSED;
     }
 
     yank_register_function(BLOCKDEV_YANK_INSTANCE(s->bs->node_name), nbd_yank,
-                           bs);
+                           c);
 
-    ret = nbd_handle_updated_info(s->bs, NULL);
+    if (index == 0) {
+        s->info = c->info;
+        ret = nbd_handle_updated_info(s->bs, NULL);
+        if (ret == 0 && s->nb_conns > 1) {
+            nbd_update_secondaries(s);
+        }
+    } else {
+        ret = nbd_check_secondary_info(c, errp);
+        if (ret < 0) {
+            /* The connections disagree, only keep the first one */
+            nbd_drop_secondaries(s);
+        }
+    }
     if (ret < 0) {
         /*
          * We have connected, but must fail for other reasons.
          * Send NBD_CMD_DISC as a courtesy to the server.
          */
-        NBDRequest request = { .type = NBD_CMD_DISC, .mode = s->info.mode };
+        NBDRequest request = { .type = NBD_CMD_DISC, .mode = c->info.mode };
 
-        nbd_send_request(s->ioc, &request);
+        nbd_send_request(c->ioc, &request);
 
         yank_unregister_function(BLOCKDEV_YANK_INSTANCE(s->bs->node_name),
-                                 nbd_yank, bs);
-        object_unref(OBJECT(s->ioc));
-        s->ioc = NULL;
+                                 nbd_yank, c);
+        object_unref(OBJECT(c->ioc));
+        c->ioc = NULL;
 
         return ret;
     }
 
-    qio_channel_set_blocking(s->ioc, false, NULL);
-    qio_channel_set_follow_coroutine_ctx(s->ioc, true);
+    qio_channel_set_blocking(c->ioc, false, NULL);
+    qio_channel_set_follow_coroutine_ctx(c->ioc, true);
+
+    /* The export may have changed while we were disconnected */
+    nbd_cache_invalidate(s, 0, -1);
 
     /* successfully connected */
-    WITH_QEMU_LOCK_GUARD(&s->requests_lock) {
-        s->state = NBD_CLIENT_CONNECTED;
+    WITH_QEMU_LOCK_GUARD(&c->requests_lock) {
+        c->state = NBD_CLIENT_CONNECTED;
     }
 
     return 0;
 }
 
-/* Called with s->requests_lock held.  */
-static bool nbd_client_connecting(BDRVNBDState *s)
+/* Called with c->requests_lock held.  */
+static bool nbd_client_connecting(NBDConnection *c)
 {
-    return s->state == NBD_CLIENT_CONNECTING_WAIT ||
-        s->state == NBD_CLIENT_CONNECTING_NOWAIT;
+    return c->state == NBD_CLIENT_CONNECTING_WAIT ||
+        c->state == NBD_CLIENT_CONNECTING_NOWAIT;
 }
 
-/* Called with s->requests_lock taken.  */
-static void coroutine_fn GRAPH_RDLOCK nbd_reconnect_attempt(BDRVNBDState *s)
+/* Called with c->requests_lock taken.  */
+static void coroutine_fn GRAPH_RDLOCK nbd_reconnect_attempt(NBDConnection *c)
 {
     int ret;
-    bool blocking = s->state == NBD_CLIENT_CONNECTING_WAIT;
+    bool blocking = c->state == NBD_CLIENT_CONNECTING_WAIT;
 
     /*
      * Now we are sure that nobody is accessing the channel, and no one will
      * try until we set the state to CONNECTED.
      */
-    assert(nbd_client_connecting(s));
-    assert(s->in_flight == 1);
+    assert(nbd_client_connecting(c));
+    assert(c->in_flight == 1);
 
-    trace_nbd_reconnect_attempt(s->bs->in_flight);
+    trace_nbd_reconnect_attempt(c->s->bs->in_flight);
 
-    if (blocking && !s->reconnect_delay_timer) {
+    if (blocking && !c->reconnect_delay_timer) {
         /*
          * It's the first reconnect attempt after switching to
          * NBD_CLIENT_CONNECTING_WAIT
          */
-        g_assert(s->reconnect_delay);
-        reconnect_delay_timer_init(s,
+        g_assert(c->s->reconnect_delay);
+        reconnect_delay_timer_init(c,
             qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
-            s->reconnect_delay * NANOSECONDS_PER_SECOND);
+            c->s->reconnect_delay * NANOSECONDS_PER_SECOND);
     }
 
     /* Finalize previous connection if any */
-    if (s->ioc) {
-        yank_unregister_function(BLOCKDEV_YANK_INSTANCE(s->bs->node_name),
-                                 nbd_yank, s->bs);
-        object_unref(OBJECT(s->ioc));
-        s->ioc = NULL;
+    if (c->ioc) {
+        yank_unregister_function(BLOCKDEV_YANK_INSTANCE(c->s->bs->node_name),
+                                 nbd_yank, c);
+        object_unref(OBJECT(c->ioc));
+        c->ioc = NULL;
     }
 
-    qemu_mutex_unlock(&s->requests_lock);
-    ret = nbd_co_do_establish_connection(s->bs, blocking, NULL);
-    trace_nbd_reconnect_attempt_result(ret, s->bs->in_flight);
-    qemu_mutex_lock(&s->requests_lock);
+    qemu_mutex_unlock(&c->requests_lock);
+    ret = nbd_co_do_establish_connection(c->s->bs, c->index, blocking, NULL);
+    trace_nbd_reconnect_attempt_result(ret, c->s->bs->in_flight);
+    qemu_mutex_lock(&c->requests_lock);
 
     /*
      * The reconnect attempt is done (maybe successfully, maybe not), so
      * we no longer need this timer.  Delete it so it will not outlive
      * this I/O request (so draining removes all timers).
      */
-    reconnect_delay_timer_del(s);
+    reconnect_delay_timer_del(c);
 }
 
-static coroutine_fn int nbd_receive_replies(BDRVNBDState *s, uint64_t cookie,
+static coroutine_fn int nbd_receive_replies(NBDConnection *c, uint64_t cookie,
                                             Error **errp)
 {
     int ret;
     uint64_t ind = COOKIE_TO_INDEX(cookie), ind2;
-    QEMU_LOCK_GUARD(&s->receive_mutex);
+    QEMU_LOCK_GUARD(&c->receive_mutex);
 
     while (true) {
-        if (s->reply.cookie == cookie) {
+        if (c->reply.cookie == cookie) {
             /* We are done */
             return 0;
         }
 
-        if (s->reply.cookie != 0) {
+        if (c->reply.cookie != 0) {
             /*
              * Some other request is being handled now. It should already be
-             * woken by whoever set s->reply.cookie (or never wait in this
+             * woken by whoever set c->reply.cookie (or never wait in this
              * yield). So, we should not wake it here.
              */
-            ind2 = COOKIE_TO_INDEX(s->reply.cookie);
-            assert(!s->requests[ind2].receiving);
+            ind2 = COOKIE_TO_INDEX(c->reply.cookie);
+            assert(!c->requests[ind2].receiving);
 
-            s->requests[ind].receiving = true;
-            qemu_co_mutex_unlock(&s->receive_mutex);
+            c->requests[ind].receiving = true;
+            qemu_co_mutex_unlock(&c->receive_mutex);
 
             qemu_coroutine_yield();
             /*
@@ -447,112 +684,139 @@ static coroutine_fn int nbd_receive_replies(BDRVNBDState *s, uint64_t cookie,
              * 1. From this function, executing in parallel coroutine, when our
              *    cookie is received.
              * 2. From nbd_co_receive_one_chunk(), when previous request is
-             *    finished and s->reply.cookie set to 0.
+             *    finished and c->reply.cookie set to 0.
              * Anyway, it's OK to lock the mutex and go to the next iteration.
              */
 
-            qemu_co_mutex_lock(&s->receive_mutex);
-            assert(!s->requests[ind].receiving);
+            qemu_co_mutex_lock(&c->receive_mutex);
+            assert(!c->requests[ind].receiving);
             continue;
         }
 
         /* We are under mutex and cookie is 0. We have to do the dirty work. */
-        assert(s->reply.cookie == 0);
-        ret = nbd_receive_reply(s->bs, s->ioc, &s->reply, s->info.mode, errp);
+        assert(c->reply.cookie == 0);
+        ret = nbd_receive_reply(c->s->bs, c->ioc, &c->reply, c->info.mode,
+                                errp);
         if (ret == 0) {
             ret = -EIO;
             error_setg(errp, "server dropped connection");
         }
         if (ret < 0) {
-            nbd_channel_error(s, ret);
+            nbd_channel_error(c, ret);
             return ret;
         }
-        if (nbd_reply_is_structured(&s->reply) &&
-            s->info.mode < NBD_MODE_STRUCTURED) {
-            nbd_channel_error(s, -EINVAL);
+        if (nbd_reply_is_structured(&c->reply) &&
+            c->info.mode < NBD_MODE_STRUCTURED) {
+            nbd_channel_error(c, -EINVAL);
             error_setg(errp, "unexpected structured reply");
             return -EINVAL;
         }
-        ind2 = COOKIE_TO_INDEX(s->reply.cookie);
-        if (ind2 >= MAX_NBD_REQUESTS || !s->requests[ind2].coroutine) {
-            nbd_channel_error(s, -EINVAL);
+        ind2 = COOKIE_TO_INDEX(c->reply.cookie);
+        if (ind2 >= MAX_NBD_REQUESTS || !c->requests[ind2].coroutine) {
+            nbd_channel_error(c, -EINVAL);
             error_setg(errp, "unexpected cookie value");
             return -EINVAL;
         }
-        if (s->reply.cookie == cookie) {
+        if (c->reply.cookie == cookie) {
             /* We are done */
             return 0;
         }
-        nbd_recv_coroutine_wake_one(&s->requests[ind2]);
+        nbd_recv_coroutine_wake_one(&c->requests[ind2]);
+    }
+}
+
+/* Pick the connection to send a new request on */
+static NBDConnection *nbd_get_connection(BDRVNBDState *s)
+{
+    unsigned n = qatomic_read(&s->nb_active_conns);
+
+    if (n == 1) {
+        return &s->conns[0];
     }
+    return &s->conns[qatomic_fetch_inc(&s->next_conn) % n];
+}
+
+/*
+ * Whether a request that failed on *@c should be sent again, once *@c has
+ * reconnected or, if *@c was dropped, on another connection.
+ */
+static bool nbd_client_retry(BDRVNBDState *s, NBDConnection **c)
+{
+    if (nbd_client_will_reconnect(*c)) {
+        return true;
+    }
+    if ((*c)->index >= qatomic_read(&s->nb_active_conns)) {
+        *c = nbd_get_connection(s);
+        return true;
+    }
+    return false;
 }
 
 static int coroutine_fn GRAPH_RDLOCK
-nbd_co_send_request(BlockDriverState *bs, NBDRequest *request,
+nbd_co_send_request(NBDConnection *c, NBDRequest *request,
                     QEMUIOVector *qiov)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     int rc, i = -1;
 
-    qemu_mutex_lock(&s->requests_lock);
-    while (s->in_flight == MAX_NBD_REQUESTS ||
-           (s->state != NBD_CLIENT_CONNECTED && s->in_flight > 0)) {
-        qemu_co_queue_wait(&s->free_sema, &s->requests_lock);
+    qemu_mutex_lock(&c->requests_lock);
+    while (c->in_flight == MAX_NBD_REQUESTS ||
+           (c->state != NBD_CLIENT_CONNECTED && c->in_flight > 0)) {
+        qemu_co_queue_wait(&c->free_sema, &c->requests_lock);
     }
 
-    s->in_flight++;
-    if (s->state != NBD_CLIENT_CONNECTED) {
-        if (nbd_client_connecting(s)) {
-            nbd_reconnect_attempt(s);
-            qemu_co_queue_restart_all(&s->free_sema);
+    c->in_flight++;
+    if (c->state != NBD_CLIENT_CONNECTED) {
+        if (nbd_client_connecting(c)) {
+            nbd_reconnect_attempt(c);
+            qemu_co_queue_restart_all(&c->free_sema);
         }
-        if (s->state != NBD_CLIENT_CONNECTED) {
+        if (c->state != NBD_CLIENT_CONNECTED) {
             rc = -EIO;
             goto err;
         }
     }
 
     for (i = 0; i < MAX_NBD_REQUESTS; i++) {
-        if (s->requests[i].coroutine == NULL) {
+        if (c->requests[i].coroutine == NULL) {
             break;
         }
     }
 
     assert(i < MAX_NBD_REQUESTS);
-    s->requests[i].coroutine = qemu_coroutine_self();
-    s->requests[i].offset = request->from;
-    s->requests[i].receiving = false;
-    qemu_mutex_unlock(&s->requests_lock);
+    c->requests[i].coroutine = qemu_coroutine_self();
+    c->requests[i].offset = request->from;
+    c->requests[i].receiving = false;
+    qemu_mutex_unlock(&c->requests_lock);
 
-    qemu_co_mutex_lock(&s->send_mutex);
+    qemu_co_mutex_lock(&c->send_mutex);
     request->cookie = INDEX_TO_COOKIE(i);
-    request->mode = s->info.mode;
+    request->mode = c->info.mode;
 
-    assert(s->ioc);
+    assert(c->ioc);
 
     if (qiov) {
-        qio_channel_set_cork(s->ioc, true);
-        rc = nbd_send_request(s->ioc, request);
-        if (rc >= 0 && qio_channel_writev_all(s->ioc, qiov->iov, qiov->niov,
+        qio_channel_set_cork(c->ioc, true);
+        rc = nbd_send_request(c->ioc, request);
+        if (rc >= 0 && qio_channel_writev_all(c->ioc, qiov->iov, qiov->niov,
                                               NULL) < 0) {
             rc = -EIO;
         }
-        qio_channel_set_cork(s->ioc, false);
+        qio_channel_set_cork(c->ioc, false);
     } else {
-        rc = nbd_send_request(s->ioc, request);
+        rc = nbd_send_request(c->ioc, request);
     }
-    qemu_co_mutex_unlock(&s->send_mutex);
+    qemu_co_mutex_unlock(&c->send_mutex);
 
     if (rc < 0) {
-        qemu_mutex_lock(&s->requests_lock);
+        qemu_mutex_lock(&c->requests_lock);
 err:
-        nbd_channel_error_locked(s, rc);
+        nbd_channel_error_locked(c, rc);
         if (i != -1) {
-            s->requests[i].coroutine = NULL;
+            c->requests[i].coroutine = NULL;
         }
-        s->in_flight--;
-        qemu_co_queue_next(&s->free_sema);
-        qemu_mutex_unlock(&s->requests_lock);
+        c->in_flight--;
+        qemu_co_queue_next(&c->free_sema);
+        qemu_mutex_unlock(&c->requests_lock);
     }
     return rc;
 }
@@ -575,7 +839,7 @@ static inline uint64_t payload_advance64(uint8_t **payload)
     return ldq_be_p(*payload - 8);
 }
 
-static int nbd_parse_offset_hole_payload(BDRVNBDState *s,
+static int nbd_parse_offset_hole_payload(NBDConnection *c,
                                          NBDStructuredReplyChunk *chunk,
                                          uint8_t *payload, uint64_t orig_offset,
                                          QEMUIOVector *qiov, Error **errp)
@@ -598,8 +862,8 @@ static int nbd_parse_offset_hole_payload(BDRVNBDState *s,
                          " region");
         return -EINVAL;
     }
-    if (s->info.min_block &&
-        !QEMU_IS_ALIGNED(hole_size, s->info.min_block)) {
+    if (c->info.min_block &&
+        !QEMU_IS_ALIGNED(hole_size, c->info.min_block)) {
         trace_nbd_structured_read_compliance("hole");
     }
 
@@ -613,7 +877,7 @@ static int nbd_parse_offset_hole_payload(BDRVNBDState *s,
  * Based on our request, we expect only one extent in reply, for the
  * base:allocation context.
  */
-static int nbd_parse_blockstatus_payload(BDRVNBDState *s,
+static int nbd_parse_blockstatus_payload(NBDConnection *c,
                                          NBDStructuredReplyChunk *chunk,
                                          uint8_t *payload, bool wide,
                                          uint64_t orig_length,
@@ -632,11 +896,11 @@ static int nbd_parse_blockstatus_payload(BDRVNBDState *s,
     }
 
     context_id = payload_advance32(&payload);
-    if (s->info.context_id != context_id) {
+    if (c->info.context_id != context_id) {
         error_setg(errp, "Protocol error: unexpected context id %d for "
                          "NBD_REPLY_TYPE_BLOCK_STATUS, when negotiated context "
                          "id is %d", context_id,
-                         s->info.context_id);
+                         c->info.context_id);
         return -EINVAL;
     }
 
@@ -668,14 +932,14 @@ static int nbd_parse_blockstatus_payload(BDRVNBDState *s,
      * up to the full block and change the status to fully-allocated
      * (always a safe status, even if it loses information).
      */
-    if (s->info.min_block && !QEMU_IS_ALIGNED(extent->length,
-                                              s->info.min_block)) {
+    if (c->info.min_block && !QEMU_IS_ALIGNED(extent->length,
+                                              c->info.min_block)) {
         trace_nbd_parse_blockstatus_compliance("extent length is unaligned");
-        if (extent->length > s->info.min_block) {
+        if (extent->length > c->info.min_block) {
             extent->length = QEMU_ALIGN_DOWN(extent->length,
-                                             s->info.min_block);
+                                             c->info.min_block);
         } else {
-            extent->length = s->info.min_block;
+            extent->length = c->info.min_block;
             extent->flags = 0;
         }
     }
@@ -704,7 +968,7 @@ static int nbd_parse_blockstatus_payload(BDRVNBDState *s,
      * since nbd_client_co_block_status is only expecting the low two
      * bits to be set.
      */
-    if (s->alloc_depth && extent->flags > 2) {
+    if (c->s->alloc_depth && extent->flags > 2) {
         extent->flags = 2;
     }
 
@@ -754,16 +1018,16 @@ static int nbd_parse_error_payload(NBDStructuredReplyChunk *chunk,
 }
 
 static int coroutine_fn
-nbd_co_receive_offset_data_payload(BDRVNBDState *s, uint64_t orig_offset,
+nbd_co_receive_offset_data_payload(NBDConnection *c, uint64_t orig_offset,
                                    QEMUIOVector *qiov, Error **errp)
 {
     QEMUIOVector sub_qiov;
     uint64_t offset;
     size_t data_size;
     int ret;
-    NBDStructuredReplyChunk *chunk = &s->reply.structured;
+    NBDStructuredReplyChunk *chunk = &c->reply.structured;
 
-    assert(nbd_reply_is_structured(&s->reply));
+    assert(nbd_reply_is_structured(&c->reply));
 
     /* The NBD spec requires at least one byte of payload */
     if (chunk->length <= sizeof(offset)) {
@@ -772,7 +1036,7 @@ nbd_co_receive_offset_data_payload(BDRVNBDState *s, uint64_t orig_offset,
         return -EINVAL;
     }
 
-    if (nbd_read64(s->ioc, &offset, "OFFSET_DATA offset", errp) < 0) {
+    if (nbd_read64(c->ioc, &offset, "OFFSET_DATA offset", errp) < 0) {
         return -EIO;
     }
 
@@ -784,13 +1048,13 @@ nbd_co_receive_offset_data_payload(BDRVNBDState *s, uint64_t orig_offset,
                          " region");
         return -EINVAL;
     }
-    if (s->info.min_block && !QEMU_IS_ALIGNED(data_size, s->info.min_block)) {
+    if (c->info.min_block && !QEMU_IS_ALIGNED(data_size, c->info.min_block)) {
         trace_nbd_structured_read_compliance("data");
     }
 
     qemu_iovec_init(&sub_qiov, qiov->niov);
     qemu_iovec_concat(&sub_qiov, qiov, offset - orig_offset, data_size);
-    ret = qio_channel_readv_all(s->ioc, sub_qiov.iov, sub_qiov.niov, errp);
+    ret = qio_channel_readv_all(c->ioc, sub_qiov.iov, sub_qiov.niov, errp);
     qemu_iovec_destroy(&sub_qiov);
 
     return ret < 0 ? -EIO : 0;
@@ -798,14 +1062,14 @@ nbd_co_receive_offset_data_payload(BDRVNBDState *s, uint64_t orig_offset,
 
 #define NBD_MAX_MALLOC_PAYLOAD 1000
 static coroutine_fn int nbd_co_receive_structured_payload(
-        BDRVNBDState *s, void **payload, Error **errp)
+        NBDConnection *c, void **payload, Error **errp)
 {
     int ret;
     uint32_t len;
 
-    assert(nbd_reply_is_structured(&s->reply));
+    assert(nbd_reply_is_structured(&c->reply));
 
-    len = s->reply.structured.length;
+    len = c->reply.structured.length;
 
     if (len == 0) {
         return 0;
@@ -822,7 +1086,7 @@ static coroutine_fn int nbd_co_receive_structured_payload(
     }
 
     *payload = g_new(char, len);
-    ret = nbd_read(s->ioc, *payload, len, "structured payload", errp);
+    ret = nbd_read(c->ioc, *payload, len, "structured payload", errp);
     if (ret < 0) {
         g_free(*payload);
         *payload = NULL;
@@ -848,7 +1112,7 @@ static coroutine_fn int nbd_co_receive_structured_payload(
  * corresponding to the server's error reply), and errp is unchanged.
  */
 static coroutine_fn int nbd_co_do_receive_one_chunk(
-        BDRVNBDState *s, uint64_t cookie, bool only_structured,
+        NBDConnection *c, uint64_t cookie, bool only_structured,
         int *request_ret, QEMUIOVector *qiov, void **payload, Error **errp)
 {
     ERRP_GUARD();
@@ -862,34 +1126,34 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
     }
     *request_ret = 0;
 
-    ret = nbd_receive_replies(s, cookie, errp);
+    ret = nbd_receive_replies(c, cookie, errp);
     if (ret < 0) {
         error_prepend(errp, "Connection closed: ");
         return -EIO;
     }
-    assert(s->ioc);
+    assert(c->ioc);
 
-    assert(s->reply.cookie == cookie);
+    assert(c->reply.cookie == cookie);
 
-    if (nbd_reply_is_simple(&s->reply)) {
+    if (nbd_reply_is_simple(&c->reply)) {
         if (only_structured) {
             error_setg(errp, "Protocol error: simple reply when structured "
                              "reply chunk was expected");
             return -EINVAL;
         }
 
-        *request_ret = -nbd_errno_to_system_errno(s->reply.simple.error);
+        *request_ret = -nbd_errno_to_system_errno(c->reply.simple.error);
         if (*request_ret < 0 || !qiov) {
             return 0;
         }
 
-        return qio_channel_readv_all(s->ioc, qiov->iov, qiov->niov,
+        return qio_channel_readv_all(c->ioc, qiov->iov, qiov->niov,
                                      errp) < 0 ? -EIO : 0;
     }
 
     /* handle structured reply chunk */
-    assert(s->info.mode >= NBD_MODE_STRUCTURED);
-    chunk = &s->reply.structured;
+    assert(c->info.mode >= NBD_MODE_STRUCTURED);
+    chunk = &c->reply.structured;
 
     if (chunk->type == NBD_REPLY_TYPE_NONE) {
         if (!(chunk->flags & NBD_REPLY_FLAG_DONE)) {
@@ -911,7 +1175,7 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
             return -EINVAL;
         }
 
-        return nbd_co_receive_offset_data_payload(s, s->requests[i].offset,
+        return nbd_co_receive_offset_data_payload(c, c->requests[i].offset,
                                                   qiov, errp);
     }
 
@@ -919,7 +1183,7 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
         payload = &local_payload;
     }
 
-    ret = nbd_co_receive_structured_payload(s, payload, errp);
+    ret = nbd_co_receive_structured_payload(c, payload, errp);
     if (ret < 0) {
         return ret;
     }
@@ -939,23 +1203,23 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
  * Return value is a fatal error code or normal nbd reply error code
  */
 static coroutine_fn int nbd_co_receive_one_chunk(
-        BDRVNBDState *s, uint64_t cookie, bool only_structured,
+        NBDConnection *c, uint64_t cookie, bool only_structured,
         int *request_ret, QEMUIOVector *qiov, NBDReply *reply, void **payload,
         Error **errp)
 {
-    int ret = nbd_co_do_receive_one_chunk(s, cookie, only_structured,
+    int ret = nbd_co_do_receive_one_chunk(c, cookie, only_structured,
                                           request_ret, qiov, payload, errp);
 
     if (ret < 0) {
         memset(reply, 0, sizeof(*reply));
-        nbd_channel_error(s, ret);
+        nbd_channel_error(c, ret);
     } else {
         /* For assert at loop start in nbd_connection_entry */
-        *reply = s->reply;
+        *reply = c->reply;
     }
-    s->reply.cookie = 0;
+    c->reply.cookie = 0;
 
-    nbd_recv_coroutines_wake(s);
+    nbd_recv_coroutines_wake(c);
 
     return ret;
 }
@@ -996,16 +1260,16 @@ static void nbd_iter_request_error(NBDReplyChunkIter *iter, int ret)
  * NBD_FOREACH_REPLY_CHUNK
  * The pointer stored in @payload requires g_free() to free it.
  */
-#define NBD_FOREACH_REPLY_CHUNK(s, iter, cookie, structured, \
+#define NBD_FOREACH_REPLY_CHUNK(c, iter, cookie, structured, \
                                 qiov, reply, payload) \
     for (iter = (NBDReplyChunkIter) { .only_structured = structured }; \
-         nbd_reply_chunk_iter_receive(s, &iter, cookie, qiov, reply, payload);)
+         nbd_reply_chunk_iter_receive(c, &iter, cookie, qiov, reply, payload);)
 
 /*
  * nbd_reply_chunk_iter_receive
  * The pointer stored in @payload requires g_free() to free it.
  */
-static bool coroutine_fn nbd_reply_chunk_iter_receive(BDRVNBDState *s,
+static bool coroutine_fn nbd_reply_chunk_iter_receive(NBDConnection *c,
                                                       NBDReplyChunkIter *iter,
                                                       uint64_t cookie,
                                                       QEMUIOVector *qiov,
@@ -1026,7 +1290,7 @@ static bool coroutine_fn nbd_reply_chunk_iter_receive(BDRVNBDState *s,
         reply = &local_reply;
     }
 
-    ret = nbd_co_receive_one_chunk(s, cookie, iter->only_structured,
+    ret = nbd_co_receive_one_chunk(c, cookie, iter->only_structured,
                                    &request_ret, qiov, reply, payload,
                                    &local_err);
     if (ret < 0) {
@@ -1058,22 +1322,22 @@ static bool coroutine_fn nbd_reply_chunk_iter_receive(BDRVNBDState *s,
     return true;
 
 break_loop:
-    qemu_mutex_lock(&s->requests_lock);
-    s->requests[COOKIE_TO_INDEX(cookie)].coroutine = NULL;
-    s->in_flight--;
-    qemu_co_queue_next(&s->free_sema);
-    qemu_mutex_unlock(&s->requests_lock);
+    qemu_mutex_lock(&c->requests_lock);
+    c->requests[COOKIE_TO_INDEX(cookie)].coroutine = NULL;
+    c->in_flight--;
+    qemu_co_queue_next(&c->free_sema);
+    qemu_mutex_unlock(&c->requests_lock);
 
     return false;
 }
 
 static int coroutine_fn
-nbd_co_receive_return_code(BDRVNBDState *s, uint64_t cookie,
+nbd_co_receive_return_code(NBDConnection *c, uint64_t cookie,
                            int *request_ret, Error **errp)
 {
     NBDReplyChunkIter iter;
 
-    NBD_FOREACH_REPLY_CHUNK(s, iter, cookie, false, NULL, NULL, NULL) {
+    NBD_FOREACH_REPLY_CHUNK(c, iter, cookie, false, NULL, NULL, NULL) {
         /* nbd_reply_chunk_iter_receive does all the work */
     }
 
@@ -1083,7 +1347,7 @@ nbd_co_receive_return_code(BDRVNBDState *s, uint64_t cookie,
 }
 
 static int coroutine_fn
-nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t cookie,
+nbd_co_receive_cmdread_reply(NBDConnection *c, uint64_t cookie,
                              uint64_t offset, QEMUIOVector *qiov,
                              int *request_ret, Error **errp)
 {
@@ -1092,8 +1356,8 @@ nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t cookie,
     void *payload = NULL;
     Error *local_err = NULL;
 
-    NBD_FOREACH_REPLY_CHUNK(s, iter, cookie,
-                            s->info.mode >= NBD_MODE_STRUCTURED,
+    NBD_FOREACH_REPLY_CHUNK(c, iter, cookie,
+                            c->info.mode >= NBD_MODE_STRUCTURED,
                             qiov, &reply, &payload)
     {
         int ret;
@@ -1109,17 +1373,17 @@ nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t cookie,
              */
             break;
         case NBD_REPLY_TYPE_OFFSET_HOLE:
-            ret = nbd_parse_offset_hole_payload(s, &reply.structured, payload,
+            ret = nbd_parse_offset_hole_payload(c, &reply.structured, payload,
                                                 offset, qiov, &local_err);
             if (ret < 0) {
-                nbd_channel_error(s, ret);
+                nbd_channel_error(c, ret);
                 nbd_iter_channel_error(&iter, ret, &local_err);
             }
             break;
         default:
             if (!nbd_reply_type_is_error(chunk->type)) {
                 /* not allowed reply type */
-                nbd_channel_error(s, -EINVAL);
+                nbd_channel_error(c, -EINVAL);
                 error_setg(&local_err,
                            "Unexpected reply type: %d (%s) for CMD_READ",
                            chunk->type, nbd_reply_type_lookup(chunk->type));
@@ -1137,7 +1401,7 @@ nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t cookie,
 }
 
 static int coroutine_fn
-nbd_co_receive_blockstatus_reply(BDRVNBDState *s, uint64_t cookie,
+nbd_co_receive_blockstatus_reply(NBDConnection *c, uint64_t cookie,
                                  uint64_t length, NBDExtent64 *extent,
                                  int *request_ret, Error **errp)
 {
@@ -1148,7 +1412,7 @@ nbd_co_receive_blockstatus_reply(BDRVNBDState *s, uint64_t cookie,
     bool received = false;
 
     assert(!extent->length);
-    NBD_FOREACH_REPLY_CHUNK(s, iter, cookie, false, NULL, &reply, &payload) {
+    NBD_FOREACH_REPLY_CHUNK(c, iter, cookie, false, NULL, &reply, &payload) {
         int ret;
         NBDStructuredReplyChunk *chunk = &reply.structured;
         bool wide;
@@ -1159,27 +1423,27 @@ nbd_co_receive_blockstatus_reply(BDRVNBDState *s, uint64_t cookie,
         case NBD_REPLY_TYPE_BLOCK_STATUS_EXT:
         case NBD_REPLY_TYPE_BLOCK_STATUS:
             wide = chunk->type == NBD_REPLY_TYPE_BLOCK_STATUS_EXT;
-            if ((s->info.mode >= NBD_MODE_EXTENDED) != wide) {
+            if ((c->info.mode >= NBD_MODE_EXTENDED) != wide) {
                 trace_nbd_extended_headers_compliance("block_status");
             }
             if (received) {
-                nbd_channel_error(s, -EINVAL);
+                nbd_channel_error(c, -EINVAL);
                 error_setg(&local_err, "Several BLOCK_STATUS chunks in reply");
                 nbd_iter_channel_error(&iter, -EINVAL, &local_err);
             }
             received = true;
 
             ret = nbd_parse_blockstatus_payload(
-                s, &reply.structured, payload, wide,
+                c, &reply.structured, payload, wide,
                 length, extent, &local_err);
             if (ret < 0) {
-                nbd_channel_error(s, ret);
+                nbd_channel_error(c, ret);
                 nbd_iter_channel_error(&iter, ret, &local_err);
             }
             break;
         default:
             if (!nbd_reply_type_is_error(chunk->type)) {
-                nbd_channel_error(s, -EINVAL);
+                nbd_channel_error(c, -EINVAL);
                 error_setg(&local_err,
                            "Unexpected reply type: %d (%s) "
                            "for CMD_BLOCK_STATUS",
@@ -1209,6 +1473,7 @@ nbd_co_request(BlockDriverState *bs, NBDRequest *request,
     int ret, request_ret;
     Error *local_err = NULL;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnection *c = nbd_get_connection(s);
 
     assert(request->type != NBD_CMD_READ);
     if (write_qiov) {
@@ -1219,12 +1484,12 @@ nbd_co_request(BlockDriverState *bs, NBDRequest *request,
     }
 
     do {
-        ret = nbd_co_send_request(bs, request, write_qiov);
+        ret = nbd_co_send_request(c, request, write_qiov);
         if (ret < 0) {
             continue;
         }
 
-        ret = nbd_co_receive_return_code(s, request->cookie,
+        ret = nbd_co_receive_return_code(c, request->cookie,
                                          &request_ret, &local_err);
         if (local_err) {
             trace_nbd_co_request_fail(request->from, request->len,
@@ -1235,24 +1500,245 @@ nbd_co_request(BlockDriverState *bs, NBDRequest *request,
             error_free(local_err);
             local_err = NULL;
         }
-    } while (ret < 0 && nbd_client_will_reconnect(s));
+    } while (ret < 0 && nbd_client_retry(s, &c));
 
     return ret ? ret : request_ret;
 }
 
+/* Read from the server, @offset + @bytes must not exceed the export size */
 static int coroutine_fn GRAPH_RDLOCK
-nbd_client_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
-                     QEMUIOVector *qiov, BdrvRequestFlags flags)
+nbd_co_do_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                 QEMUIOVector *qiov)
 {
     int ret, request_ret;
     Error *local_err = NULL;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnection *c = nbd_get_connection(s);
     NBDRequest request = {
         .type = NBD_CMD_READ,
         .from = offset,
         .len = bytes,
     };
 
+    assert(bytes <= NBD_MAX_BUFFER_SIZE);
+    assert(offset + bytes <= s->info.size);
+
+    do {
+        ret = nbd_co_send_request(c, &request, NULL);
+        if (ret < 0) {
+            continue;
+        }
+
+        ret = nbd_co_receive_cmdread_reply(c, request.cookie, offset, qiov,
+                                           &request_ret, &local_err);
+        if (local_err) {
+            trace_nbd_co_request_fail(request.from, request.len, request.cookie,
+                                      request.flags, request.type,
+                                      nbd_cmd_lookup(request.type),
+                                      ret, error_get_pretty(local_err));
+            error_free(local_err);
+            local_err = NULL;
+        }
+    } while (ret < 0 && nbd_client_retry(s, &c));
+
+    return ret ? ret : request_ret;
+}
+
+static NBDCacheChunk *nbd_cache_lookup(BDRVNBDState *s, int64_t offset)
+{
+    return g_hash_table_lookup(s->cache_map, &offset);
+}
+
+static void nbd_cache_drop(BDRVNBDState *s, NBDCacheChunk *chunk)
+{
+    g_hash_table_remove(s->cache_map, &chunk->offset);
+    chunk->offset = -1;
+    QTAILQ_REMOVE(&s->cache_lru, chunk, next);
+    QTAILQ_INSERT_HEAD(&s->cache_lru, chunk, next);
+}
+
+/*
+ * Drop the cached data in [@offset, @offset + @bytes), or all of it if
+ * @bytes is negative.  Must be called both before and after changing
+ * data on the server: reads that are in flight when it is called will
+ * not populate the cache.
+ */
+static void coroutine_fn nbd_cache_invalidate(BDRVNBDState *s, int64_t offset,
+                                              int64_t bytes)
+{
+    int64_t pos, end;
+    int i;
+
+    if (!s->cache_nb_chunks) {
+        return;
+    }
+
+    qemu_co_mutex_lock(&s->cache_lock);
+    s->cache_gen++;
+
+    if (bytes < 0 || bytes / NBD_CACHE_CHUNK_SIZE >= s->cache_nb_chunks) {
+        for (i = 0; i < s->cache_nb_chunks; i++) {
+            pos = s->cache_chunks[i].offset;
+            if (pos >= 0 && (bytes < 0 || (pos + NBD_CACHE_CHUNK_SIZE > offset &&
+                                           pos < offset + bytes))) {
+                nbd_cache_drop(s, &s->cache_chunks[i]);
+            }
+        }
+    } else {
+        end = offset + bytes;
+        for (pos = QEMU_ALIGN_DOWN(offset, NBD_CACHE_CHUNK_SIZE); pos < end;
+             pos += NBD_CACHE_CHUNK_SIZE) {
+            NBDCacheChunk *chunk = nbd_cache_lookup(s, pos);
+            if (chunk) {
+                nbd_cache_drop(s, chunk);
+            }
+        }
+    }
+
+    qemu_co_mutex_unlock(&s->cache_lock);
+}
+
+/* Insert a chunk read from the server, evicting the least recently used */
+static void nbd_cache_insert(BDRVNBDState *s, int64_t offset,
+                             const uint8_t *buf, int64_t bytes)
+{
+    NBDCacheChunk *chunk = nbd_cache_lookup(s, offset);
+
+    if (!chunk) {
+        chunk = QTAILQ_FIRST(&s->cache_lru);
+        if (chunk->offset >= 0) {
+            g_hash_table_remove(s->cache_map, &chunk->offset);
+        }
+        chunk->offset = offset;
+        g_hash_table_insert(s->cache_map, &chunk->offset, chunk);
+    }
+
+    memcpy(chunk->buf, buf, bytes);
+    memset(chunk->buf + bytes, 0, NBD_CACHE_CHUNK_SIZE - bytes);
+    QTAILQ_REMOVE(&s->cache_lru, chunk, next);
+    QTAILQ_INSERT_TAIL(&s->cache_lru, chunk, next);
+}
+
+/* Called with s->cache_lock held */
+static bool nbd_cache_read(BDRVNBDState *s, int64_t offset, int64_t bytes,
+                           QEMUIOVector *qiov)
+{
+    int64_t start = QEMU_ALIGN_DOWN(offset, NBD_CACHE_CHUNK_SIZE);
+    int64_t end = offset + bytes;
+    size_t qiov_offset = 0;
+    int64_t pos;
+
+    for (pos = start; pos < end; pos += NBD_CACHE_CHUNK_SIZE) {
+        if (!nbd_cache_lookup(s, pos)) {
+            return false;
+        }
+    }
+
+    for (pos = start; pos < end; pos += NBD_CACHE_CHUNK_SIZE) {
+        NBDCacheChunk *chunk = nbd_cache_lookup(s, pos);
+        int64_t from = MAX(offset, pos);
+        int64_t to = MIN(end, pos + NBD_CACHE_CHUNK_SIZE);
+
+        qemu_iovec_from_buf(qiov, qiov_offset, chunk->buf + (from - pos),
+                            to - from);
+        qiov_offset += to - from;
+        QTAILQ_REMOVE(&s->cache_lru, chunk, next);
+        QTAILQ_INSERT_TAIL(&s->cache_lru, chunk, next);
+    }
+
+    return true;
+}
+
+/*
+ * Serve a read from the cache, or read whole chunks from the server and
+ * cache them.  When reads are sequential, the chunks that follow the
+ * request are read too; the read-ahead window doubles with each
+ * sequential read, up to @max_read_ahead.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+nbd_cache_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                    QEMUIOVector *qiov)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int64_t start = QEMU_ALIGN_DOWN(offset, NBD_CACHE_CHUNK_SIZE);
+    int64_t end = QEMU_ALIGN_UP(offset + bytes, NBD_CACHE_CHUNK_SIZE);
+    int64_t max = MIN_NON_ZERO(NBD_MAX_BUFFER_SIZE, s->info.max_block);
+    int64_t fill_end, pos;
+    QEMUIOVector fill_qiov;
+    uint64_t gen;
+    uint8_t *buf;
+    int ret;
+
+    qemu_co_mutex_lock(&s->cache_lock);
+
+    if (offset == s->read_ahead_next) {
+        s->read_ahead_size = MIN(MAX(s->read_ahead_size * 2,
+                                     NBD_CACHE_CHUNK_SIZE),
+                                 s->max_read_ahead);
+    } else {
+        s->read_ahead_size = 0;
+    }
+    s->read_ahead_next = offset + bytes;
+
+    if (nbd_cache_read(s, offset, bytes, qiov)) {
+        s->cache_hits++;
+        qemu_co_mutex_unlock(&s->cache_lock);
+        return 0;
+    }
+
+    s->cache_misses++;
+    end = MIN(end + s->read_ahead_size,
+              start + QEMU_ALIGN_DOWN(max, NBD_CACHE_CHUNK_SIZE));
+    fill_end = MIN(end, s->info.size);
+    if (fill_end < offset + bytes ||
+        (end - start) / NBD_CACHE_CHUNK_SIZE > s->cache_nb_chunks ||
+        s->info.min_block > NBD_CACHE_CHUNK_SIZE) {
+        /* Too large to go through the cache */
+        qemu_co_mutex_unlock(&s->cache_lock);
+        return nbd_co_do_preadv(bs, offset, bytes, qiov);
+    }
+    if (fill_end > QEMU_ALIGN_UP(offset + bytes, NBD_CACHE_CHUNK_SIZE)) {
+        s->cache_read_ahead_bytes +=
+            fill_end - QEMU_ALIGN_UP(offset + bytes, NBD_CACHE_CHUNK_SIZE);
+    }
+    gen = s->cache_gen;
+    qemu_co_mutex_unlock(&s->cache_lock);
+
+    buf = g_try_malloc(fill_end - start);
+    if (!buf) {
+        return nbd_co_do_preadv(bs, offset, bytes, qiov);
+    }
+
+    trace_nbd_cache_fill(offset, bytes, start, fill_end - start);
+
+    qemu_iovec_init_buf(&fill_qiov, buf, fill_end - start);
+    ret = nbd_co_do_preadv(bs, start, fill_end - start, &fill_qiov);
+    if (ret < 0) {
+        goto out;
+    }
+
+    qemu_iovec_from_buf(qiov, 0, buf + (offset - start), bytes);
+
+    qemu_co_mutex_lock(&s->cache_lock);
+    if (gen == s->cache_gen) {
+        for (pos = start; pos < fill_end; pos += NBD_CACHE_CHUNK_SIZE) {
+            nbd_cache_insert(s, pos, buf + (pos - start),
+                             MIN(NBD_CACHE_CHUNK_SIZE, fill_end - pos));
+        }
+    }
+    qemu_co_mutex_unlock(&s->cache_lock);
+
+out:
+    g_free(buf);
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+nbd_client_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                     QEMUIOVector *qiov, BdrvRequestFlags flags)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+
     assert(bytes <= NBD_MAX_BUFFER_SIZE);
 
     if (!bytes) {
@@ -1274,28 +1760,13 @@ nbd_client_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
 
         assert(slop < BDRV_SECTOR_SIZE);
         qemu_iovec_memset(qiov, bytes - slop, 0, slop);
-        request.len -= slop;
+        bytes -= slop;
     }
 
-    do {
-        ret = nbd_co_send_request(bs, &request, NULL);
-        if (ret < 0) {
-            continue;
-        }
-
-        ret = nbd_co_receive_cmdread_reply(s, request.cookie, offset, qiov,
-                                           &request_ret, &local_err);
-        if (local_err) {
-            trace_nbd_co_request_fail(request.from, request.len, request.cookie,
-                                      request.flags, request.type,
-                                      nbd_cmd_lookup(request.type),
-                                      ret, error_get_pretty(local_err));
-            error_free(local_err);
-            local_err = NULL;
-        }
-    } while (ret < 0 && nbd_client_will_reconnect(s));
-
-    return ret ? ret : request_ret;
+    if (s->cache_enabled) {
+        return nbd_cache_co_preadv(bs, offset, bytes, qiov);
+    }
+    return nbd_co_do_preadv(bs, offset, bytes, qiov);
 }
 
 static int coroutine_fn GRAPH_RDLOCK
@@ -1303,6 +1774,7 @@ nbd_client_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
                       QEMUIOVector *qiov, BdrvRequestFlags flags)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int ret;
     NBDRequest request = {
         .type = NBD_CMD_WRITE,
         .from = offset,
@@ -1320,7 +1792,12 @@ nbd_client_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
     if (!bytes) {
         return 0;
     }
-    return nbd_co_request(bs, &request, qiov);
+
+    nbd_cache_invalidate(s, offset, bytes);
+    ret = nbd_co_request(bs, &request, qiov);
+    nbd_cache_invalidate(s, offset, bytes);
+
+    return ret;
 }
 
 static int coroutine_fn GRAPH_RDLOCK
@@ -1328,6 +1805,7 @@ nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
                             BdrvRequestFlags flags)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int ret;
     NBDRequest request = {
         .type = NBD_CMD_WRITE_ZEROES,
         .from = offset,
@@ -1357,7 +1835,12 @@ nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
     if (!bytes) {
         return 0;
     }
-    return nbd_co_request(bs, &request, NULL);
+
+    nbd_cache_invalidate(s, offset, bytes);
+    ret = nbd_co_request(bs, &request, NULL);
+    nbd_cache_invalidate(s, offset, bytes);
+
+    return ret;
 }
 
 static int coroutine_fn GRAPH_RDLOCK nbd_client_co_flush(BlockDriverState *bs)
@@ -1379,6 +1862,7 @@ static int coroutine_fn GRAPH_RDLOCK
 nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int ret;
     NBDRequest request = {
         .type = NBD_CMD_TRIM,
         .from = offset,
@@ -1393,7 +1877,11 @@ nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
         return 0;
     }
 
-    return nbd_co_request(bs, &request, NULL);
+    nbd_cache_invalidate(s, offset, bytes);
+    ret = nbd_co_request(bs, &request, NULL);
+    nbd_cache_invalidate(s, offset, bytes);
+
+    return ret;
 }
 
 static int coroutine_fn GRAPH_RDLOCK nbd_client_co_block_status(
@@ -1403,6 +1891,7 @@ static int coroutine_fn GRAPH_RDLOCK nbd_client_co_block_status(
     int ret, request_ret;
     NBDExtent64 extent = { 0 };
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnection *c = nbd_get_connection(s);
     Error *local_err = NULL;
 
     NBDRequest request = {
@@ -1441,12 +1930,12 @@ static int coroutine_fn GRAPH_RDLOCK nbd_client_co_block_status(
         assert(QEMU_IS_ALIGNED(request.len, s->info.min_block));
     }
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        ret = nbd_co_send_request(c, &request, NULL);
         if (ret < 0) {
             continue;
         }
 
-        ret = nbd_co_receive_blockstatus_reply(s, request.cookie, bytes,
+        ret = nbd_co_receive_blockstatus_reply(c, request.cookie, bytes,
                                                &extent, &request_ret,
                                                &local_err);
         if (local_err) {
@@ -1457,7 +1946,7 @@ static int coroutine_fn GRAPH_RDLOCK nbd_client_co_block_status(
             error_free(local_err);
             local_err = NULL;
         }
-    } while (ret < 0 && nbd_client_will_reconnect(s));
+    } while (ret < 0 && nbd_client_retry(s, &c));
 
     if (ret < 0 || request_ret < 0) {
         return ret ? ret : request_ret;
@@ -1486,24 +1975,28 @@ static int nbd_client_reopen_prepare(BDRVReopenState *state,
 
 static void nbd_yank(void *opaque)
 {
-    BlockDriverState *bs = opaque;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnection *c = opaque;
 
-    QEMU_LOCK_GUARD(&s->requests_lock);
-    qio_channel_shutdown(s->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
-    s->state = NBD_CLIENT_QUIT;
+    QEMU_LOCK_GUARD(&c->requests_lock);
+    qio_channel_shutdown(c->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+    c->state = NBD_CLIENT_QUIT;
 }
 
 static void nbd_client_close(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
-    NBDRequest request = { .type = NBD_CMD_DISC, .mode = s->info.mode };
+    unsigned i;
 
-    if (s->ioc) {
-        nbd_send_request(s->ioc, &request);
-    }
+    for (i = 0; i < s->nb_conns; i++) {
+        NBDConnection *c = &s->conns[i];
+        NBDRequest request = { .type = NBD_CMD_DISC, .mode = c->info.mode };
+
+        if (c->ioc) {
+            nbd_send_request(c->ioc, &request);
+        }
 
-    nbd_teardown_connection(bs);
+        nbd_teardown_connection(c);
+    }
 }
 
 
@@ -1840,6 +2333,31 @@ static QemuOptsList nbd_runtime_opts = {
                     "attempts until successful or until @open-timeout seconds "
                     "have elapsed. Default 0",
         },
+        {
+            .name = "multi-conn",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of connections to open if the server supports "
+                    "multiple connections. Default 1",
+        },
+        {
+            .name = "cache-size",
+            .type = QEMU_OPT_SIZE,
+            .help = "Size of the read cache in bytes. Only used for "
+                    "read-only exports unless cache-exclusive is set. "
+                    "Default 0 (disabled)",
+        },
+        {
+            .name = "cache-exclusive",
+            .type = QEMU_OPT_BOOL,
+            .help = "No other client writes to the export, so the read "
+                    "cache can be used even if it is writable",
+        },
+        {
+            .name = "max-read-ahead",
+            .type = QEMU_OPT_SIZE,
+            .help = "Maximum number of bytes read ahead of sequential reads "
+                    "into the read cache",
+        },
         { /* end of list */ }
     },
 };
@@ -1895,6 +2413,16 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
 
     s->reconnect_delay = qemu_opt_get_number(opts, "reconnect-delay", 0);
     s->open_timeout = qemu_opt_get_number(opts, "open-timeout", 0);
+    s->multi_conn = qemu_opt_get_number(opts, "multi-conn", 1);
+    if (!s->multi_conn || s->multi_conn > MAX_NBD_CONNECTIONS) {
+        error_setg(errp, "multi-conn must be between 1 and %d",
+                   MAX_NBD_CONNECTIONS);
+        goto error;
+    }
+    s->cache_size = qemu_opt_get_size(opts, "cache-size", 0);
+    s->max_read_ahead = qemu_opt_get_size(opts, "max-read-ahead",
+                                          NBD_MAX_BUFFER_SIZE);
+    s->cache_exclusive = qemu_opt_get_bool(opts, "cache-exclusive", false);
 
     ret = 0;
 
@@ -1907,13 +2435,10 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
                     Error **errp)
 {
     int ret;
+    unsigned i, j;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
 
     s->bs = bs;
-    qemu_mutex_init(&s->requests_lock);
-    qemu_co_queue_init(&s->free_sema);
-    qemu_co_mutex_init(&s->send_mutex);
-    qemu_co_mutex_init(&s->receive_mutex);
 
     if (!yank_register_instance(BLOCKDEV_YANK_INSTANCE(bs->node_name), errp)) {
         return -EEXIST;
@@ -1924,20 +2449,53 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
-    s->conn = nbd_client_connection_new(s->saddr, true, s->export,
-                                        s->x_dirty_bitmap, s->tlscreds,
-                                        s->tlshostname);
+    ret = nbd_cache_init(s, errp);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    s->conns = g_new0(NBDConnection, s->multi_conn);
+    s->nb_conns = s->multi_conn;
+    s->nb_active_conns = s->nb_conns;
+    for (i = 0; i < s->nb_conns; i++) {
+        NBDConnection *c = &s->conns[i];
+
+        c->s = s;
+        c->index = i;
+        qemu_mutex_init(&c->requests_lock);
+        qemu_co_queue_init(&c->free_sema);
+        qemu_co_mutex_init(&c->send_mutex);
+        qemu_co_mutex_init(&c->receive_mutex);
+    }
 
     if (s->open_timeout) {
-        nbd_client_connection_enable_retry(s->conn);
         open_timer_init(s, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
                         s->open_timeout * NANOSECONDS_PER_SECOND);
     }
 
-    s->state = NBD_CLIENT_CONNECTING_WAIT;
-    ret = nbd_do_establish_connection(bs, true, errp);
-    if (ret < 0) {
-        goto fail;
+    for (i = 0; i < s->nb_conns; i++) {
+        NBDConnection *c = &s->conns[i];
+
+        c->conn = nbd_client_connection_new(s->saddr, true, s->export,
+                                            s->x_dirty_bitmap, s->tlscreds,
+                                            s->tlshostname);
+        if (s->open_timeout) {
+            nbd_client_connection_enable_retry(c->conn);
+        }
+
+        c->state = NBD_CLIENT_CONNECTING_WAIT;
+        ret = nbd_do_establish_connection(bs, i, true, errp);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        if (i == 0 && qatomic_read(&s->nb_active_conns) == 1) {
+            /* Not safe, stick to a single connection */
+            for (j = 1; j < s->nb_conns; j++) {
+                qemu_mutex_destroy(&s->conns[j].requests_lock);
+            }
+            s->nb_conns = 1;
+        }
     }
 
     /*
@@ -1947,12 +2505,20 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
      */
     open_timer_del(s);
 
-    nbd_client_connection_enable_retry(s->conn);
+    if (s->cache_nb_chunks && !s->cache_enabled) {
+        warn_report("nbd: export is writable, read cache is not used "
+                    "without cache-exclusive=on");
+    }
+
+    for (i = 0; i < s->nb_conns; i++) {
+        nbd_client_connection_enable_retry(s->conns[i].conn);
+    }
 
     return 0;
 
 fail:
     open_timer_del(s);
+    nbd_client_close(bs);
     nbd_clear_bdrvstate(bs);
     return ret;
 }
@@ -1999,6 +2565,22 @@ static void nbd_refresh_limits(BlockDriverState *bs, Error **errp)
     }
 }
 
+static BlockStatsSpecific *nbd_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+
+    stats->driver = BLOCKDEV_DRIVER_NBD;
+    stats->u.nbd = (BlockStatsSpecificNbd) {
+        .cache_hits = s->cache_hits,
+        .cache_misses = s->cache_misses,
+        .read_ahead_bytes = s->cache_read_ahead_bytes,
+        .connections = qatomic_read(&s->nb_active_conns),
+    };
+
+    return stats;
+}
+
 static void nbd_close(BlockDriverState *bs)
 {
     nbd_client_close(bs);
@@ -2099,22 +2681,28 @@ static const char *const nbd_strong_runtime_opts[] = {
 static void nbd_cancel_in_flight(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    unsigned i;
 
-    reconnect_delay_timer_del(s);
+    for (i = 0; i < s->nb_conns; i++) {
+        NBDConnection *c = &s->conns[i];
 
-    qemu_mutex_lock(&s->requests_lock);
-    if (s->state == NBD_CLIENT_CONNECTING_WAIT) {
-        s->state = NBD_CLIENT_CONNECTING_NOWAIT;
-    }
-    qemu_mutex_unlock(&s->requests_lock);
+        reconnect_delay_timer_del(c);
 
-    nbd_co_establish_connection_cancel(s->conn);
+        qemu_mutex_lock(&c->requests_lock);
+        if (c->state == NBD_CLIENT_CONNECTING_WAIT) {
+            c->state = NBD_CLIENT_CONNECTING_NOWAIT;
+        }
+        qemu_mutex_unlock(&c->requests_lock);
+
+        nbd_co_establish_connection_cancel(c->conn);
+    }
 }
 
 static void nbd_attach_aio_context(BlockDriverState *bs,
                                    AioContext *new_context)
 {
     BDRVNBDState *s = bs->opaque;
+    unsigned i;
 
     /* The open_timer is used only during nbd_open() */
     assert(!s->open_timer);
@@ -2128,15 +2716,20 @@ static void nbd_attach_aio_context(BlockDriverState *bs,
      * Since the AioContext can only be changed when a node is drained,
      * the reconnect_delay_timer cannot be active here.
      */
-    assert(!s->reconnect_delay_timer);
+    for (i = 0; i < s->nb_conns; i++) {
+        assert(!s->conns[i].reconnect_delay_timer);
+    }
 }
 
 static void nbd_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNBDState *s = bs->opaque;
+    unsigned i;
 
     assert(!s->open_timer);
-    assert(!s->reconnect_delay_timer);
+    for (i = 0; i < s->nb_conns; i++) {
+        assert(!s->conns[i].reconnect_delay_timer);
+    }
 }
 
 static BlockDriver bdrv_nbd = {
@@ -2155,6 +2748,7 @@ static BlockDriver bdrv_nbd = {
     .bdrv_co_flush_to_os        = nbd_client_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
     .bdrv_refresh_limits        = nbd_refresh_limits,
+    .bdrv_get_specific_stats    = nbd_get_specific_stats,
     .bdrv_co_truncate           = nbd_co_truncate,
     .bdrv_co_getlength          = nbd_co_getlength,
     .bdrv_refresh_filename      = nbd_refresh_filename,
@@ -2183,6 +2777,7 @@ static BlockDriver bdrv_nbd_tcp = {
     .bdrv_co_flush_to_os        = nbd_client_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
     .bdrv_refresh_limits        = nbd_refresh_limits,
+    .bdrv_get_specific_stats    = nbd_get_specific_stats,
     .bdrv_co_truncate           = nbd_co_truncate,
     .bdrv_co_getlength          = nbd_co_getlength,
     .bdrv_refresh_filename      = nbd_refresh_filename,
@@ -2211,6 +2806,7 @@ static BlockDriver bdrv_nbd_unix = {
     .bdrv_co_flush_to_os        = nbd_client_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
     .bdrv_refresh_limits        = nbd_refresh_limits,
+    .bdrv_get_specific_stats    = nbd_get_specific_stats,
     .bdrv_co_truncate           = nbd_co_truncate,
     .bdrv_co_getlength          = nbd_co_getlength,
     .bdrv_refresh_filename      = nbd_refresh_filename,
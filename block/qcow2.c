@@ -1888,6 +1888,7 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    qemu_co_queue_init(&s->compress_alloc_queue);
 
     return ret;
 
@@ -4671,6 +4672,28 @@ fail:
     return ret;
 }
 
+/*
+ * Wait until the compressed write with sequence number @seq may allocate its
+ * host cluster. Must be called with s->lock held.
+ */
+static void coroutine_fn qcow2_co_compress_alloc_wait(BDRVQcow2State *s,
+                                                      uint64_t seq)
+{
+    while (s->compress_seq_alloc != seq) {
+        qemu_co_queue_wait(&s->compress_alloc_queue, &s->lock);
+    }
+}
+
+/*
+ * Let the next compressed write allocate its host cluster. Must be called
+ * with s->lock held.
+ */
+static void coroutine_fn qcow2_co_compress_alloc_done(BDRVQcow2State *s)
+{
+    s->compress_seq_alloc++;
+    qemu_co_queue_restart_all(&s->compress_alloc_queue);
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
                                  uint64_t offset, uint64_t bytes,
@@ -4681,10 +4704,17 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
     ssize_t out_len;
     uint8_t *buf, *out_buf;
     uint64_t cluster_offset;
+    uint64_t seq;
 
     assert(bytes == s->cluster_size || (bytes < s->cluster_size &&
            (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS)));
 
+    /*
+     * Tasks are entered in the order they are added to the pool, so taking
+     * the sequence number before the first yield keeps the request order.
+     */
+    seq = s->compress_seq_next++;
+
     buf = qemu_blockalign(bs, s->cluster_size);
     if (bytes < s->cluster_size) {
         /* Zero-pad last write if image size is not cluster aligned */
@@ -4696,21 +4726,33 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
 
     out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
                                 buf, s->cluster_size);
+
+    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_compress_alloc_wait(s, seq);
     if (out_len == -ENOMEM) {
-        /* could not compress: write normal cluster */
+        /*
+         * could not compress: write normal cluster. Keep our turn until it is
+         * allocated so that the following compressed clusters come after it.
+         */
+        qemu_co_mutex_unlock(&s->lock);
         ret = qcow2_co_pwritev_part(bs, offset, bytes, qiov, qiov_offset, 0);
+        qemu_co_mutex_lock(&s->lock);
+        qcow2_co_compress_alloc_done(s);
+        qemu_co_mutex_unlock(&s->lock);
         if (ret < 0) {
             goto fail;
         }
         goto success;
     } else if (out_len < 0) {
+        qcow2_co_compress_alloc_done(s);
+        qemu_co_mutex_unlock(&s->lock);
         ret = -EINVAL;
         goto fail;
     }
 
-    qemu_co_mutex_lock(&s->lock);
     ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
                                                 &cluster_offset);
+    qcow2_co_compress_alloc_done(s);
     if (ret < 0) {
         qemu_co_mutex_unlock(&s->lock);
         goto fail;
@@ -5236,7 +5278,7 @@ err:
     return NULL;
 }
 
-static int coroutine_fn
+static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -5244,9 +5286,23 @@ qcow2_co_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     bdi->subcluster_size = s->subcluster_size;
     bdi->vm_state_offset = qcow2_vm_state_offset(s);
     bdi->is_dirty = s->incompatible_features & QCOW2_INCOMPAT_DIRTY;
+    bdi->multi_cluster_compressed_writes = !has_data_file(bs);
     return 0;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BDRVQcow2State *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    qcow2_cache_get_stats(s->l2_table_cache, &stats->u.qcow2.l2_cache);
+    qcow2_cache_get_stats(s->refcount_block_cache,
+                          &stats->u.qcow2.refcount_cache);
+
+    return stats;
+}
+
 static ImageInfoSpecific * GRAPH_RDLOCK
 qcow2_get_specific_info(BlockDriverState *bs, Error **errp)
 {
@@ -6176,6 +6232,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure                       = qcow2_measure,
     .bdrv_co_get_info                   = qcow2_co_get_info,
     .bdrv_get_specific_info             = qcow2_get_specific_info,
+    .bdrv_get_specific_stats            = qcow2_get_specific_stats,
 
     .bdrv_co_save_vmstate               = qcow2_co_save_vmstate,
     .bdrv_co_load_vmstate               = qcow2_co_load_vmstate,
@@ -411,6 +411,16 @@ typedef struct BDRVQcow2State {
     CoQueue thread_task_queue;
     int nb_threads;
 
+    /*
+     * Compressed writes are compressed in parallel, but their host clusters
+     * are allocated in the order in which the writes were started, so that
+     * the image layout does not depend on the thread scheduling.
+     * Protected by lock.
+     */
+    uint64_t compress_seq_next;
+    uint64_t compress_seq_alloc;
+    CoQueue compress_alloc_queue;
+
     BdrvChild *data_file;
 
     bool metadata_preallocation_checked;
@@ -1021,6 +1031,7 @@ qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+void qcow2_cache_get_stats(Qcow2Cache *c, Qcow2CacheStats *stats);
 
 /* qcow2-bitmap.c functions */
 int coroutine_fn GRAPH_RDLOCK
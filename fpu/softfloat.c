@@ -396,6 +396,103 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
     return soft(ua.s, ub.s, s);
 }
 
+/*
+ * Vector flavors of float32_gen2 and float64_gen2, for @n elements.
+ *
+ * Elements are processed in blocks of FLOAT_VEC_BLOCK.  Each block is
+ * first computed with @hard in straight loops that the compiler can
+ * vectorize, checking for the conditions under which the scalar
+ * function would have gone to softfloat or raised overflow: inputs
+ * that are not zero-or-normal (including denormals to be flushed),
+ * and infinite or tiny results.  If any element of a block trips one of
+ * them, the block is redone one element at a time with the scalar
+ * function, so results and exception flags are the same as calling it
+ * in a loop.
+ *
+ * @d may be equal to @a or @b, but must not otherwise overlap them.
+ */
+#define FLOAT_VEC_BLOCK 16
+
+static inline void
+float32_gen2_vec(size_t n, float32 *d, const float32 *a, const float32 *b,
+                 float_status *s, hard_f32_op2_fn hard, soft_f32_op2_fn soft,
+                 f32_check_fn pre, f32_check_fn post)
+{
+    union_float32 ua[FLOAT_VEC_BLOCK], ub[FLOAT_VEC_BLOCK];
+    union_float32 ur[FLOAT_VEC_BLOCK];
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        bool ok = can_use_fpu(s);
+
+        len = MIN(n - i, FLOAT_VEC_BLOCK);
+        for (j = 0; j < len; j++) {
+            ua[j].s = a[i + j];
+            ub[j].s = b[i + j];
+        }
+        if (likely(ok)) {
+            for (j = 0; j < len; j++) {
+                ok &= pre(ua[j], ub[j]);
+                ur[j].h = hard(ua[j].h, ub[j].h);
+            }
+            for (j = 0; j < len; j++) {
+                ok &= !f32_is_inf(ur[j]) &&
+                      !(fabsf(ur[j].h) <= FLT_MIN && post(ua[j], ub[j]));
+            }
+        }
+        if (likely(ok)) {
+            for (j = 0; j < len; j++) {
+                d[i + j] = ur[j].s;
+            }
+        } else {
+            for (j = 0; j < len; j++) {
+                d[i + j] = float32_gen2(ua[j].s, ub[j].s, s,
+                                        hard, soft, pre, post);
+            }
+        }
+    }
+}
+
+static inline void
+float64_gen2_vec(size_t n, float64 *d, const float64 *a, const float64 *b,
+                 float_status *s, hard_f64_op2_fn hard, soft_f64_op2_fn soft,
+                 f64_check_fn pre, f64_check_fn post)
+{
+    union_float64 ua[FLOAT_VEC_BLOCK], ub[FLOAT_VEC_BLOCK];
+    union_float64 ur[FLOAT_VEC_BLOCK];
+    size_t i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        bool ok = can_use_fpu(s);
+
+        len = MIN(n - i, FLOAT_VEC_BLOCK);
+        for (j = 0; j < len; j++) {
+            ua[j].s = a[i + j];
+            ub[j].s = b[i + j];
+        }
+        if (likely(ok)) {
+            for (j = 0; j < len; j++) {
+                ok &= pre(ua[j], ub[j]);
+                ur[j].h = hard(ua[j].h, ub[j].h);
+            }
+            for (j = 0; j < len; j++) {
+                ok &= !f64_is_inf(ur[j]) &&
+                      !(fabs(ur[j].h) <= DBL_MIN && post(ua[j], ub[j]));
+            }
+        }
+        if (likely(ok)) {
+            for (j = 0; j < len; j++) {
+                d[i + j] = ur[j].s;
+            }
+        } else {
+            for (j = 0; j < len; j++) {
+                d[i + j] = float64_gen2(ua[j].s, ub[j].s, s,
+                                        hard, soft, pre, post);
+            }
+        }
+    }
+}
+
 /*
  * Classify a floating point number. Everything above float_class_qnan
  * is a NaN so cls >= float_class_qnan is any NaN.
@@ -2023,6 +2120,38 @@ float64_sub(float64 a, float64 b, float_status *s)
     return float64_addsub(a, b, s, hard_f64_sub, soft_f64_sub);
 }
 
+void QEMU_FLATTEN
+float32_add_vec(size_t n, float32 *d, const float32 *a, const float32 *b,
+                float_status *s)
+{
+    float32_gen2_vec(n, d, a, b, s, hard_f32_add, soft_f32_add,
+                     f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float32_sub_vec(size_t n, float32 *d, const float32 *a, const float32 *b,
+                float_status *s)
+{
+    float32_gen2_vec(n, d, a, b, s, hard_f32_sub, soft_f32_sub,
+                     f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_add_vec(size_t n, float64 *d, const float64 *a, const float64 *b,
+                float_status *s)
+{
+    float64_gen2_vec(n, d, a, b, s, hard_f64_add, soft_f64_add,
+                     f64_is_zon2, f64_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_sub_vec(size_t n, float64 *d, const float64 *a, const float64 *b,
+                float_status *s)
+{
+    float64_gen2_vec(n, d, a, b, s, hard_f64_sub, soft_f64_sub,
+                     f64_is_zon2, f64_addsubmul_post);
+}
+
 static float64 float64r32_addsub(float64 a, float64 b, float_status *status,
                                  bool subtract)
 {
@@ -2176,6 +2305,22 @@ float64_mul(float64 a, float64 b, float_status *s)
                         f64_is_zon2, f64_addsubmul_post);
 }
 
+void QEMU_FLATTEN
+float32_mul_vec(size_t n, float32 *d, const float32 *a, const float32 *b,
+                float_status *s)
+{
+    float32_gen2_vec(n, d, a, b, s, hard_f32_mul, soft_f32_mul,
+                     f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_mul_vec(size_t n, float64 *d, const float64 *a, const float64 *b,
+                float_status *s)
+{
+    float64_gen2_vec(n, d, a, b, s, hard_f64_mul, soft_f64_mul,
+                     f64_is_zon2, f64_addsubmul_post);
+}
+
 float64 float64r32_mul(float64 a, float64 b, float_status *status)
 {
     FloatParts64 pa, pb, *pr;
@@ -2554,6 +2699,22 @@ float64_div(float64 a, float64 b, float_status *s)
                         f64_div_pre, f64_div_post);
 }
 
+void QEMU_FLATTEN
+float32_div_vec(size_t n, float32 *d, const float32 *a, const float32 *b,
+                float_status *s)
+{
+    float32_gen2_vec(n, d, a, b, s, hard_f32_div, soft_f32_div,
+                     f32_div_pre, f32_div_post);
+}
+
+void QEMU_FLATTEN
+float64_div_vec(size_t n, float64 *d, const float64 *a, const float64 *b,
+                float_status *s)
+{
+    float64_gen2_vec(n, d, a, b, s, hard_f64_div, soft_f64_div,
+                     f64_div_pre, f64_div_post);
+}
+
 float64 float64r32_div(float64 a, float64 b, float_status *status)
 {
     FloatParts64 pa, pb, *pr;
@@ -59,6 +59,9 @@
 #define VIRTIO_NET_RX_QUEUE_MIN_SIZE VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE
 #define VIRTIO_NET_TX_QUEUE_MIN_SIZE VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE
 
+/* Packets popped from the tx virtqueue and completed at once */
+#define VIRTIO_NET_TX_BATCH 32
+
 #define VIRTIO_NET_IP4_ADDR_SIZE   8        /* ipv4 saddr + daddr */
 
 #define VIRTIO_NET_TCP_FLAG         0x3F
@@ -2695,7 +2698,7 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
     virtio_notify(vdev, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
@@ -2718,11 +2721,41 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+static void virtio_net_tx_push_batch(VirtIONetQueue *q,
+                                     VirtQueueElement **elems,
+                                     unsigned int count)
+{
+    unsigned int i;
+
+    if (!count) {
+        return;
+    }
+
+    virtqueue_push_batch(q->tx_vq, elems, NULL, count);
+    virtio_notify(VIRTIO_DEVICE(q->n), q->tx_vq);
+    for (i = 0; i < count; i++) {
+        virtqueue_element_free(elems[i]);
+    }
+}
+
+/* Give back the elements that were popped but not sent, newest first */
+static void virtio_net_tx_unpop_batch(VirtIONetQueue *q,
+                                      VirtQueueElement **elems,
+                                      unsigned int count)
+{
+    while (count--) {
+        virtqueue_unpop(q->tx_vq, elems[count], 0);
+        virtqueue_element_free(elems[count]);
+    }
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    VirtQueueElement *elems[VIRTIO_NET_TX_BATCH];
     VirtQueueElement *elem;
+    unsigned int i = 0, num_elems = 0;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
@@ -2740,10 +2773,19 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
         struct virtio_net_hdr vhdr;
 
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
-            break;
+        if (i == num_elems) {
+            /* Everything popped so far has been sent */
+            virtio_net_tx_push_batch(q, elems, num_elems);
+            num_elems = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement),
+                                            elems,
+                                            MIN(ARRAY_SIZE(elems),
+                                                n->tx_burst - num_packets));
+            i = 0;
+            if (!num_elems) {
+                break;
+            }
         }
+        elem = elems[i++];
 
         out_num = elem->out_num;
         out_sg = elem->out_sg;
@@ -2798,25 +2840,27 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
                                       out_sg, out_num, virtio_net_tx_complete);
         if (ret == 0) {
+            virtio_net_tx_unpop_batch(q, elems + i, num_elems - i);
+            virtio_net_tx_push_batch(q, elems, i - 1);
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
             return -EBUSY;
         }
 
 drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
-
         if (++num_packets >= n->tx_burst) {
             break;
         }
     }
+    virtio_net_tx_unpop_batch(q, elems + i, num_elems - i);
+    virtio_net_tx_push_batch(q, elems, i);
     return num_packets;
 
 detach:
+    virtio_net_tx_unpop_batch(q, elems + i, num_elems - i);
+    virtio_net_tx_push_batch(q, elems, i - 1);
     virtqueue_detach_element(q->tx_vq, elem, 0);
-    g_free(elem);
+    virtqueue_element_free(elem);
     return -EINVAL;
 }
 
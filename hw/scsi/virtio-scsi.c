@@ -32,6 +32,9 @@
 #include "hw/virtio/virtio-access.h"
 #include "trace.h"
 
+/* Requests popped from a command virtqueue at once */
+#define VIRTIO_SCSI_POP_BATCH 32
+
 typedef struct VirtIOSCSIReq {
     /*
      * Note:
@@ -100,7 +103,7 @@ static void virtio_scsi_free_req(VirtIOSCSIReq *req)
 {
     qemu_iovec_destroy(&req->resp_iov);
     qemu_sglist_destroy(&req->qsgl);
-    g_free(req);
+    virtqueue_element_free(&req->elem);
 }
 
 static void virtio_scsi_complete_req(VirtIOSCSIReq *req, QemuMutex *vq_lock)
@@ -898,7 +901,10 @@ static void virtio_scsi_handle_cmd_req_submit(VirtIOSCSI *s, VirtIOSCSIReq *req)
 
 static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
 {
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    VirtQueueElement *elems[VIRTIO_SCSI_POP_BATCH];
     VirtIOSCSIReq *req, *next;
+    unsigned int i, n;
     int ret = 0;
     bool suppress_notifications = virtio_queue_get_notification(vq);
 
@@ -909,12 +915,26 @@ static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_scsi_pop_req(s, vq, NULL))) {
-            ret = virtio_scsi_handle_cmd_req_prepare(s, req);
-            if (!ret) {
-                QTAILQ_INSERT_TAIL(&reqs, req, next);
-            } else if (ret == -EINVAL) {
+        while (ret != -EINVAL &&
+               (n = virtqueue_pop_batch(vq,
+                                        sizeof(VirtIOSCSIReq) + vs->cdb_size,
+                                        elems, ARRAY_SIZE(elems)))) {
+            for (i = 0; i < n; i++) {
+                req = (VirtIOSCSIReq *)elems[i];
+                virtio_scsi_init_req(s, vq, req);
+                ret = virtio_scsi_handle_cmd_req_prepare(s, req);
+                if (!ret) {
+                    QTAILQ_INSERT_TAIL(&reqs, req, next);
+                } else if (ret == -EINVAL) {
+                    break;
+                }
+            }
+            if (ret == -EINVAL) {
                 /* The device is broken and shouldn't process any request */
+                while (++i < n) {
+                    virtqueue_detach_element(vq, elems[i], 0);
+                    virtqueue_element_free(elems[i]);
+                }
                 while (!QTAILQ_EMPTY(&reqs)) {
                     req = QTAILQ_FIRST(&reqs);
                     QTAILQ_REMOVE(&reqs, req, next);
@@ -722,6 +722,7 @@ static void virtio_pci_ats_ctrl_trigger(PCIDevice *pci_dev, bool enable)
     VirtioDeviceClass *k = VIRTIO_DEVICE_GET_CLASS(vdev);
 
     vdev->device_iotlb_enabled = enable;
+    virtio_toggle_device_iotlb(vdev);
 
     if (k->toggle_device_iotlb) {
         k->toggle_device_iotlb(vdev);
@@ -12,6 +12,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-virtio.h"
 #include "trace.h"
@@ -32,6 +33,7 @@
 #include "hw/virtio/virtio-access.h"
 #include "system/dma.h"
 #include "system/runstate.h"
+#include "system/xen.h"
 #include "virtio-qmp.h"
 
 #include "standard-headers/linux/virtio_ids.h"
@@ -117,6 +119,56 @@ typedef struct VRingPackedDescEvent {
     uint16_t flags;
 } VRingPackedDescEvent ;
 
+/*
+ * Elements allocated by virtqueue_pop_batch() have room for this many
+ * descriptors; longer chains are allocated with g_malloc().
+ */
+#define VIRTQUEUE_POOL_SG 16
+
+/* Overlaid on a VirtQueueElement while it sits in the pool */
+typedef struct VirtQueuePoolEntry {
+    QSLIST_ENTRY(VirtQueuePoolEntry) next;
+} VirtQueuePoolEntry;
+
+/*
+ * Free elements for virtqueue_pop_batch().  @free is only accessed by the
+ * thread that pops from the queue, @released is filled atomically by
+ * virtqueue_element_free() from any thread.  The queue and every element
+ * that was popped from the pool hold a reference, so that elements can
+ * still be freed after the queue is deleted.
+ */
+struct VirtQueuePool {
+    unsigned int refcnt; /* atomic */
+    size_t elem_sz;
+    QSLIST_HEAD(, VirtQueuePoolEntry) free;
+    QSLIST_HEAD(, VirtQueuePoolEntry) released;
+};
+
+/*
+ * Guest-physical ranges whose host mapping is cached by each virtqueue.
+ * Entries cover at most VIRTQUEUE_XLAT_WINDOW bytes, starting at a
+ * multiple of it when possible.
+ */
+#define VIRTQUEUE_XLAT_ENTRIES 4
+#define VIRTQUEUE_XLAT_WINDOW  (1 * GiB)
+
+typedef struct VirtQueueXlatEntry {
+    hwaddr start;
+    hwaddr len;                 /* 0 if the entry is unused */
+    void *host;
+    MemoryRegion *mr;
+    unsigned int gen;           /* VirtIODevice.xlat_gen at fill time */
+    bool is_write;
+} VirtQueueXlatEntry;
+
+/* IOMMU notifier that flushes the translations cached for a device */
+struct VirtIOXlatIOMMU {
+    VirtIODevice *vdev;
+    MemoryRegion *mr;
+    IOMMUNotifier n;
+    QLIST_ENTRY(VirtIOXlatIOMMU) next;
+};
+
 struct VirtQueue
 {
     VRing vring;
@@ -153,6 +205,16 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    /* Element pool for virtqueue_pop_batch(), allocated on first use */
+    VirtQueuePool *pool;
+
+    /*
+     * Descriptor translation cache, see virtqueue_xlat_map().  Only
+     * accessed by the thread that pops from the queue.
+     */
+    VirtQueueXlatEntry xlat[VIRTQUEUE_XLAT_ENTRIES];
+    unsigned int xlat_next;
 };
 
 const char *virtio_device_names[] = {
@@ -867,7 +929,8 @@ void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
 {
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        virtqueue_packed_rewind(vq, 1);
+        /* Popping the element skipped all of its descriptors */
+        virtqueue_packed_rewind(vq, elem->ndescs);
     } else {
         virtqueue_split_rewind(vq, 1);
     }
@@ -1168,6 +1231,18 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement **elems,
+                          const unsigned int *lens, unsigned int count)
+{
+    unsigned int i;
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < count; i++) {
+        virtqueue_fill(vq, elems[i], lens ? lens[i] : 0, i);
+    }
+    virtqueue_flush(vq, count);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1552,11 +1627,100 @@ int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
     return in_bytes <= in_total && out_bytes <= out_total;
 }
 
-static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
+/* Make descriptor translations cached by the virtqueues stale */
+static void virtio_xlat_invalidate(VirtIODevice *vdev)
+{
+    qatomic_inc(&vdev->xlat_gen);
+}
+
+/*
+ * Try to fill a translation cache entry for [@pa, @pa + @len) starting
+ * at @start.  Called within rcu_read_lock().
+ */
+static VirtQueueXlatEntry *virtqueue_xlat_fill(VirtQueue *vq, hwaddr start,
+                                               hwaddr pa, hwaddr len,
+                                               bool is_write, unsigned int gen)
+{
+    VirtQueueXlatEntry *e;
+    MemoryRegion *mr;
+    hwaddr xlat, l = VIRTQUEUE_XLAT_WINDOW;
+
+    mr = address_space_translate(vq->vdev->dma_as, start, &xlat, &l,
+                                 is_write, MEMTXATTRS_UNSPECIFIED);
+    if (!memory_access_is_direct(mr, is_write, MEMTXATTRS_UNSPECIFIED) ||
+        l < pa - start + len) {
+        return NULL;
+    }
+
+    e = &vq->xlat[vq->xlat_next++ % VIRTQUEUE_XLAT_ENTRIES];
+    e->start = start;
+    e->len = l;
+    e->host = qemu_map_ram_ptr(mr->ram_block, xlat);
+    e->mr = mr;
+    e->gen = gen;
+    e->is_write = is_write;
+    return e;
+}
+
+/*
+ * Like dma_memory_map(), but look up @pa in the translation cache of @vq
+ * first so that repeated mappings of the same guest buffers skip the
+ * FlatView walk.  The result is unmapped with dma_memory_unmap() as
+ * usual.  Called within rcu_read_lock(), which keeps the cached memory
+ * regions alive until the entries are invalidated.
+ */
+static void *virtqueue_xlat_map(VirtQueue *vq, hwaddr pa, hwaddr *plen,
+                                bool is_write)
+{
+    VirtIODevice *vdev = vq->vdev;
+    unsigned int gen = qatomic_read(&vdev->xlat_gen);
+    hwaddr len = *plen;
+    VirtQueueXlatEntry *e;
+    int i;
+
+    for (i = 0; i < VIRTQUEUE_XLAT_ENTRIES; i++) {
+        e = &vq->xlat[i];
+        if (e->gen == gen && e->is_write == is_write &&
+            pa - e->start < e->len && len <= e->len - (pa - e->start)) {
+            goto hit;
+        }
+    }
+
+    /*
+     * Xen maps guest memory lazily through the map cache, so the host
+     * address of a range is not stable.
+     */
+    if (vdev->xlat_disabled || xen_enabled()) {
+        goto slow;
+    }
+    e = virtqueue_xlat_fill(vq, QEMU_ALIGN_DOWN(pa, VIRTQUEUE_XLAT_WINDOW),
+                            pa, len, is_write, gen);
+    if (!e) {
+        e = virtqueue_xlat_fill(vq, pa, pa, len, is_write, gen);
+    }
+    if (!e) {
+        goto slow;
+    }
+
+hit:
+    /* Same reference that address_space_map() takes */
+    memory_region_ref(e->mr);
+    fuzz_dma_read_cb(pa, len, e->mr);
+    return e->host + (pa - e->start);
+
+slow:
+    return dma_memory_map(vdev->dma_as, pa, plen,
+                          is_write ? DMA_DIRECTION_FROM_DEVICE :
+                                     DMA_DIRECTION_TO_DEVICE,
+                          MEMTXATTRS_UNSPECIFIED);
+}
+
+static bool virtqueue_map_desc(VirtQueue *vq, unsigned int *p_num_sg,
                                hwaddr *addr, struct iovec *iov,
                                unsigned int max_num_sg, bool is_write,
                                hwaddr pa, size_t sz)
 {
+    VirtIODevice *vdev = vq->vdev;
     bool ok = false;
     unsigned num_sg = *p_num_sg;
     assert(num_sg <= max_num_sg);
@@ -1575,11 +1739,7 @@ static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
             goto out;
         }
 
-        iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
-                                              is_write ?
-                                              DMA_DIRECTION_FROM_DEVICE :
-                                              DMA_DIRECTION_TO_DEVICE,
-                                              MEMTXATTRS_UNSPECIFIED);
+        iov[num_sg].iov_base = virtqueue_xlat_map(vq, pa, &len, is_write);
         if (!iov[num_sg].iov_base) {
             virtio_error(vdev, "virtio: bogus descriptor or out of resources");
             goto out;
@@ -1648,9 +1808,16 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+/*
+ * Lay out an element of @sz bytes followed by its descriptor arrays in
+ * @buf, or return the size of the buffer if @buf is NULL.  The size only
+ * depends on out_num + in_num, which lets pooled elements be reused for
+ * any split between the two.
+ */
+static size_t virtqueue_layout_element(void *buf, size_t sz,
+                                       unsigned out_num, unsigned in_num)
 {
-    VirtQueueElement *elem;
+    VirtQueueElement *elem = buf;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
     size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
@@ -1658,19 +1825,117 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
+    if (elem) {
+        elem->out_num = out_num;
+        elem->in_num = in_num;
+        elem->pool = NULL;
+        elem->in_addr = (void *)elem + in_addr_ofs;
+        elem->out_addr = (void *)elem + out_addr_ofs;
+        elem->in_sg = (void *)elem + in_sg_ofs;
+        elem->out_sg = (void *)elem + out_sg_ofs;
+    }
+    return out_sg_end;
+}
+
+static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem;
+
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    elem = g_malloc(virtqueue_layout_element(NULL, sz, out_num, in_num));
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
-    elem->out_num = out_num;
-    elem->in_num = in_num;
-    elem->in_addr = (void *)elem + in_addr_ofs;
-    elem->out_addr = (void *)elem + out_addr_ofs;
-    elem->in_sg = (void *)elem + in_sg_ofs;
-    elem->out_sg = (void *)elem + out_sg_ofs;
+    virtqueue_layout_element(elem, sz, out_num, in_num);
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+static void virtqueue_pool_unref(VirtQueuePool *pool)
+{
+    VirtQueuePoolEntry *entry;
+
+    if (qatomic_fetch_dec(&pool->refcnt) != 1) {
+        return;
+    }
+
+    while ((entry = QSLIST_FIRST(&pool->released))) {
+        QSLIST_REMOVE_HEAD(&pool->released, next);
+        g_free(entry);
+    }
+    while ((entry = QSLIST_FIRST(&pool->free))) {
+        QSLIST_REMOVE_HEAD(&pool->free, next);
+        g_free(entry);
+    }
+    g_free(pool);
+}
+
+/* Called by the thread that pops from @vq. */
+static void *virtqueue_pool_alloc_element(VirtQueue *vq, size_t sz,
+                                          unsigned out_num, unsigned in_num)
+{
+    VirtQueuePool *pool = vq->pool;
+    VirtQueuePoolEntry *entry;
+    VirtQueueElement *elem;
+
+    if (!pool) {
+        pool = vq->pool = g_new0(VirtQueuePool, 1);
+        pool->refcnt = 1;
+        pool->elem_sz = sz;
+    }
+    if (sz > pool->elem_sz || out_num + in_num > VIRTQUEUE_POOL_SG) {
+        return virtqueue_alloc_element(sz, out_num, in_num);
+    }
+
+    if (QSLIST_EMPTY(&pool->free)) {
+        QSLIST_MOVE_ATOMIC(&pool->free, &pool->released);
+    }
+    entry = QSLIST_FIRST(&pool->free);
+    if (entry) {
+        QSLIST_REMOVE_HEAD(&pool->free, next);
+        elem = (VirtQueueElement *)entry;
+    } else {
+        assert(sz >= sizeof(VirtQueueElement));
+        elem = g_malloc(virtqueue_layout_element(NULL, pool->elem_sz,
+                                                 VIRTQUEUE_POOL_SG, 0));
+    }
+    trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
+    virtqueue_layout_element(elem, sz, out_num, in_num);
+    qatomic_inc(&pool->refcnt);
+    elem->pool = pool;
+    return elem;
+}
+
+void virtqueue_element_free(VirtQueueElement *elem)
+{
+    VirtQueuePool *pool = elem->pool;
+
+    if (pool) {
+        VirtQueuePoolEntry *entry = (VirtQueuePoolEntry *)elem;
+
+        QSLIST_INSERT_HEAD_ATOMIC(&pool->released, entry, next);
+        virtqueue_pool_unref(pool);
+    } else {
+        g_free(elem);
+    }
+}
+
+/*
+ * Drop the reference of the queue to its pool.  Elements that are still
+ * in use keep the pool alive until they are freed.
+ */
+static void virtqueue_pool_destroy(VirtQueue *vq)
+{
+    if (vq->pool) {
+        virtqueue_pool_unref(vq->pool);
+        vq->pool = NULL;
+    }
+}
+
+/*
+ * Pop one element from a split ring that is known to have one available.
+ * Called within rcu_read_lock(), after the barrier that orders the read
+ * of the avail index before the descriptor reads.  The caller updates
+ * the avail event.
+ */
+static void *virtqueue_split_pop_one(VirtQueue *vq, size_t sz, bool pooled)
 {
     unsigned int i, head, max, idx;
     VRingMemoryRegionCaches *caches;
@@ -1687,14 +1952,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1709,10 +1966,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
     caches = vring_get_region_caches(vq);
@@ -1753,7 +2006,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         bool map_ok;
 
         if (desc.flags & VRING_DESC_F_WRITE) {
-            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
+            map_ok = virtqueue_map_desc(vq, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
                                         desc.addr, desc.len);
@@ -1762,7 +2015,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
                 virtio_error(vdev, "Incorrect order for descriptors");
                 goto err_undo_map;
             }
-            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
+            map_ok = virtqueue_map_desc(vq, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
                                         desc.addr, desc.len);
         }
@@ -1784,7 +2037,11 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    if (pooled) {
+        elem = virtqueue_pool_alloc_element(vq, sz, out_num, in_num);
+    } else {
+        elem = virtqueue_alloc_element(sz, out_num, in_num);
+    }
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1816,7 +2073,62 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    VirtQueueElement *elem;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return NULL;
+    }
+    /*
+     * Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads().
+     */
+    smp_rmb();
+
+    elem = virtqueue_split_pop_one(vq, sz, false);
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return elem;
+}
+
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              VirtQueueElement **elems,
+                                              unsigned int max)
+{
+    unsigned int n = 0;
+    int num_heads;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return 0;
+    }
+
+    /* Reads the avail index once and issues the barrier for all heads */
+    num_heads = virtqueue_num_heads(vq, vq->last_avail_idx);
+    if (num_heads <= 0) {
+        return 0;
+    }
+
+    max = MIN(max, num_heads);
+    while (n < max) {
+        elems[n] = virtqueue_split_pop_one(vq, sz, true);
+        if (!elems[n]) {
+            break;
+        }
+        n++;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return n;
+}
+
+static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz, bool pooled)
 {
     unsigned int i, max;
     VRingMemoryRegionCaches *caches;
@@ -1890,7 +2202,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
         bool map_ok;
 
         if (desc.flags & VRING_DESC_F_WRITE) {
-            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
+            map_ok = virtqueue_map_desc(vq, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
                                         desc.addr, desc.len);
@@ -1899,7 +2211,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
                 virtio_error(vdev, "Incorrect order for descriptors");
                 goto err_undo_map;
             }
-            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
+            map_ok = virtqueue_map_desc(vq, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
                                         desc.addr, desc.len);
         }
@@ -1924,7 +2236,11 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    if (pooled) {
+        elem = virtqueue_pool_alloc_element(vq, sz, out_num, in_num);
+    } else {
+        elem = virtqueue_alloc_element(sz, out_num, in_num);
+    }
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1972,12 +2288,36 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        return virtqueue_packed_pop(vq, sz, false);
     } else {
         return virtqueue_split_pop(vq, sz);
     }
 }
 
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz,
+                                 VirtQueueElement **elems, unsigned int max)
+{
+    unsigned int n = 0;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    if (!virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        return virtqueue_split_pop_batch(vq, sz, elems, max);
+    }
+
+    RCU_READ_LOCK_GUARD();
+    while (n < max) {
+        elems[n] = virtqueue_packed_pop(vq, sz, true);
+        if (!elems[n]) {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -2522,6 +2862,7 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    virtqueue_pool_destroy(vq);
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -3926,11 +4267,115 @@ void G_GNUC_PRINTF(2, 3) virtio_error(VirtIODevice *vdev, const char *fmt, ...)
     vdev->broken = true;
 }
 
+static void virtio_xlat_iommu_unmap_notify(IOMMUNotifier *n,
+                                           IOMMUTLBEntry *iotlb)
+{
+    VirtIOXlatIOMMU *iommu = container_of(n, VirtIOXlatIOMMU, n);
+
+    virtio_xlat_invalidate(iommu->vdev);
+}
+
+/*
+ * Once the guest enables ATS, the vIOMMU may only send device IOTLB
+ * invalidations for the device, so listen to those too.
+ */
+static IOMMUNotifierFlag virtio_xlat_iommu_flags(VirtIODevice *vdev)
+{
+    return vdev->device_iotlb_enabled ?
+           IOMMU_NOTIFIER_UNMAP | IOMMU_NOTIFIER_DEVIOTLB_UNMAP :
+           IOMMU_NOTIFIER_UNMAP;
+}
+
+void virtio_toggle_device_iotlb(VirtIODevice *vdev)
+{
+    VirtIOXlatIOMMU *iommu, *tmp;
+    Error *local_err = NULL;
+
+    QLIST_FOREACH_SAFE(iommu, &vdev->xlat_iommu_list, next, tmp) {
+        memory_region_unregister_iommu_notifier(iommu->mr, &iommu->n);
+        iommu->n.notifier_flags = virtio_xlat_iommu_flags(vdev);
+        if (memory_region_register_iommu_notifier(iommu->mr, &iommu->n,
+                                                  &local_err)) {
+            /* Without invalidations the cache cannot be used safely */
+            error_free(local_err);
+            local_err = NULL;
+            QLIST_REMOVE(iommu, next);
+            g_free(iommu);
+            vdev->xlat_disabled = true;
+        }
+    }
+    virtio_xlat_invalidate(vdev);
+}
+
+static void virtio_memory_listener_region_add(MemoryListener *listener,
+                                              MemoryRegionSection *section)
+{
+    VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
+    VirtIOXlatIOMMU *iommu;
+    IOMMUMemoryRegion *iommu_mr;
+    Error *local_err = NULL;
+    Int128 end;
+    int iommu_idx;
+
+    if (!memory_region_is_iommu(section->mr)) {
+        return;
+    }
+
+    iommu_mr = IOMMU_MEMORY_REGION(section->mr);
+
+    iommu = g_new0(VirtIOXlatIOMMU, 1);
+    end = int128_add(int128_make64(section->offset_within_region),
+                     section->size);
+    end = int128_sub(end, int128_one());
+    iommu_idx = memory_region_iommu_attrs_to_index(iommu_mr,
+                                                   MEMTXATTRS_UNSPECIFIED);
+    iommu_notifier_init(&iommu->n, virtio_xlat_iommu_unmap_notify,
+                        virtio_xlat_iommu_flags(vdev),
+                        section->offset_within_region,
+                        int128_get64(end),
+                        iommu_idx);
+    iommu->mr = section->mr;
+    iommu->vdev = vdev;
+    if (memory_region_register_iommu_notifier(section->mr, &iommu->n,
+                                              &local_err)) {
+        /* Without invalidations the cache cannot be used safely */
+        error_free(local_err);
+        g_free(iommu);
+        vdev->xlat_disabled = true;
+        virtio_xlat_invalidate(vdev);
+        return;
+    }
+    QLIST_INSERT_HEAD(&vdev->xlat_iommu_list, iommu, next);
+}
+
+static void virtio_memory_listener_region_del(MemoryListener *listener,
+                                              MemoryRegionSection *section)
+{
+    VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
+    VirtIOXlatIOMMU *iommu;
+
+    if (!memory_region_is_iommu(section->mr)) {
+        return;
+    }
+
+    QLIST_FOREACH(iommu, &vdev->xlat_iommu_list, next) {
+        if (iommu->mr == section->mr &&
+            iommu->n.start == section->offset_within_region) {
+            memory_region_unregister_iommu_notifier(iommu->mr, &iommu->n);
+            QLIST_REMOVE(iommu, next);
+            g_free(iommu);
+            break;
+        }
+    }
+}
+
 static void virtio_memory_listener_commit(MemoryListener *listener)
 {
     VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
     int i;
 
+    virtio_xlat_invalidate(vdev);
+
     for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
         if (vdev->vq[i].vring.num == 0) {
             break;
@@ -3971,6 +4416,8 @@ static void virtio_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    vdev->listener.region_add = virtio_memory_listener_region_add;
+    vdev->listener.region_del = virtio_memory_listener_region_del;
     vdev->listener.commit = virtio_memory_listener_commit;
     vdev->listener.name = "virtio";
     memory_listener_register(&vdev->listener, vdev->dma_as);
@@ -21,10 +21,12 @@
 #include "qemu/queue.h"
 #include "qemu/event_notifier.h"
 #include "qemu/lockcnt.h"
+#include "qemu/stats64.h"
 #include "qemu/thread.h"
 #include "qemu/timer.h"
 #include "block/graph-lock.h"
 #include "hw/qdev-core.h"
+#include "qapi/qapi-types-common.h"
 
 
 typedef struct BlockAIOCB BlockAIOCB;
@@ -125,8 +127,21 @@ typedef QSLIST_HEAD(, AioHandler) AioHandlerSList;
 
 typedef struct AioPolledEvent {
     int64_t ns;        /* current polling time in nanoseconds */
+
+    /* Used by AIO_POLL_POLICY_LATENCY */
+    int64_t last_event;      /* time of the last event */
+    int64_t interval_ns;     /* smoothed time between events */
+    int64_t interval_dev_ns; /* smoothed deviation from interval_ns */
 } AioPolledEvent;
 
+/* Written by the AioContext's thread, can be read from any thread */
+typedef struct AioPollStats {
+    Stat64 polled_events;   /* handler events found by polling */
+    Stat64 notified_events; /* handler events found by fdmon wait() */
+    Stat64 poll_ns;         /* time spent polling */
+    Stat64 wasted_ns;       /* time spent polling without progress */
+} AioPollStats;
+
 struct AioContext {
     GSource source;
 
@@ -236,6 +251,11 @@ struct AioContext {
     int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
+    AioPollPolicy poll_policy;
+    int64_t poll_budget_ns; /* maximum polling time per second, or 0 */
+    int64_t poll_budget_start; /* start of the current budget period */
+    int64_t poll_budget_used;  /* polling time in the current period */
+    AioPollStats poll_stats;
 
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
@@ -708,6 +728,15 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_set_poll_policy:
+ * @ctx: the aio context
+ * @policy: how to compute the polling time of each handler
+ * @budget_ns: maximum polling time per second, 0 means no limit
+ */
+void aio_context_set_poll_policy(AioContext *ctx, AioPollPolicy policy,
+                                 int64_t budget_ns, Error **errp);
+
 /**
  * aio_context_set_aio_params:
  * @ctx: the aio context
@@ -148,6 +148,11 @@ typedef struct BlockDriverInfo {
      * True if this block driver only supports compressed writes
      */
     bool needs_compressed_writes;
+    /*
+     * True if compressed writes may span multiple clusters. The clusters are
+     * compressed in parallel, but allocated in the order of the request.
+     */
+    bool multi_cluster_compressed_writes;
 } BlockDriverInfo;
 
 typedef struct BlockFragInfo {
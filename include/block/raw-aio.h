@@ -84,11 +84,20 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 bool luring_has_fua(void);
+
+/* Fixed buffers and files, shared by all rings */
+void luring_register_buf(void *host, size_t size);
+void luring_unregister_buf(void *host, size_t size);
+void luring_unregister_fd(int fd);
 #else
 static inline bool luring_has_fua(void)
 {
     return false;
 }
+
+static inline void luring_unregister_fd(int fd)
+{
+}
 #endif
 
 #ifdef _WIN32
@@ -206,6 +206,12 @@ struct CPUClass {
 /* Use a fully associative victim tlb of 8 entries. */
 #define CPU_VTLB_SIZE 8
 
+/*
+ * Remember the last 4 uniform large pages returned by tlb_fill,
+ * per mmu mode.
+ */
+#define CPU_LTLB_SIZE 4
+
 /*
  * The full TLB entry, which is not accessed by generated TCG code,
  * so the layout is not as critical as that of CPUTLBEntry. This is
@@ -238,6 +244,15 @@ struct CPUTLBEntryFull {
     /* @lg_page_size contains the log2 of the page size. */
     uint8_t lg_page_size;
 
+    /*
+     * @lg_page_uniform is set by tlb_fill if the whole page described
+     * by @lg_page_size is mapped contiguously from @phys_addr, with the
+     * same @prot and @attrs.  Otherwise @lg_page_size is only used to
+     * invalidate the page, e.g. when it is the larger of the page sizes
+     * of a two-stage translation.
+     */
+    bool lg_page_uniform;
+
     /* Additional tlb flags requested by tlb_fill. */
     uint8_t tlb_fill_flags;
 
@@ -293,6 +308,17 @@ typedef struct CPUTLBDesc {
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
     CPUTLBEntryFull *fulltlb;
+    /* The next index to use in the large page table.  */
+    size_t lindex;
+    /*
+     * Large pages recently returned by tlb_fill with lg_page_uniform
+     * set, so that the other small pages within them can be entered
+     * into the tlb without another page table walk.  @laddr is -1 for
+     * an empty slot; @lfulltlb holds the physical address of the large page.
+     */
+    vaddr laddr[CPU_LTLB_SIZE];
+    vaddr lmask[CPU_LTLB_SIZE];
+    CPUTLBEntryFull lfulltlb[CPU_LTLB_SIZE];
 } CPUTLBDesc;
 
 /*
@@ -307,6 +333,11 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     uint16_t dirty;
+    /*
+     * Flushes requested by other cpus that are yet to be applied.
+     * Protected by tlb_c.lock.
+     */
+    struct TLBFlushPending *pending;
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
@@ -315,6 +346,12 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /*
+     * Cross-cpu flush requests that queued a work item, and those that
+     * were folded into a work item that was already queued.
+     */
+    size_t issued_flush_count;
+    size_t coalesced_flush_count;
 } CPUTLBCommon;
 
 /*
@@ -59,6 +59,8 @@ size_t virtio_get_config_size(const VirtIOConfigSizeParams *params,
                               uint64_t host_features);
 
 typedef struct VirtQueue VirtQueue;
+typedef struct VirtIOXlatIOMMU VirtIOXlatIOMMU;
+typedef struct VirtQueuePool VirtQueuePool;
 
 #define VIRTQUEUE_MAX_SIZE 1024
 
@@ -71,6 +73,8 @@ typedef struct VirtQueueElement
     unsigned int in_num;
     /* Element has been processed (VIRTIO_F_IN_ORDER) */
     bool in_order_filled;
+    /* Element pool to return to, see virtqueue_element_free() */
+    VirtQueuePool *pool;
     hwaddr *in_addr;
     hwaddr *out_addr;
     struct iovec *in_sg;
@@ -167,6 +171,14 @@ struct VirtIODevice
      */
     EventNotifier config_notifier;
     bool device_iotlb_enabled;
+    /**
+     * @xlat_gen: bumped whenever the descriptor translations cached by
+     * the virtqueues may have become stale
+     */
+    unsigned int xlat_gen;
+    /* @xlat_disabled: do not cache descriptor translations */
+    bool xlat_disabled;
+    QLIST_HEAD(, VirtIOXlatIOMMU) xlat_iommu_list;
 };
 
 struct VirtioDeviceClass {
@@ -248,6 +260,9 @@ void virtio_error(VirtIODevice *vdev, const char *fmt, ...) G_GNUC_PRINTF(2, 3);
 /* Set the child bus name. */
 void virtio_device_set_child_bus_name(VirtIODevice *vdev, char *bus_name);
 
+/* Follow a change of @vdev->device_iotlb_enabled. */
+void virtio_toggle_device_iotlb(VirtIODevice *vdev);
+
 typedef void (*VirtIOHandleOutput)(VirtIODevice *, VirtQueue *);
 
 VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
@@ -270,6 +285,47 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+
+/**
+ * virtqueue_pop_batch:
+ * @vq: The #VirtQueue
+ * @sz: the size of the structures that embed a #VirtQueueElement
+ * @elems: array that receives the elements
+ * @max: maximum number of elements to pop
+ *
+ * Like calling virtqueue_pop() up to @max times, but the available ring
+ * index is read and the memory barriers are issued only once.  The
+ * elements come from a per-queue pool and should be released with
+ * virtqueue_element_free(), which may also happen after the queue is
+ * deleted.
+ *
+ * Returns: the number of elements stored in @elems.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz,
+                                 VirtQueueElement **elems, unsigned int max);
+
+/**
+ * virtqueue_push_batch:
+ * @vq: The #VirtQueue
+ * @elems: the elements to complete
+ * @lens: number of bytes written to each element, or NULL if none
+ * @count: number of elements
+ *
+ * Like virtqueue_fill() for each element followed by a single
+ * virtqueue_flush(), so that the used index is written only once.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement **elems,
+                          const unsigned int *lens, unsigned int count);
+
+/**
+ * virtqueue_element_free:
+ * @elem: the element to free
+ *
+ * Free an element returned by virtqueue_pop(), virtqueue_pop_batch() or
+ * qemu_get_virtqueue_element().  Elements from virtqueue_pop_batch() go
+ * back to the pool of their queue; this can be called from any thread.
+ */
+void virtqueue_element_free(VirtQueueElement *elem);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
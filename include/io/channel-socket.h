@@ -49,6 +49,7 @@ struct QIOChannelSocket {
     socklen_t remoteAddrLen;
     ssize_t zero_copy_queued;
     ssize_t zero_copy_sent;
+    ssize_t zero_copy_copied;
 };
 
 
@@ -262,4 +263,34 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
 
+/**
+ * qio_channel_socket_enable_zero_copy:
+ * @ioc: the socket channel object
+ *
+ * Enable SO_ZEROCOPY on a connected socket.  If the host supports it,
+ * the channel gets the QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY feature.
+ * Sockets created by qio_channel_socket_connect_sync() already have it
+ * enabled; accepted sockets do not, since pinning pages only pays off
+ * for users that send large buffers and can keep them alive until the
+ * kernel is done with them.
+ */
+void qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc);
+
+
+/**
+ * qio_channel_socket_poll_zero_copy:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Like qio_channel_flush(), but only process the zero copy completions
+ * that are already available, without waiting for the others.
+ * @ioc->zero_copy_sent is then the number of zero copy writes whose
+ * buffers can be reused, and @ioc->zero_copy_copied the number of those
+ * that the kernel copied anyway, for example over the loopback device.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qio_channel_socket_poll_zero_copy(QIOChannelSocket *ioc, Error **errp);
+
+
 #endif /* QIO_CHANNEL_SOCKET_H */
@@ -72,6 +72,7 @@ enum plugin_dyn_cb_type {
     PLUGIN_CB_MEM_REGULAR,
     PLUGIN_CB_INLINE_ADD_U64,
     PLUGIN_CB_INLINE_STORE_U64,
+    PLUGIN_CB_INLINE_MEM_APPEND,
 };
 
 struct qemu_plugin_regular_cb {
@@ -87,6 +88,13 @@ struct qemu_plugin_inline_cb {
     enum qemu_plugin_mem_rw rw;
 };
 
+struct qemu_plugin_mem_append_cb {
+    struct qemu_plugin_mem_buffer *buf;
+    TCGHelperInfo *info;
+    uint32_t tag;
+    enum qemu_plugin_mem_rw rw;
+};
+
 struct qemu_plugin_conditional_cb {
     union qemu_plugin_cb_sig f;
     TCGHelperInfo *info;
@@ -107,6 +115,7 @@ struct qemu_plugin_dyn_cb {
         struct qemu_plugin_regular_cb regular;
         struct qemu_plugin_conditional_cb cond;
         struct qemu_plugin_inline_cb inline_insn;
+        struct qemu_plugin_mem_append_cb mem_append;
     };
 };
 
@@ -128,6 +137,19 @@ struct qemu_plugin_scoreboard {
     QLIST_ENTRY(qemu_plugin_scoreboard) entry;
 };
 
+/*
+ * Per-vCPU memory access buffers. Each scoreboard entry holds the number
+ * of records in the buffer and the number of records dropped so far,
+ * followed by @nr_records records and a spare one that the dropped
+ * records are written to.
+ */
+struct qemu_plugin_mem_buffer {
+    struct qemu_plugin_scoreboard *score;
+    size_t nr_records;
+    qemu_plugin_vcpu_mem_buffer_cb_t cb;
+    void *userdata;
+};
+
 /* Internal context for this TranslationBlock */
 struct qemu_plugin_tb {
     GPtrArray *insns;
@@ -173,6 +195,9 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
 
 void qemu_plugin_flush_cb(void);
 
+/* Called by generated code to drain a full struct qemu_plugin_mem_buffer */
+void qemu_plugin_vcpu_mem_buffer_drain(uint32_t cpu_index, void *buf);
+
 void qemu_plugin_atexit_cb(void);
 
 void qemu_plugin_add_dyn_cb_arr(GArray *arr);
@@ -65,11 +65,16 @@ typedef uint64_t qemu_plugin_id_t;
  *
  * version 4:
  * - added qemu_plugin_read_memory_vaddr
+ *
+ * version 5:
+ * - added qemu_plugin_mem_buffer_new, qemu_plugin_mem_buffer_free,
+ *   qemu_plugin_mem_buffer_flush, qemu_plugin_mem_buffer_dropped and
+ *   qemu_plugin_register_vcpu_mem_inline_append
  */
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 4
+#define QEMU_PLUGIN_VERSION 5
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -701,6 +706,120 @@ void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
     qemu_plugin_u64 entry,
     uint64_t imm);
 
+/**
+ * typedef qemu_plugin_mem_record - a memory access stored in a buffer
+ * @vaddr: the virtual address of the access
+ * @info: an opaque handle for further queries about the memory
+ * @tag: the tag given when registering the append op
+ */
+typedef struct {
+    uint64_t vaddr;
+    qemu_plugin_meminfo_t info;
+    uint32_t tag;
+} qemu_plugin_mem_record;
+
+/** struct qemu_plugin_mem_buffer - Opaque handle for memory access buffers */
+struct qemu_plugin_mem_buffer;
+
+/**
+ * typedef qemu_plugin_vcpu_mem_buffer_cb_t - buffer drain function type
+ * @vcpu_index: the vCPU that owns the buffer
+ * @records: the records appended since the last drain, oldest first
+ * @n: the number of records
+ * @userdata: any user data attached to the buffer
+ *
+ * @records is only valid until the callback returns.
+ *
+ * When called from generated code, the callback runs as if registered
+ * with QEMU_PLUGIN_CB_NO_REGS: the guest registers are not synced, so it
+ * must not read them (e.g. with qemu_plugin_read_register()).
+ */
+typedef void (*qemu_plugin_vcpu_mem_buffer_cb_t)(
+    unsigned int vcpu_index,
+    const qemu_plugin_mem_record *records,
+    size_t n,
+    void *userdata);
+
+/**
+ * qemu_plugin_mem_buffer_new() - alloc per-vCPU memory access buffers
+ * @nr_records: capacity of the buffer of each vCPU
+ * @cb: callback that drains a buffer
+ * @userdata: opaque pointer for userdata
+ *
+ * The buffers are filled by qemu_plugin_register_vcpu_mem_inline_append().
+ * @cb is called on the vCPU thread whenever its buffer might not have
+ * room for the accesses of the next instruction, and from
+ * qemu_plugin_mem_buffer_flush().
+ *
+ * Returns a pointer to new buffers. They must be freed using
+ * qemu_plugin_mem_buffer_free.
+ */
+QEMU_PLUGIN_API
+struct qemu_plugin_mem_buffer *
+qemu_plugin_mem_buffer_new(size_t nr_records,
+                           qemu_plugin_vcpu_mem_buffer_cb_t cb,
+                           void *userdata);
+
+/**
+ * qemu_plugin_mem_buffer_free() - free memory access buffers
+ * @buf: buffers to free
+ *
+ * Records still in the buffers are discarded.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf);
+
+/**
+ * qemu_plugin_mem_buffer_flush() - drain the buffer of a vCPU
+ * @buf: buffers to drain
+ * @vcpu_index: vCPU whose buffer is drained
+ *
+ * Calls the drain callback for the records left in the buffer, if any.
+ * This is meant to be called from the vCPU itself (e.g. from a vcpu_exit
+ * or vcpu_idle callback) or once the vCPU has stopped, e.g. from an
+ * atexit callback.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_mem_buffer_flush(struct qemu_plugin_mem_buffer *buf,
+                                  unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_mem_buffer_dropped() - count the records a vCPU dropped
+ * @buf: buffers to query
+ * @vcpu_index: vCPU to query
+ *
+ * The buffer is drained before an instruction whose accesses might not
+ * fit, but the number of accesses cannot always be known when the
+ * instruction is translated, and a buffer may be smaller than the
+ * accesses of a single instruction. Records that do not fit are dropped
+ * rather than written over older ones.
+ *
+ * Returns the number of records dropped by @vcpu_index so far.
+ */
+QEMU_PLUGIN_API
+uint64_t qemu_plugin_mem_buffer_dropped(struct qemu_plugin_mem_buffer *buf,
+                                        unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_register_vcpu_mem_inline_append() - buffer mem accesses
+ * @insn: handle for instruction to instrument
+ * @rw: apply to reads, writes or both
+ * @buf: buffers to append to
+ * @tag: value stored in the tag field of the records
+ *
+ * This appends a qemu_plugin_mem_record to the buffer of the executing
+ * vCPU for every memory access generated by the instruction. The record
+ * is stored by inline code; the generated code only calls out of line
+ * to drain a buffer that is about to fill up, so that the plugin can
+ * process the accesses in batches.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_inline_append(
+    struct qemu_plugin_insn *insn,
+    enum qemu_plugin_mem_rw rw,
+    struct qemu_plugin_mem_buffer *buf,
+    uint32_t tag);
+
 /**
  * qemu_plugin_request_time_control() - request the ability to control time
  *
@@ -38,6 +38,8 @@ struct IOThread {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+    int poll_policy;            /* AioPollPolicy */
+    int64_t poll_budget_ns;
 };
 typedef struct IOThread IOThread;
 
@@ -569,6 +569,21 @@ bool kvm_dirty_ring_enabled(void);
 
 uint32_t kvm_dirty_ring_size(void);
 
+/* Number of buckets in the dirty ring reap latency histogram */
+#define KVM_DIRTY_RING_REAP_HIST_SIZE 16
+
+/**
+ * kvm_dirty_ring_reap_stats - statistics of the dirty ring reaper
+ * @latency: array of KVM_DIRTY_RING_REAP_HIST_SIZE counters.  Bucket 0
+ *   counts the reaps that took less than 1us, bucket i the ones that took
+ *   [2^(i-1), 2^i) us; the last bucket also counts all slower reaps.
+ *
+ * Only reaps that found dirty pages are counted.
+ *
+ * Returns: the number of pages harvested from the dirty rings.
+ */
+uint64_t kvm_dirty_ring_reap_stats(uint64_t *latency);
+
 void kvm_mark_guest_state_protected(void);
 
 /**
@@ -13,6 +13,7 @@
 #include "qapi/qapi-types-common.h"
 #include "qemu/accel.h"
 #include "qemu/queue.h"
+#include "qemu/stats64.h"
 #include "system/kvm.h"
 #include "hw/boards.h"
 #include "hw/i386/topology.h"
@@ -99,6 +100,13 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    /* Maximum number of threads harvesting the rings concurrently */
+    uint32_t max_workers;
+    /* Helpers for the thread that reaps, created on first use */
+    struct ThreadPool *pool;
+    /* Statistics, see kvm_dirty_ring_reap_stats() */
+    Stat64 pages;
+    Stat64 latency[KVM_DIRTY_RING_REAP_HIST_SIZE];
 };
 struct KVMState
 {
@@ -7,6 +7,53 @@
 #ifndef TCG_PERF_H
 #define TCG_PERF_H
 
+/*
+ * Layout of the /tmp/qemu-tbprof-<pid> file written with -tbprof.
+ *
+ * The file is mapped shared and updated while the guest runs, so that
+ * an external tool can mmap it read-only and sample it at any time.
+ * All fields are in host byte order.  The header is followed by
+ * @nr_slots slots of @slot_size bytes; the magic is written last, so a
+ * reader must wait for it to be valid.
+ *
+ * Each slot counts one guest block, keyed by the virtual and physical
+ * pc of its first instruction.  Slots are never reused, so counts
+ * survive retranslation and tb_flush.  Slot 0 collects the blocks that
+ * found no free slot, and has @pc and @phys_pc set to -1.
+ *
+ * @exec_count is incremented by the generated code without atomics,
+ * and may undercount when several vCPUs run the same block at once.
+ */
+#define TBPROF_MAGIC    0x00464f5250425451ULL  /* "QTBPROF" on little-endian */
+#define TBPROF_VERSION  1
+
+typedef struct TBProfHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t nr_slots;
+    uint32_t slot_size;
+    uint32_t pad;
+    /* Completed translations, including retranslations. */
+    uint64_t translations;
+    /* Translations that were counted in slot 0. */
+    uint64_t dropped;
+    /* Calls to cpu_io_recompile(). */
+    uint64_t io_recompiles;
+    uint64_t used_slots;
+} TBProfHeader;
+
+typedef struct TBProfSlot {
+    uint64_t pc;
+    uint64_t phys_pc;
+    uint64_t exec_count;
+    uint64_t io_recompiles;
+    /* Times the block was translated; more than once means retranslated. */
+    uint32_t translations;
+    /* Guest instructions in the last translation. */
+    uint16_t icount;
+    uint16_t in_use;
+} TBProfSlot;
+
 #if defined(CONFIG_TCG) && defined(CONFIG_LINUX)
 /* Start writing perf-<pid>.map. */
 void perf_enable_perfmap(void);
@@ -21,6 +68,22 @@ void perf_report_prologue(const void *start, size_t size);
 void perf_report_code(uint64_t guest_pc, TranslationBlock *tb,
                       const void *start);
 
+/* Start counting block executions in /tmp/qemu-tbprof-<pid>. */
+void perf_enable_tbprof(void);
+
+/*
+ * Return the execution counter that the code being generated for the
+ * block at @guest_pc/@phys_pc should increment, or NULL if -tbprof is
+ * disabled.
+ */
+uint64_t *perf_tbprof_counter(uint64_t guest_pc, uint64_t phys_pc);
+
+/*
+ * Account a cpu_io_recompile() of the block at @guest_pc/@phys_pc.
+ * @guest_pc is -1 if it is not known.
+ */
+void perf_report_io_recompile(uint64_t guest_pc, uint64_t phys_pc);
+
 /* Stop writing perf-<pid>.map and/or jit-<pid>.dump. */
 void perf_exit(void);
 #else
@@ -41,6 +104,21 @@ static inline void perf_report_code(uint64_t guest_pc, TranslationBlock *tb,
 {
 }
 
+static inline void perf_enable_tbprof(void)
+{
+}
+
+static inline uint64_t *perf_tbprof_counter(uint64_t guest_pc,
+                                            uint64_t phys_pc)
+{
+    return NULL;
+}
+
+static inline void perf_report_io_recompile(uint64_t guest_pc,
+                                            uint64_t phys_pc)
+{
+}
+
 static inline void perf_exit(void)
 {
 }
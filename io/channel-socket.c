@@ -65,6 +65,7 @@ qio_channel_socket_new(void)
     sioc->fd = -1;
     sioc->zero_copy_queued = 0;
     sioc->zero_copy_sent = 0;
+    sioc->zero_copy_copied = 0;
 
     ioc = QIO_CHANNEL(sioc);
     qio_channel_set_feature(ioc, QIO_CHANNEL_FEATURE_SHUTDOWN);
@@ -145,6 +146,19 @@ qio_channel_socket_new_fd(int fd,
 }
 
 
+void qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    int ret, v = 1;
+    ret = setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
+    if (ret == 0) {
+        /* Zero copy available on host */
+        qio_channel_set_feature(QIO_CHANNEL(ioc),
+                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+    }
+#endif
+}
+
 int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
                                     SocketAddress *addr,
                                     Error **errp)
@@ -164,15 +178,7 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
-#ifdef QEMU_MSG_ZEROCOPY
-    int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
-    if (ret == 0) {
-        /* Zero copy available on host */
-        qio_channel_set_feature(QIO_CHANNEL(ioc),
-                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
-    }
-#endif
+    qio_channel_socket_enable_zero_copy(ioc);
 
     qio_channel_set_feature(QIO_CHANNEL(ioc),
                             QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
@@ -725,10 +731,10 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 
 
 #ifdef QEMU_MSG_ZEROCOPY
-static int qio_channel_socket_flush(QIOChannel *ioc,
-                                    Error **errp)
+static int qio_channel_socket_reap_zero_copy(QIOChannelSocket *sioc,
+                                             bool wait, Error **errp)
 {
-    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+    QIOChannel *ioc = QIO_CHANNEL(sioc);
     struct msghdr msg = {};
     struct sock_extended_err *serr;
     struct cmsghdr *cm;
@@ -751,6 +757,9 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
         if (received < 0) {
             switch (errno) {
             case EAGAIN:
+                if (!wait) {
+                    return ret;
+                }
                 /* Nothing on errqueue, wait until something is available */
                 qio_channel_wait(ioc, G_IO_ERR);
                 continue;
@@ -794,12 +803,33 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
         /* If any sendmsg() succeeded using zero copy, return 0 at the end */
         if (serr->ee_code != SO_EE_CODE_ZEROCOPY_COPIED) {
             ret = 0;
+        } else {
+            sioc->zero_copy_copied += serr->ee_data - serr->ee_info + 1;
         }
     }
 
     return ret;
 }
 
+static int qio_channel_socket_flush(QIOChannel *ioc,
+                                    Error **errp)
+{
+    return qio_channel_socket_reap_zero_copy(QIO_CHANNEL_SOCKET(ioc), true,
+                                             errp);
+}
+
+int qio_channel_socket_poll_zero_copy(QIOChannelSocket *ioc, Error **errp)
+{
+    return qio_channel_socket_reap_zero_copy(ioc, false, errp) < 0 ? -1 : 0;
+}
+
+#else /* !QEMU_MSG_ZEROCOPY */
+
+int qio_channel_socket_poll_zero_copy(QIOChannelSocket *ioc, Error **errp)
+{
+    return 0;
+}
+
 #endif /* QEMU_MSG_ZEROCOPY */
 
 static int
@@ -151,6 +151,25 @@ static void iothread_init_gcontext(IOThread *iothread, const char *thread_name)
     iothread->main_loop = g_main_loop_new(iothread->worker_context, TRUE);
 }
 
+static void iothread_set_poll_params(IOThread *iothread, Error **errp)
+{
+    ERRP_GUARD();
+
+    aio_context_set_poll_params(iothread->ctx,
+                                iothread->poll_max_ns,
+                                iothread->poll_grow,
+                                iothread->poll_shrink,
+                                errp);
+    if (*errp) {
+        return;
+    }
+
+    aio_context_set_poll_policy(iothread->ctx,
+                                iothread->poll_policy,
+                                iothread->poll_budget_ns,
+                                errp);
+}
+
 static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
 {
     ERRP_GUARD();
@@ -160,11 +179,7 @@ static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
         return;
     }
 
-    aio_context_set_poll_params(iothread->ctx,
-                                iothread->poll_max_ns,
-                                iothread->poll_grow,
-                                iothread->poll_shrink,
-                                errp);
+    iothread_set_poll_params(iothread, errp);
     if (*errp) {
         return;
     }
@@ -233,6 +248,9 @@ static IOThreadParamInfo poll_grow_info = {
 static IOThreadParamInfo poll_shrink_info = {
     "poll-shrink", offsetof(IOThread, poll_shrink),
 };
+static IOThreadParamInfo poll_budget_ns_info = {
+    "poll-budget-ns", offsetof(IOThread, poll_budget_ns),
+};
 
 static void iothread_get_param(Object *obj, Visitor *v,
         const char *name, IOThreadParamInfo *info, Error **errp)
@@ -284,11 +302,25 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 
     if (iothread->ctx) {
-        aio_context_set_poll_params(iothread->ctx,
-                                    iothread->poll_max_ns,
-                                    iothread->poll_grow,
-                                    iothread->poll_shrink,
-                                    errp);
+        iothread_set_poll_params(iothread, errp);
+    }
+}
+
+static int iothread_get_poll_policy(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return iothread->poll_policy;
+}
+
+static void iothread_set_poll_policy(Object *obj, int value, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    iothread->poll_policy = value;
+
+    if (iothread->ctx) {
+        iothread_set_poll_params(iothread, errp);
     }
 }
 
@@ -311,6 +343,14 @@ static void iothread_class_init(ObjectClass *klass, const void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add(klass, "poll-budget-ns", "int",
+                              iothread_get_poll_param,
+                              iothread_set_poll_param,
+                              NULL, &poll_budget_ns_info);
+    object_class_property_add_enum(klass, "poll-policy", "AioPollPolicy",
+                                   &AioPollPolicy_lookup,
+                                   iothread_get_poll_policy,
+                                   iothread_set_poll_policy);
 }
 
 static const TypeInfo iothread_info = {
@@ -357,6 +397,16 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
     info->aio_max_batch = iothread->parent_obj.aio_max_batch;
+    info->poll_policy = iothread->poll_policy;
+    info->poll_budget_ns = iothread->poll_budget_ns;
+    if (iothread->ctx) {
+        AioPollStats *stats = &iothread->ctx->poll_stats;
+
+        info->polled_events = stat64_get(&stats->polled_events);
+        info->notified_events = stat64_get(&stats->notified_events);
+        info->poll_ns = stat64_get(&stats->poll_ns);
+        info->poll_wasted_ns = stat64_get(&stats->wasted_ns);
+    }
 
     QAPI_LIST_APPEND(*tail, info);
     return 0;
@@ -467,6 +467,11 @@ static void handle_arg_jitdump(const char *arg)
     perf_enable_jitdump();
 }
 
+static void handle_arg_tbprof(const char *arg)
+{
+    perf_enable_tbprof();
+}
+
 static QemuPluginList plugins = QTAILQ_HEAD_INITIALIZER(plugins);
 
 #ifdef CONFIG_PLUGIN
@@ -547,6 +552,8 @@ static const struct qemu_argument arg_table[] = {
      "",           "Generate a /tmp/perf-${pid}.map file for perf"},
     {"jitdump",    "QEMU_JITDUMP",     false, handle_arg_jitdump,
      "",           "Generate a jit-${pid}.dump file for perf"},
+    {"tbprof",     "QEMU_TBPROF",      false, handle_arg_tbprof,
+     "",           "Count block executions in /tmp/qemu-tbprof-${pid}"},
     {NULL, NULL, false, NULL, NULL, NULL}
 };
 
@@ -158,6 +158,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, ", zerocopy_fallbacks=%" PRIu64,
                            info->ram->dirty_sync_missed_zero_copy);
         }
+        if (info->ram->dedup_pages) {
+            monitor_printf(mon, ", dedup_pages=%" PRIu64,
+                           info->ram->dedup_pages);
+        }
         monitor_printf(mon, "\n");
     }
 
@@ -199,6 +203,19 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->dirty_limit_ring_full_time);
     }
 
+    if (info->dirty_ring_reap) {
+        uint64List *item;
+
+        monitor_printf(mon, "Dirty ring reaped pages: %" PRIu64 "\n",
+                       info->dirty_ring_reap->pages);
+        monitor_printf(mon, "Dirty ring reap latency (log2 us):");
+        for (item = info->dirty_ring_reap->latency_histogram; item;
+             item = item->next) {
+            monitor_printf(mon, " %" PRIu64, item->value);
+        }
+        monitor_printf(mon, "\n");
+    }
+
     if (info->has_postcopy_blocktime) {
         monitor_printf(mon, "Postcopy Blocktime (ms): %" PRIu32 "\n",
                        info->postcopy_blocktime);
@@ -101,6 +101,11 @@ typedef struct {
      * Number of pages transferred that were full of zeros.
      */
     Stat64 zero_pages;
+    /*
+     * Number of pages sent as a reference to an identical page.  These
+     * are also counted in normal_pages.
+     */
+    Stat64 dedup_pages;
 } MigrationAtomicStats;
 
 extern MigrationAtomicStats mig_stats;
@@ -1271,7 +1271,9 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->transferred = migration_transferred_bytes();
     info->ram->total = ram_bytes_total();
     info->ram->duplicate = stat64_get(&mig_stats.zero_pages);
-    info->ram->normal = stat64_get(&mig_stats.normal_pages);
+    info->ram->dedup_pages = stat64_get(&mig_stats.dedup_pages);
+    info->ram->normal = stat64_get(&mig_stats.normal_pages) -
+                        info->ram->dedup_pages;
     info->ram->normal_bytes = info->ram->normal * page_size;
     info->ram->mbps = s->mbps;
     info->ram->dirty_sync_count =
@@ -1317,6 +1319,19 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         info->has_dirty_limit_ring_full_time = true;
         info->dirty_limit_ring_full_time = dirtylimit_ring_full_time();
     }
+
+    if (kvm_dirty_ring_enabled()) {
+        uint64_t latency[KVM_DIRTY_RING_REAP_HIST_SIZE];
+        uint64List **tail;
+        int i;
+
+        info->dirty_ring_reap = g_new0(DirtyRingReapStats, 1);
+        info->dirty_ring_reap->pages = kvm_dirty_ring_reap_stats(latency);
+        tail = &info->dirty_ring_reap->latency_histogram;
+        for (i = 0; i < KVM_DIRTY_RING_REAP_HIST_SIZE; i++) {
+            QAPI_LIST_APPEND(tail, latency[i]);
+        }
+    }
 }
 
 static void fill_source_migration_info(MigrationInfo *info)
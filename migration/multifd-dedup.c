@@ -0,0 +1,377 @@
+/*
+ * Multifd page deduplication implementation.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * With multifd-dedup, every normal page is fingerprinted with XXH64
+ * before it is sent.  A table shared by all send channels remembers
+ * which page was sent with which fingerprint, and a later page with the
+ * same fingerprint is sent as a reference to that page instead of its
+ * content.  The destination copies the referenced page once the packet
+ * that carried it has been processed.
+ *
+ * The fingerprint only selects a candidate: the page is compared with
+ * the candidate in guest RAM before it is turned into a reference.  The
+ * candidate was sent earlier in the round with the same fingerprint, so
+ * a wrong reference needs both a fingerprint collision and the guest
+ * rewriting the candidate with this exact content before the compare.
+ * Random data does not do that; a guest that crafts it on purpose only
+ * corrupts its own copy of the page.
+ * A cryptographic digest would cost more CPU per page than the
+ * bandwidth dedup saves.
+ *
+ * References are only made to pages sent since the last multifd sync.
+ * Channels sync at the end of every round of RAM scan, and a page is
+ * sent at most once per round, so the referenced page is written once
+ * on the destination and cannot change before the reference is copied.
+ *
+ * Normal pages are copied before being fingerprinted, and the copy is
+ * what is sent, so the destination gets the exact content that the
+ * fingerprint describes even if the guest keeps writing the page.
+ *
+ * The table is only updated under a lock held for the whole packet, so
+ * a packet can only refer to itself or to packets prepared before it.
+ * The destination can wait for the referenced packet without risking a
+ * deadlock.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/thread.h"
+#include "qemu/xxhash.h"
+#include "qapi/error.h"
+#include "system/ramblock.h"
+#include "migration.h"
+#include "migration-stats.h"
+#include "multifd.h"
+#include "options.h"
+#include "ram.h"
+
+/* Number of entries in the fingerprint table, as a power of 2 */
+#define MULTIFD_DEDUP_TABLE_BITS 18
+
+typedef struct {
+    uint64_t hash;
+    RAMBlock *block;
+    ram_addr_t offset;
+    /* round of RAM scan in which the page was sent */
+    uint64_t epoch;
+    /* see MultiFDDedupRef_t */
+    uint64_t packet;
+    uint8_t channel;
+} MultiFDDedupEntry;
+
+static struct {
+    QemuMutex lock;
+    /* current round, entries of older rounds are stale */
+    uint64_t epoch;
+    MultiFDDedupEntry *table;
+} *multifd_dedup_send;
+
+static struct {
+    QemuMutex lock;
+    QemuCond cond;
+    bool exiting;
+    /* RAM packets processed by each channel */
+    uint64_t *packets;
+} *multifd_dedup_recv;
+
+/* XXH64 of a page; the page size is a multiple of 32 bytes */
+static uint64_t multifd_dedup_hash(const uint8_t *page, uint32_t size)
+{
+    uint64_t v1 = QEMU_XXHASH_SEED + XXH_PRIME64_1 + XXH_PRIME64_2;
+    uint64_t v2 = QEMU_XXHASH_SEED + XXH_PRIME64_2;
+    uint64_t v3 = QEMU_XXHASH_SEED + 0;
+    uint64_t v4 = QEMU_XXHASH_SEED - XXH_PRIME64_1;
+    uint32_t i;
+
+    for (i = 0; i < size; i += 32) {
+        v1 = XXH64_round(v1, ldq_he_p(page + i));
+        v2 = XXH64_round(v2, ldq_he_p(page + i + 8));
+        v3 = XXH64_round(v3, ldq_he_p(page + i + 16));
+        v4 = XXH64_round(v4, ldq_he_p(page + i + 24));
+    }
+
+    return XXH64_avalanche(XXH64_mergerounds(v1, v2, v3, v4) + size);
+}
+
+static uint32_t multifd_dedup_index(uint64_t hash)
+{
+    return hash & ((1 << MULTIFD_DEDUP_TABLE_BITS) - 1);
+}
+
+void multifd_send_dedup_setup(void)
+{
+    if (!migrate_multifd_dedup()) {
+        return;
+    }
+
+    multifd_dedup_send = g_new0(typeof(*multifd_dedup_send), 1);
+    qemu_mutex_init(&multifd_dedup_send->lock);
+    /* Zeroed entries belong to epoch 0 and are never matched */
+    multifd_dedup_send->epoch = 1;
+    multifd_dedup_send->table = g_new0(MultiFDDedupEntry,
+                                       1 << MULTIFD_DEDUP_TABLE_BITS);
+}
+
+void multifd_send_dedup_cleanup(void)
+{
+    if (!multifd_dedup_send) {
+        return;
+    }
+
+    qemu_mutex_destroy(&multifd_dedup_send->lock);
+    g_free(multifd_dedup_send->table);
+    g_clear_pointer(&multifd_dedup_send, g_free);
+}
+
+void multifd_send_dedup_channel_setup(MultiFDSendParams *p)
+{
+    uint32_t page_count = multifd_ram_page_count();
+
+    if (!multifd_dedup_send) {
+        return;
+    }
+
+    p->dedup_packets = 0;
+    p->dedup_buf = qemu_memalign(qemu_real_host_page_size(),
+                                 page_count * multifd_ram_page_size());
+    p->dedup_hash = g_new0(uint64_t, page_count);
+    p->dedup = g_new0(ram_addr_t, page_count);
+    p->dedup_ref = g_new0(MultiFDDedupRef_t, page_count);
+    p->dedup_num = 0;
+}
+
+void multifd_send_dedup_channel_cleanup(MultiFDSendParams *p)
+{
+    g_clear_pointer(&p->dedup_buf, qemu_vfree);
+    g_clear_pointer(&p->dedup_hash, g_free);
+    g_clear_pointer(&p->dedup, g_free);
+    g_clear_pointer(&p->dedup_ref, g_free);
+}
+
+/*
+ * Called once all channels have synced with the destination: the pages
+ * of the next round can be rewritten, so forget the current ones.
+ */
+void multifd_send_dedup_sync(void)
+{
+    if (!multifd_dedup_send) {
+        return;
+    }
+
+    qemu_mutex_lock(&multifd_dedup_send->lock);
+    multifd_dedup_send->epoch++;
+    qemu_mutex_unlock(&multifd_dedup_send->lock);
+}
+
+/**
+ * multifd_send_dedup_detect: Look for pages already sent in this round.
+ *
+ * Moves the normal pages that are a duplicate to p->dedup, and copies
+ * the remaining normal pages to p->dedup_buf.  Must be called after
+ * multifd_send_zero_page_detect().
+ *
+ * @param p A pointer to the send params.
+ */
+void multifd_send_dedup_detect(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = &p->data->u.ram;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t zero_num = pages->num - pages->normal_num;
+    uint64_t packet;
+    uint32_t normal_num = 0;
+    uint64_t epoch;
+    uint32_t i;
+
+    if (!multifd_dedup_send) {
+        return;
+    }
+
+    packet = p->dedup_packets++;
+    p->dedup_num = 0;
+
+    for (i = 0; i < pages->normal_num; i++) {
+        uint8_t *copy = p->dedup_buf + i * page_size;
+
+        memcpy(copy, pages->block->host + pages->offset[i], page_size);
+        p->dedup_hash[i] = multifd_dedup_hash(copy, page_size);
+    }
+
+    qemu_mutex_lock(&multifd_dedup_send->lock);
+    epoch = multifd_dedup_send->epoch;
+    for (i = 0; i < pages->normal_num; i++) {
+        uint64_t hash = p->dedup_hash[i];
+        MultiFDDedupEntry *e;
+
+        e = &multifd_dedup_send->table[multifd_dedup_index(hash)];
+        if (e->epoch == epoch && e->block == pages->block &&
+            e->hash == hash &&
+            !memcmp(pages->block->host + e->offset,
+                    p->dedup_buf + i * page_size, page_size)) {
+            MultiFDDedupRef_t *ref = &p->dedup_ref[p->dedup_num];
+
+            ref->offset = e->offset;
+            ref->packet = e->packet;
+            ref->channel = e->channel;
+            p->dedup[p->dedup_num++] = pages->offset[i];
+            pages->offset[i] = RAM_ADDR_INVALID;
+            continue;
+        }
+
+        e->hash = hash;
+        e->block = pages->block;
+        e->offset = pages->offset[i];
+        e->epoch = epoch;
+        e->packet = packet;
+        e->channel = p->id;
+    }
+    qemu_mutex_unlock(&multifd_dedup_send->lock);
+
+    if (!p->dedup_num) {
+        return;
+    }
+
+    /* Pack the remaining normal pages, followed by the zero pages */
+    for (i = 0; i < pages->normal_num; i++) {
+        if (pages->offset[i] == RAM_ADDR_INVALID) {
+            continue;
+        }
+        if (normal_num != i) {
+            pages->offset[normal_num] = pages->offset[i];
+            memcpy(p->dedup_buf + normal_num * page_size,
+                   p->dedup_buf + i * page_size, page_size);
+        }
+        normal_num++;
+    }
+    memmove(&pages->offset[normal_num], &pages->offset[pages->normal_num],
+            zero_num * sizeof(pages->offset[0]));
+
+    pages->normal_num = normal_num;
+    pages->num = normal_num + zero_num;
+
+    stat64_add(&mig_stats.dedup_pages, p->dedup_num);
+}
+
+void multifd_recv_dedup_setup(void)
+{
+    if (!migrate_multifd_dedup()) {
+        return;
+    }
+
+    multifd_dedup_recv = g_new0(typeof(*multifd_dedup_recv), 1);
+    qemu_mutex_init(&multifd_dedup_recv->lock);
+    qemu_cond_init(&multifd_dedup_recv->cond);
+    multifd_dedup_recv->packets = g_new0(uint64_t,
+                                         migrate_multifd_channels());
+}
+
+void multifd_recv_dedup_cleanup(void)
+{
+    if (!multifd_dedup_recv) {
+        return;
+    }
+
+    qemu_cond_destroy(&multifd_dedup_recv->cond);
+    qemu_mutex_destroy(&multifd_dedup_recv->lock);
+    g_free(multifd_dedup_recv->packets);
+    g_clear_pointer(&multifd_dedup_recv, g_free);
+}
+
+void multifd_recv_dedup_channel_setup(MultiFDRecvParams *p)
+{
+    uint32_t page_count = multifd_ram_page_count();
+
+    if (!multifd_dedup_recv) {
+        return;
+    }
+
+    p->dedup = g_new0(ram_addr_t, page_count);
+    p->dedup_ref = g_new0(MultiFDDedupRef_t, page_count);
+}
+
+void multifd_recv_dedup_channel_cleanup(MultiFDRecvParams *p)
+{
+    g_clear_pointer(&p->dedup, g_free);
+    g_clear_pointer(&p->dedup_ref, g_free);
+}
+
+/* Wake up the channels waiting for another one, which may never come */
+void multifd_recv_dedup_terminate(void)
+{
+    if (!multifd_dedup_recv) {
+        return;
+    }
+
+    qemu_mutex_lock(&multifd_dedup_recv->lock);
+    multifd_dedup_recv->exiting = true;
+    qemu_cond_broadcast(&multifd_dedup_recv->cond);
+    qemu_mutex_unlock(&multifd_dedup_recv->lock);
+}
+
+/**
+ * multifd_recv_dedup_process: Copy the dedup pages of a RAM packet.
+ *
+ * Must be called for every RAM packet that carries pages, after its
+ * normal pages were received.
+ *
+ * @param p A pointer to the recv params.
+ * @param errp Pointer to an error.
+ */
+int multifd_recv_dedup_process(MultiFDRecvParams *p, Error **errp)
+{
+    uint32_t page_size = multifd_ram_page_size();
+    uint64_t packet;
+    int i;
+
+    if (!multifd_dedup_recv) {
+        return 0;
+    }
+
+    qemu_mutex_lock(&multifd_dedup_recv->lock);
+    packet = multifd_dedup_recv->packets[p->id];
+    qemu_mutex_unlock(&multifd_dedup_recv->lock);
+
+    for (i = 0; i < p->dedup_num; i++) {
+        MultiFDDedupRef_t *ref = &p->dedup_ref[i];
+
+        if (ref->channel == p->id) {
+            /* Packets of the same channel are processed in order */
+            if (ref->packet > packet) {
+                error_setg(errp, "multifd %u: dedup page refers to future "
+                           "packet %" PRIu64, p->id, ref->packet);
+                return -1;
+            }
+        } else {
+            bool exiting;
+
+            qemu_mutex_lock(&multifd_dedup_recv->lock);
+            while (multifd_dedup_recv->packets[ref->channel] <= ref->packet &&
+                   !multifd_dedup_recv->exiting) {
+                qemu_cond_wait(&multifd_dedup_recv->cond,
+                               &multifd_dedup_recv->lock);
+            }
+            exiting = multifd_dedup_recv->exiting;
+            qemu_mutex_unlock(&multifd_dedup_recv->lock);
+
+            if (exiting) {
+                error_setg(errp, "multifd %u: terminated while waiting for "
+                           "channel %u", p->id, ref->channel);
+                return -1;
+            }
+        }
+
+        memcpy(p->host + p->dedup[i], p->host + ref->offset, page_size);
+        ramblock_recv_bitmap_set_offset(p->block, p->dedup[i]);
+    }
+
+    qemu_mutex_lock(&multifd_dedup_recv->lock);
+    multifd_dedup_recv->packets[p->id]++;
+    qemu_cond_broadcast(&multifd_dedup_recv->cond);
+    qemu_mutex_unlock(&multifd_dedup_recv->lock);
+
+    return 0;
+}
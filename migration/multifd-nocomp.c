@@ -98,7 +98,11 @@ static void multifd_send_prepare_iovs(MultiFDSendParams *p)
     uint32_t page_size = multifd_ram_page_size();
 
     for (int i = 0; i < pages->normal_num; i++) {
-        p->iov[p->iovs_num].iov_base = pages->block->host + pages->offset[i];
+        if (p->dedup_buf) {
+            p->iov[p->iovs_num].iov_base = p->dedup_buf + i * page_size;
+        } else {
+            p->iov[p->iovs_num].iov_base = pages->block->host + pages->offset[i];
+        }
         p->iov[p->iovs_num].iov_len = page_size;
         p->iovs_num++;
     }
@@ -120,6 +124,8 @@ static int multifd_nocomp_send_prepare(MultiFDSendParams *p, Error **errp)
         return 0;
     }
 
+    multifd_send_dedup_detect(p);
+
     if (!use_zero_copy_send) {
         /*
          * Only !zerocopy needs the header in IOV; zerocopy will
@@ -222,6 +228,20 @@ void multifd_ram_fill_packet(MultiFDSendParams *p)
         packet->offset[i] = cpu_to_be64(temp);
     }
 
+    if (p->dedup_buf) {
+        MultiFDDedupRef_t *ref = multifd_packet_dedup_ref(packet);
+
+        packet->dedup_pages = cpu_to_be32(p->dedup_num);
+        for (int i = 0; i < p->dedup_num; i++) {
+            uint64_t temp = p->dedup[i];
+
+            packet->offset[pages->num + i] = cpu_to_be64(temp);
+            ref[i].offset = cpu_to_be64(p->dedup_ref[i].offset);
+            ref[i].packet = cpu_to_be64(p->dedup_ref[i].packet);
+            ref[i].channel = p->dedup_ref[i].channel;
+        }
+    }
+
     trace_multifd_send_ram_fill(p->id, pages->normal_num,
                                 zero_num);
 }
@@ -256,7 +276,20 @@ int multifd_ram_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
-    if (p->normal_num == 0 && p->zero_num == 0) {
+    p->dedup_num = be32_to_cpu(packet->dedup_pages);
+    if (p->dedup_num && !p->dedup) {
+        error_setg(errp, "multifd: received dedup pages, but multifd-dedup "
+                   "is not enabled");
+        return -1;
+    }
+    if (p->dedup_num > pages_per_packet - p->normal_num - p->zero_num) {
+        error_setg(errp,
+                   "multifd: received packet with %u dedup pages, expected maximum %u",
+                   p->dedup_num, pages_per_packet - p->normal_num - p->zero_num);
+        return -1;
+    }
+
+    if (p->normal_num == 0 && p->zero_num == 0 && p->dedup_num == 0) {
         return 0;
     }
 
@@ -294,6 +327,30 @@ int multifd_ram_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->zero[i] = offset;
     }
 
+    for (i = 0; i < p->dedup_num; i++) {
+        MultiFDDedupRef_t *ref = &multifd_packet_dedup_ref(packet)[i];
+        uint64_t offset = be64_to_cpu(packet->offset[p->normal_num +
+                                                     p->zero_num + i]);
+        uint64_t src = be64_to_cpu(ref->offset);
+
+        if (offset > (p->block->used_length - page_size) ||
+            src > (p->block->used_length - page_size)) {
+            error_setg(errp, "multifd: dedup offset too long %" PRIu64
+                       " or %" PRIu64 " (max " RAM_ADDR_FMT ")",
+                       offset, src, p->block->used_length);
+            return -1;
+        }
+        if (ref->channel >= migrate_multifd_channels()) {
+            error_setg(errp, "multifd: dedup page refers to channel %u",
+                       ref->channel);
+            return -1;
+        }
+        p->dedup[i] = offset;
+        p->dedup_ref[i].offset = src;
+        p->dedup_ref[i].packet = be64_to_cpu(ref->packet);
+        p->dedup_ref[i].channel = ref->channel;
+    }
+
     return 0;
 }
 
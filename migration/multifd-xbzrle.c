@@ -0,0 +1,377 @@
+/*
+ * Multifd XBZRLE compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/host-utils.h"
+#include "qemu/thread.h"
+#include "system/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "migration-stats.h"
+#include "options.h"
+#include "multifd.h"
+#include "page_cache.h"
+#include "ram.h"
+#include "xbzrle.h"
+
+/*
+ * Every normal page in a packet is sent as a 32-bit big endian length
+ * followed by either the XBZRLE encoded page (length < page size) or the
+ * raw page (length == page size).
+ */
+#define MULTIFD_XBZRLE_HDR_LEN 4
+
+/* Maximum number of cache shards, must be a power of 2 */
+#define MULTIFD_XBZRLE_MAX_SHARDS 64
+
+/*
+ * The content that was last sent for a page, to encode the next version of
+ * the page against.  A page may be sent by a different channel in every
+ * round of RAM scan, so the cache is shared by all channels.  It is split
+ * in shards by page address to reduce lock contention.
+ *
+ * Within a round, a page is sent at most once, and the channels are synced
+ * between rounds, so the cached content is always the one that the
+ * destination has.
+ */
+typedef struct {
+    QemuMutex lock;
+    PageCache *cache;
+} MultiFDXbzrleShard;
+
+static struct {
+    MultiFDXbzrleShard *shards;
+    unsigned int nr_shards;
+    unsigned int users;
+} multifd_xbzrle;
+
+struct xbzrle_data {
+    /* copy of the page, because the guest may change it while encoding */
+    uint8_t *page;
+    /* encoded packet */
+    uint8_t *buf;
+    /* size of encoded packet buffer */
+    uint32_t buf_len;
+};
+
+static int multifd_xbzrle_cache_init(Error **errp)
+{
+    uint32_t page_size = multifd_ram_page_size();
+    uint64_t cache_size = migrate_xbzrle_cache_size();
+    unsigned int i;
+
+    if (multifd_xbzrle.users++) {
+        return 0;
+    }
+
+    /* cache_init() reports the error for a cache smaller than a page */
+    multifd_xbzrle.nr_shards = MAX(1, MIN(MULTIFD_XBZRLE_MAX_SHARDS,
+                                          pow2floor(cache_size / page_size)));
+    multifd_xbzrle.shards = g_new0(MultiFDXbzrleShard,
+                                   multifd_xbzrle.nr_shards);
+
+    for (i = 0; i < multifd_xbzrle.nr_shards; i++) {
+        MultiFDXbzrleShard *shard = &multifd_xbzrle.shards[i];
+
+        shard->cache = cache_init(cache_size / multifd_xbzrle.nr_shards,
+                                  page_size, errp);
+        if (!shard->cache) {
+            return -1;
+        }
+        qemu_mutex_init(&shard->lock);
+    }
+
+    return 0;
+}
+
+static void multifd_xbzrle_cache_fini(void)
+{
+    unsigned int i;
+
+    assert(multifd_xbzrle.users);
+    if (--multifd_xbzrle.users) {
+        return;
+    }
+
+    for (i = 0; i < multifd_xbzrle.nr_shards; i++) {
+        MultiFDXbzrleShard *shard = &multifd_xbzrle.shards[i];
+
+        if (shard->cache) {
+            cache_fini(shard->cache);
+            qemu_mutex_destroy(&shard->lock);
+        }
+    }
+    g_clear_pointer(&multifd_xbzrle.shards, g_free);
+    multifd_xbzrle.nr_shards = 0;
+}
+
+/*
+ * Return the shard of the page at @addr, and in @key the address to use
+ * for it inside the shard, so that all entries of the shard's cache are
+ * used.
+ */
+static MultiFDXbzrleShard *multifd_xbzrle_shard(ram_addr_t addr,
+                                                uint64_t *key)
+{
+    uint32_t page_size = multifd_ram_page_size();
+    uint64_t page = addr / page_size;
+
+    *key = page / multifd_xbzrle.nr_shards * page_size;
+    return &multifd_xbzrle.shards[page & (multifd_xbzrle.nr_shards - 1)];
+}
+
+/* The destination will have a zero page, don't encode against old data */
+static void multifd_xbzrle_cache_zero_page(ram_addr_t addr)
+{
+    MultiFDXbzrleShard *shard;
+    uint64_t key;
+    uint8_t *data;
+
+    shard = multifd_xbzrle_shard(addr, &key);
+    qemu_mutex_lock(&shard->lock);
+    data = get_cached_data(shard->cache, key);
+    if (data && cache_is_cached(shard->cache, key,
+                                stat64_get(&mig_stats.dirty_sync_count))) {
+        memset(data, 0, multifd_ram_page_size());
+    }
+    qemu_mutex_unlock(&shard->lock);
+}
+
+/*
+ * Encode @page at @addr into @dst, and remember it as the last content
+ * sent for @addr.
+ *
+ * Returns the encoded length, or -1 if the page must be sent as is.
+ */
+static int multifd_xbzrle_encode_page(ram_addr_t addr, uint8_t *page,
+                                      uint8_t *dst)
+{
+    uint32_t page_size = multifd_ram_page_size();
+    uint64_t generation = stat64_get(&mig_stats.dirty_sync_count);
+    MultiFDXbzrleShard *shard;
+    uint8_t *cached;
+    uint64_t key;
+    int len = -1;
+
+    shard = multifd_xbzrle_shard(addr, &key);
+    qemu_mutex_lock(&shard->lock);
+    if (cache_is_cached(shard->cache, key, generation)) {
+        cached = get_cached_data(shard->cache, key);
+        /* A length of page_size would be taken as a raw page */
+        len = xbzrle_encode_buffer(cached, page, page_size, dst,
+                                   page_size - 1);
+        memcpy(cached, page, page_size);
+    } else {
+        cache_insert(shard->cache, key, page, generation);
+    }
+    qemu_mutex_unlock(&shard->lock);
+
+    return len;
+}
+
+/* Multifd xbzrle compression */
+
+static int multifd_xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x;
+    uint32_t page_size = multifd_ram_page_size();
+
+    if (multifd_xbzrle_cache_init(errp)) {
+        error_prepend(errp, "multifd %u: ", p->id);
+        multifd_xbzrle_cache_fini();
+        return -1;
+    }
+
+    x = g_new0(struct xbzrle_data, 1);
+    x->page = g_malloc(page_size);
+    x->buf_len = (MULTIFD_XBZRLE_HDR_LEN + page_size) *
+                 multifd_ram_page_count();
+    x->buf = g_malloc(x->buf_len);
+    p->compress_data = x;
+
+    /* Needs 2 IOVs, one for packet header and one for encoded data */
+    p->iov = g_new0(struct iovec, 2);
+
+    return 0;
+}
+
+static void multifd_xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->compress_data;
+
+    /* send_setup failed and already dropped its cache reference */
+    if (!x) {
+        return;
+    }
+
+    g_free(x->page);
+    g_free(x->buf);
+    g_clear_pointer(&p->compress_data, g_free);
+    g_clear_pointer(&p->iov, g_free);
+
+    multifd_xbzrle_cache_fini();
+}
+
+static int multifd_xbzrle_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = &p->data->u.ram;
+    struct xbzrle_data *x = p->compress_data;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t out_size = 0;
+    bool has_normal;
+    uint32_t i;
+
+    has_normal = multifd_send_prepare_common(p);
+
+    for (i = pages->normal_num; i < pages->num; i++) {
+        multifd_xbzrle_cache_zero_page(pages->block->offset +
+                                       pages->offset[i]);
+    }
+
+    if (!has_normal) {
+        goto out;
+    }
+
+    for (i = 0; i < pages->normal_num; i++) {
+        uint8_t *hdr = x->buf + out_size;
+        uint8_t *data = hdr + MULTIFD_XBZRLE_HDR_LEN;
+        int len;
+
+        /* The encoded and the cached data must be the same */
+        memcpy(x->page, pages->block->host + pages->offset[i], page_size);
+
+        len = multifd_xbzrle_encode_page(pages->block->offset +
+                                         pages->offset[i], x->page, data);
+        if (len < 0) {
+            memcpy(data, x->page, page_size);
+            len = page_size;
+        }
+
+        stl_be_p(hdr, len);
+        out_size += MULTIFD_XBZRLE_HDR_LEN + len;
+    }
+
+    p->iov[p->iovs_num].iov_base = x->buf;
+    p->iov[p->iovs_num].iov_len = out_size;
+    p->iovs_num++;
+    p->next_packet_size = out_size;
+
+out:
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+    multifd_send_fill_packet(p);
+    return 0;
+}
+
+static int multifd_xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = g_new0(struct xbzrle_data, 1);
+
+    x->buf_len = (MULTIFD_XBZRLE_HDR_LEN + multifd_ram_page_size()) *
+                 multifd_ram_page_count();
+    x->buf = g_malloc(x->buf_len);
+    p->compress_data = x;
+
+    return 0;
+}
+
+static void multifd_xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct xbzrle_data *x = p->compress_data;
+
+    g_free(x->buf);
+    g_clear_pointer(&p->compress_data, g_free);
+}
+
+static int multifd_xbzrle_recv(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->compress_data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t pos = 0;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+
+    multifd_recv_zero_page_process(p);
+
+    if (!p->normal_num) {
+        assert(in_size == 0);
+        return 0;
+    }
+
+    if (in_size > x->buf_len) {
+        error_setg(errp, "multifd %u: packet size %u exceeds %u",
+                   p->id, in_size, x->buf_len);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)x->buf, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint8_t *page = p->host + p->normal[i];
+        uint32_t len;
+
+        if (in_size - pos < MULTIFD_XBZRLE_HDR_LEN) {
+            error_setg(errp, "multifd %u: packet truncated", p->id);
+            return -1;
+        }
+        len = ldl_be_p(x->buf + pos);
+        pos += MULTIFD_XBZRLE_HDR_LEN;
+
+        if (len > page_size || in_size - pos < len) {
+            error_setg(errp, "multifd %u: invalid page length %u",
+                       p->id, len);
+            return -1;
+        }
+
+        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+        if (len == page_size) {
+            memcpy(page, x->buf + pos, page_size);
+        } else if (xbzrle_decode_buffer(x->buf + pos, len, page,
+                                        page_size) < 0) {
+            error_setg(errp, "multifd %u: failed to decode page at offset "
+                       RAM_ADDR_FMT, p->id, p->normal[i]);
+            return -1;
+        }
+        pos += len;
+    }
+
+    if (pos != in_size) {
+        error_setg(errp, "multifd %u: packet size received %u size used %u",
+                   p->id, in_size, pos);
+        return -1;
+    }
+
+    return 0;
+}
+
+static const MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = multifd_xbzrle_send_setup,
+    .send_cleanup = multifd_xbzrle_send_cleanup,
+    .send_prepare = multifd_xbzrle_send_prepare,
+    .recv_setup = multifd_xbzrle_recv_setup,
+    .recv_cleanup = multifd_xbzrle_recv_cleanup,
+    .recv = multifd_xbzrle_recv
+};
+
+static void multifd_xbzrle_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_XBZRLE, &multifd_xbzrle_ops);
+}
+
+migration_init(multifd_xbzrle_register);
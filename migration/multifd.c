@@ -521,6 +521,7 @@ static bool multifd_send_cleanup_channel(MultiFDSendParams *p, Error **errp)
     p->packet = NULL;
     multifd_send_state->ops->send_cleanup(p, errp);
     assert(!p->iov);
+    multifd_send_dedup_channel_cleanup(p);
 
     return *errp == NULL;
 }
@@ -530,6 +531,7 @@ static void multifd_send_cleanup_state(void)
     file_cleanup_outgoing_migration();
     socket_cleanup_outgoing_migration();
     multifd_device_state_send_cleanup();
+    multifd_send_dedup_cleanup();
     qemu_sem_destroy(&multifd_send_state->channels_created);
     qemu_sem_destroy(&multifd_send_state->channels_ready);
     qemu_mutex_destroy(&multifd_send_state->multifd_send_mutex);
@@ -652,6 +654,10 @@ int multifd_send_sync_main(MultiFDSyncReq req)
     }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 
+    if (req == MULTIFD_SYNC_ALL) {
+        multifd_send_dedup_sync();
+    }
+
     return 0;
 }
 
@@ -951,6 +957,9 @@ bool multifd_send_setup(void)
         if (use_packets) {
             p->packet_len = sizeof(MultiFDPacket_t)
                           + sizeof(uint64_t) * page_count;
+            if (migrate_multifd_dedup()) {
+                p->packet_len += sizeof(MultiFDDedupRef_t) * page_count;
+            }
             p->packet = g_malloc0(p->packet_len);
             p->packet_device_state = g_malloc0(sizeof(*p->packet_device_state));
             p->packet_device_state->hdr.magic = cpu_to_be32(MULTIFD_MAGIC);
@@ -978,6 +987,8 @@ bool multifd_send_setup(void)
         goto err;
     }
 
+    multifd_send_dedup_setup();
+
     for (i = 0; i < thread_count; i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
         Error *local_err = NULL;
@@ -988,6 +999,7 @@ bool multifd_send_setup(void)
             goto err;
         }
         assert(p->iov);
+        multifd_send_dedup_channel_setup(p);
     }
 
     multifd_device_state_send_setup();
@@ -1061,6 +1073,8 @@ static void multifd_recv_terminate_threads(Error *err)
         return;
     }
 
+    multifd_recv_dedup_terminate();
+
     if (err) {
         MigrationState *s = migrate_get_current();
         migrate_set_error(s, err);
@@ -1136,11 +1150,13 @@ static void multifd_recv_cleanup_channel(MultiFDRecvParams *p)
     p->normal = NULL;
     g_free(p->zero);
     p->zero = NULL;
+    multifd_recv_dedup_channel_cleanup(p);
     multifd_recv_state->ops->recv_cleanup(p);
 }
 
 static void multifd_recv_cleanup_state(void)
 {
+    multifd_recv_dedup_cleanup();
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
     g_free(multifd_recv_state->params);
     multifd_recv_state->params = NULL;
@@ -1353,7 +1369,7 @@ static void *multifd_recv_thread(void *opaque)
                  * because older QEMUs (<9.0) still send data along with
                  * the SYNC packet.
                  */
-                has_data = p->normal_num || p->zero_num;
+                has_data = p->normal_num || p->zero_num || p->dedup_num;
             }
 
             qemu_mutex_unlock(&p->mutex);
@@ -1396,6 +1412,9 @@ static void *multifd_recv_thread(void *opaque)
                 ret = multifd_device_state_recv(p, &local_err);
             } else {
                 ret = multifd_recv_state->ops->recv(p, &local_err);
+                if (ret == 0) {
+                    ret = multifd_recv_dedup_process(p, &local_err);
+                }
             }
             if (ret != 0) {
                 break;
@@ -1465,6 +1484,7 @@ int multifd_recv_setup(Error **errp)
     qatomic_set(&multifd_recv_state->exiting, 0);
     qemu_sem_init(&multifd_recv_state->sem_sync, 0);
     multifd_recv_state->ops = multifd_ops[migrate_multifd_compression()];
+    multifd_recv_dedup_setup();
 
     for (i = 0; i < thread_count; i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
@@ -1481,12 +1501,16 @@ int multifd_recv_setup(Error **errp)
         if (use_packets) {
             p->packet_len = sizeof(MultiFDPacket_t)
                 + sizeof(uint64_t) * page_count;
+            if (migrate_multifd_dedup()) {
+                p->packet_len += sizeof(MultiFDDedupRef_t) * page_count;
+            }
             p->packet = g_malloc0(p->packet_len);
             p->packet_dev_state = g_malloc0(sizeof(*p->packet_dev_state));
         }
         p->name = g_strdup_printf(MIGRATION_THREAD_DST_MULTIFD, i);
         p->normal = g_new0(ram_addr_t, page_count);
         p->zero = g_new0(ram_addr_t, page_count);
+        multifd_recv_dedup_channel_setup(p);
     }
 
     for (i = 0; i < thread_count; i++) {
@@ -66,6 +66,7 @@ MultiFDRecvData *multifd_get_recv_data(void);
 #define MULTIFD_FLAG_QPL (4 << 1)
 #define MULTIFD_FLAG_UADK (8 << 1)
 #define MULTIFD_FLAG_QATZIP (16 << 1)
+#define MULTIFD_FLAG_XBZRLE (3 << 1)
 
 /*
  * If set it means that this packet contains device state
@@ -94,17 +95,33 @@ typedef struct {
     uint64_t packet_num;
     /* zero pages */
     uint32_t zero_pages;
-    uint32_t unused32[1];    /* Reserved for future use */
+    /* pages sent as a reference to another page (multifd-dedup only) */
+    uint32_t dedup_pages;
     uint64_t unused64[3];    /* Reserved for future use */
     char ramblock[256];
     /*
      * This array contains the pointers to:
      *  - normal pages (initial normal_pages entries)
      *  - zero pages (following zero_pages entries)
+     *  - dedup pages (following dedup_pages entries)
+     *
+     * With multifd-dedup, it is followed by a MultiFDDedupRef_t array
+     * holding the reference of each dedup page.
      */
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
 
+/*
+ * A dedup page is a copy of the page at @offset in the same RAMBlock,
+ * which is a normal page of the @packet'th RAM packet sent by @channel.
+ */
+typedef struct {
+    uint64_t offset;
+    uint64_t packet;
+    uint8_t channel;
+    uint8_t unused[7];      /* Reserved for future use */
+} __attribute__((packed)) MultiFDDedupRef_t;
+
 typedef struct {
     MultiFDPacketHdr_t hdr;
 
@@ -234,6 +251,19 @@ typedef struct {
     uint32_t iovs_num;
     /* used for compression methods */
     void *compress_data;
+
+    /* multifd-dedup state, see multifd-dedup.c */
+
+    /* RAM packets prepared by this channel */
+    uint64_t dedup_packets;
+    /* copies of the normal pages, which are sent instead of guest RAM */
+    uint8_t *dedup_buf;
+    /* fingerprints of the normal pages */
+    uint64_t *dedup_hash;
+    /* pages sent as a reference to another page */
+    ram_addr_t *dedup;
+    MultiFDDedupRef_t *dedup_ref;
+    uint32_t dedup_num;
 }  MultiFDSendParams;
 
 typedef struct {
@@ -291,6 +321,11 @@ typedef struct {
     ram_addr_t *zero;
     /* num of zero pages */
     uint32_t zero_num;
+    /* Pages that are a copy of another page */
+    ram_addr_t *dedup;
+    MultiFDDedupRef_t *dedup_ref;
+    /* num of dedup pages */
+    uint32_t dedup_num;
     /* used for de-compression methods */
     void *compress_data;
     /* Flags for the QIOChannel */
@@ -382,6 +417,19 @@ bool multifd_send_prepare_common(MultiFDSendParams *p);
 void multifd_send_zero_page_detect(MultiFDSendParams *p);
 void multifd_recv_zero_page_process(MultiFDRecvParams *p);
 
+void multifd_send_dedup_setup(void);
+void multifd_send_dedup_cleanup(void);
+void multifd_send_dedup_channel_setup(MultiFDSendParams *p);
+void multifd_send_dedup_channel_cleanup(MultiFDSendParams *p);
+void multifd_send_dedup_sync(void);
+void multifd_send_dedup_detect(MultiFDSendParams *p);
+void multifd_recv_dedup_setup(void);
+void multifd_recv_dedup_cleanup(void);
+void multifd_recv_dedup_channel_setup(MultiFDRecvParams *p);
+void multifd_recv_dedup_channel_cleanup(MultiFDRecvParams *p);
+void multifd_recv_dedup_terminate(void);
+int multifd_recv_dedup_process(MultiFDRecvParams *p, Error **errp);
+
 void multifd_channel_connect(MultiFDSendParams *p, QIOChannel *ioc);
 bool multifd_send(MultiFDSendData **send_data);
 MultiFDSendData *multifd_send_data_alloc(void);
@@ -398,6 +446,11 @@ static inline uint32_t multifd_ram_page_count(void)
     return MULTIFD_PACKET_SIZE / qemu_target_page_size();
 }
 
+static inline MultiFDDedupRef_t *multifd_packet_dedup_ref(MultiFDPacket_t *p)
+{
+    return (MultiFDDedupRef_t *)&p->offset[multifd_ram_page_count()];
+}
+
 void multifd_ram_save_setup(void);
 void multifd_ram_save_cleanup(void);
 int multifd_ram_flush_and_sync(QEMUFile *f);
@@ -201,6 +201,7 @@ const Property migration_properties[] = {
                         MIGRATION_CAPABILITY_SWITCHOVER_ACK),
     DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
     DEFINE_PROP_MIG_CAP("mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("multifd-dedup", MIGRATION_CAPABILITY_MULTIFD_DEDUP),
 };
 const size_t migration_properties_count = ARRAY_SIZE(migration_properties);
 
@@ -281,6 +282,13 @@ bool migrate_multifd(void)
     return s->capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_multifd_dedup(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MULTIFD_DEDUP];
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s = migrate_get_current();
@@ -610,6 +618,38 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_MULTIFD_DEDUP]) {
+        if (!new_caps[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Multifd dedup requires multifd");
+            return false;
+        }
+
+        if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM] ||
+            new_caps[MIGRATION_CAPABILITY_ZERO_COPY_SEND] ||
+            migrate_multifd_compression()) {
+            error_setg(errp, "Multifd dedup is only available for "
+                       "non-compressed multifd migration without mapped-ram "
+                       "or zero-copy-send");
+            return false;
+        }
+
+        /*
+         * References are only sent to pages of the current round, which
+         * are written once on the destination as long as the channels
+         * sync at the end of each round.
+         */
+        if (migrate_multifd_flush_after_each_section()) {
+            error_setg(errp, "Multifd dedup requires "
+                       "multifd-flush-after-each-section=off");
+            return false;
+        }
+
+        if (!migrate_multifd_dedup() && migrate_incoming_started()) {
+            error_setg(errp, "Multifd dedup must be set before incoming starts");
+            return false;
+        }
+    }
+
     if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
         if (new_caps[MIGRATION_CAPABILITY_XBZRLE]) {
             error_setg(errp,
@@ -1156,6 +1196,40 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (migrate_multifd_dedup() &&
+        params->has_multifd_compression && params->multifd_compression) {
+        error_setg(errp,
+                   "Multifd dedup only available for non-compressed multifd migration");
+        return false;
+    }
+
+    /*
+     * Legacy zero page detection sends zero pages from the migration
+     * thread, and multifd xbzrle would not know that the cached content
+     * of those pages is stale.
+     */
+    if (params->has_multifd_compression &&
+        params->multifd_compression == MULTIFD_COMPRESSION_XBZRLE &&
+        params->has_zero_page_detection &&
+        params->zero_page_detection == ZERO_PAGE_DETECTION_LEGACY) {
+        error_setg(errp,
+                   "Multifd xbzrle compression is not compatible with legacy zero page detection");
+        return false;
+    }
+
+    /*
+     * Multifd xbzrle relies on a page being sent at most once between
+     * two multifd syncs, which only holds if channels sync once per
+     * round of RAM scan.
+     */
+    if (params->has_multifd_compression &&
+        params->multifd_compression == MULTIFD_COMPRESSION_XBZRLE &&
+        migrate_multifd_flush_after_each_section()) {
+        error_setg(errp,
+                   "Multifd xbzrle compression requires multifd-flush-after-each-section=off");
+        return false;
+    }
+
     if (params->has_x_vcpu_dirty_limit_period &&
         (params->x_vcpu_dirty_limit_period < 1 ||
          params->x_vcpu_dirty_limit_period > 1000)) {
@@ -15,10 +15,250 @@
 #include "qemu/host-utils.h"
 #include "xbzrle.h"
 
-#if defined(CONFIG_AVX512BW_OPT)
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512BW_OPT)
 #include <immintrin.h>
 #include "host/cpuinfo.h"
+#define xbzrle_cpuinfo() cpuinfo_init()
+#else
+#define xbzrle_cpuinfo() 0
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON) && !HOST_BIG_ENDIAN
+#include <arm_neon.h>
+#define XBZRLE_NEON
+#endif
+
+/*
+  page = zrun nzrun
+       | zrun nzrun page
+
+  zrun = length
+
+  nzrun = length byte...
+
+  length = uleb128 encoded integer
+ */
+static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
+                                    int slen, uint8_t *dst, int dlen)
+{
+    uint32_t zrun_len = 0, nzrun_len = 0;
+    int d = 0, i = 0;
+    long res;
+    uint8_t *nzrun_start = NULL;
+
+    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
+               sizeof(long)));
+
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        /* not aligned to sizeof(long) */
+        res = (slen - i) % sizeof(long);
+        while (res && old_buf[i] == new_buf[i]) {
+            zrun_len++;
+            i++;
+            res--;
+        }
+
+        /* word at a time for speed */
+        if (!res) {
+            while (i < slen &&
+                   (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
+                i += sizeof(long);
+                zrun_len += sizeof(long);
+            }
+
+            /* go over the rest */
+            while (i < slen && old_buf[i] == new_buf[i]) {
+                zrun_len++;
+                i++;
+            }
+        }
+
+        /* buffer unchanged */
+        if (zrun_len == slen) {
+            return 0;
+        }
+
+        /* skip last zero run */
+        if (i == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, zrun_len);
+
+        zrun_len = 0;
+        nzrun_start = new_buf + i;
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+        /* not aligned to sizeof(long) */
+        res = (slen - i) % sizeof(long);
+        while (res && old_buf[i] != new_buf[i]) {
+            i++;
+            nzrun_len++;
+            res--;
+        }
+
+        /* word at a time for speed, use of 32-bit long okay */
+        if (!res) {
+            /* truncation to 32-bit long okay */
+            unsigned long mask = (unsigned long)0x0101010101010101ULL;
+            while (i < slen) {
+                unsigned long xor;
+                xor = *(unsigned long *)(old_buf + i)
+                    ^ *(unsigned long *)(new_buf + i);
+                if ((xor - mask) & ~xor & (mask << 7)) {
+                    /* found the end of an nzrun within the current long */
+                    while (old_buf[i] != new_buf[i]) {
+                        nzrun_len++;
+                        i++;
+                    }
+                    break;
+                } else {
+                    i += sizeof(long);
+                    nzrun_len += sizeof(long);
+                }
+            }
+        }
+
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        /* overflow */
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, nzrun_start, nzrun_len);
+        d += nzrun_len;
+        nzrun_len = 0;
+    }
+
+    return d;
+}
+
+/*
+ * Return the index of the first byte at or after @i that differs between
+ * @old_buf and @new_buf (xbzrle_skip_same), or that is the same in both
+ * (xbzrle_skip_diff); @slen if there is none.
+ */
+typedef int (*xbzrle_skip_fn)(const uint8_t *old_buf, const uint8_t *new_buf,
+                              int i, int slen);
+
+static inline int xbzrle_skip_same_tail(const uint8_t *old_buf,
+                                        const uint8_t *new_buf,
+                                        int i, int slen)
+{
+    while (i < slen && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static inline int xbzrle_skip_diff_tail(const uint8_t *old_buf,
+                                        const uint8_t *new_buf,
+                                        int i, int slen)
+{
+    while (i < slen && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+/*
+ * Encoder for vector implementations, which are better at finding the end
+ * of a run than at following runs byte by byte.  The output is the same
+ * as the one of xbzrle_encode_buffer_int().
+ */
+static inline int QEMU_ALWAYS_INLINE
+xbzrle_encode_runs(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                   uint8_t *dst, int dlen,
+                   xbzrle_skip_fn skip_same, xbzrle_skip_fn skip_diff)
+{
+    int d = 0, i = 0;
+    int nzrun_start, nzrun_len;
+
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        nzrun_start = skip_same(old_buf, new_buf, i, slen);
+
+        /* skip last zero run, this also covers the unchanged buffer */
+        if (nzrun_start == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, nzrun_start - i);
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        i = skip_diff(old_buf, new_buf, nzrun_start, slen);
+        nzrun_len = i - nzrun_start;
+
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        /* overflow */
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + nzrun_start, nzrun_len);
+        d += nzrun_len;
+    }
+
+    return d;
+}
+
+#ifdef CONFIG_AVX2_OPT
+static inline int __attribute__((target("avx2")))
+xbzrle_skip_same_avx2(const uint8_t *old_buf, const uint8_t *new_buf,
+                      int i, int slen)
+{
+    for (; i + 32 <= slen; i += 32) {
+        __m256i old_data = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i new_data = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t diff = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(old_data,
+                                                                new_data));
+        if (diff) {
+            return i + ctz32(diff);
+        }
+    }
+    return xbzrle_skip_same_tail(old_buf, new_buf, i, slen);
+}
+
+static inline int __attribute__((target("avx2")))
+xbzrle_skip_diff_avx2(const uint8_t *old_buf, const uint8_t *new_buf,
+                      int i, int slen)
+{
+    for (; i + 32 <= slen; i += 32) {
+        __m256i old_data = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i new_data = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t same = _mm256_movemask_epi8(_mm256_cmpeq_epi8(old_data,
+                                                               new_data));
+        if (same) {
+            return i + ctz32(same);
+        }
+    }
+    return xbzrle_skip_diff_tail(old_buf, new_buf, i, slen);
+}
+
+static int __attribute__((target("avx2")))
+xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                          uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_runs(old_buf, new_buf, slen, dst, dlen,
+                              xbzrle_skip_same_avx2, xbzrle_skip_diff_avx2);
+}
+#endif /* CONFIG_AVX2_OPT */
 
+#ifdef CONFIG_AVX512BW_OPT
 static int __attribute__((target("avx512bw")))
 xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
                             uint8_t *dst, int dlen)
@@ -136,141 +376,126 @@ xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
     }
     return d;
 }
+#endif /* CONFIG_AVX512BW_OPT */
 
-static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
-                                    int slen, uint8_t *dst, int dlen);
+#ifdef XBZRLE_NEON
+/*
+ * Return a mask with 4 bits set for each byte that is the same in
+ * both vectors.
+ */
+static inline uint64_t xbzrle_neon_same_mask(const uint8_t *old_buf,
+                                             const uint8_t *new_buf)
+{
+    uint8x16_t cmp = vceqq_u8(vld1q_u8(old_buf), vld1q_u8(new_buf));
+    uint8x8_t mask = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
 
-static int (*accel_func)(uint8_t *, uint8_t *, int, uint8_t *, int);
+    return vget_lane_u64(vreinterpret_u64_u8(mask), 0);
+}
 
-static void __attribute__((constructor)) init_accel(void)
+static inline int xbzrle_skip_same_neon(const uint8_t *old_buf,
+                                        const uint8_t *new_buf,
+                                        int i, int slen)
 {
-    unsigned info = cpuinfo_init();
-    if (info & CPUINFO_AVX512BW) {
-        accel_func = xbzrle_encode_buffer_avx512;
-    } else {
-        accel_func = xbzrle_encode_buffer_int;
+    for (; i + 16 <= slen; i += 16) {
+        uint64_t diff = ~xbzrle_neon_same_mask(old_buf + i, new_buf + i);
+        if (diff) {
+            return i + ctz64(diff) / 4;
+        }
     }
+    return xbzrle_skip_same_tail(old_buf, new_buf, i, slen);
 }
 
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
+static inline int xbzrle_skip_diff_neon(const uint8_t *old_buf,
+                                        const uint8_t *new_buf,
+                                        int i, int slen)
 {
-    return accel_func(old_buf, new_buf, slen, dst, dlen);
+    for (; i + 16 <= slen; i += 16) {
+        uint64_t same = xbzrle_neon_same_mask(old_buf + i, new_buf + i);
+        if (same) {
+            return i + ctz64(same) / 4;
+        }
+    }
+    return xbzrle_skip_diff_tail(old_buf, new_buf, i, slen);
 }
 
-#define xbzrle_encode_buffer xbzrle_encode_buffer_int
-#endif
+static int xbzrle_encode_buffer_neon(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_runs(old_buf, new_buf, slen, dst, dlen,
+                              xbzrle_skip_same_neon, xbzrle_skip_diff_neon);
+}
+#endif /* XBZRLE_NEON */
 
-/*
-  page = zrun nzrun
-       | zrun nzrun page
+typedef int (*xbzrle_accel_fn)(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                               uint8_t *dst, int dlen);
 
-  zrun = length
+/*
+ * Sorted by preference; every entry is usable if the following one is,
+ * so that the tests can walk down the table.
+ */
+static const struct {
+    xbzrle_accel_fn encode;
+    unsigned cpuinfo;
+} accel_table[] = {
+    { xbzrle_encode_buffer_int, 0 },
+#ifdef CONFIG_AVX2_OPT
+    { xbzrle_encode_buffer_avx2, CPUINFO_AVX2 },
+#endif
+#ifdef CONFIG_AVX512BW_OPT
+    { xbzrle_encode_buffer_avx512, CPUINFO_AVX512BW },
+#endif
+#ifdef XBZRLE_NEON
+    { xbzrle_encode_buffer_neon, 0 },
+#endif
+};
 
-  nzrun = length byte...
+static xbzrle_accel_fn encode_accel;
+static unsigned accel_index;
 
-  length = uleb128 encoded integer
- */
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen)
 {
-    uint32_t zrun_len = 0, nzrun_len = 0;
-    int d = 0, i = 0;
-    long res;
-    uint8_t *nzrun_start = NULL;
-
-    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
-               sizeof(long)));
-
-    while (i < slen) {
-        /* overflow */
-        if (d + 2 > dlen) {
-            return -1;
-        }
-
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] == new_buf[i]) {
-            zrun_len++;
-            i++;
-            res--;
-        }
-
-        /* word at a time for speed */
-        if (!res) {
-            while (i < slen &&
-                   (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
-                i += sizeof(long);
-                zrun_len += sizeof(long);
-            }
-
-            /* go over the rest */
-            while (i < slen && old_buf[i] == new_buf[i]) {
-                zrun_len++;
-                i++;
-            }
-        }
-
-        /* buffer unchanged */
-        if (zrun_len == slen) {
-            return 0;
-        }
-
-        /* skip last zero run */
-        if (i == slen) {
-            return d;
-        }
-
-        d += uleb128_encode_small(dst + d, zrun_len);
-
-        zrun_len = 0;
-        nzrun_start = new_buf + i;
+    return encode_accel(old_buf, new_buf, slen, dst, dlen);
+}
 
-        /* overflow */
-        if (d + 2 > dlen) {
-            return -1;
-        }
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] != new_buf[i]) {
-            i++;
-            nzrun_len++;
-            res--;
-        }
+static void __attribute__((constructor)) init_accel(void)
+{
+    unsigned info = xbzrle_cpuinfo();
 
-        /* word at a time for speed, use of 32-bit long okay */
-        if (!res) {
-            /* truncation to 32-bit long okay */
-            unsigned long mask = (unsigned long)0x0101010101010101ULL;
-            while (i < slen) {
-                unsigned long xor;
-                xor = *(unsigned long *)(old_buf + i)
-                    ^ *(unsigned long *)(new_buf + i);
-                if ((xor - mask) & ~xor & (mask << 7)) {
-                    /* found the end of an nzrun within the current long */
-                    while (old_buf[i] != new_buf[i]) {
-                        nzrun_len++;
-                        i++;
-                    }
-                    break;
-                } else {
-                    i += sizeof(long);
-                    nzrun_len += sizeof(long);
-                }
-            }
-        }
+    accel_index = ARRAY_SIZE(accel_table) - 1;
+    while ((accel_table[accel_index].cpuinfo & info) !=
+           accel_table[accel_index].cpuinfo) {
+        accel_index--;
+    }
+    encode_accel = accel_table[accel_index].encode;
+}
 
-        d += uleb128_encode_small(dst + d, nzrun_len);
-        /* overflow */
-        if (d + nzrun_len > dlen) {
-            return -1;
-        }
-        memcpy(dst + d, nzrun_start, nzrun_len);
-        d += nzrun_len;
-        nzrun_len = 0;
+/*
+ * Select the next slower encoder.  Once all of them have been used,
+ * go back to the best one and return false, so that the caller leaves
+ * the selection as it found it.
+ */
+bool xbzrle_test_next_accel(void)
+{
+    if (accel_index != 0) {
+        encode_accel = accel_table[--accel_index].encode;
+        return true;
     }
+    init_accel();
+    return false;
+}
 
-    return d;
+/*
+ * Run lengths are usually shorter than 128 bytes, so avoid the call to
+ * uleb128_decode_small() for them.
+ */
+static inline int xbzrle_decode_length(const uint8_t *in, uint32_t *n)
+{
+    if (likely(!(*in & 0x80))) {
+        *n = *in;
+        return 1;
+    }
+    return uleb128_decode_small(in, n);
 }
 
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
@@ -286,7 +511,7 @@ int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
             return -1;
         }
 
-        ret = uleb128_decode_small(src + i, &count);
+        ret = xbzrle_decode_length(src + i, &count);
         if (ret < 0 || (i && !count)) {
             return -1;
         }
@@ -303,7 +528,7 @@ int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
             return -1;
         }
 
-        ret = uleb128_decode_small(src + i, &count);
+        ret = xbzrle_decode_length(src + i, &count);
         if (ret < 0 || !count) {
             return -1;
         }
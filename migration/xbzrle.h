@@ -19,4 +19,10 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
 
+/*
+ * Select the next slower encoder, for testing.  Returns false, with the
+ * best encoder selected again, once every encoder has been tried.
+ */
+bool xbzrle_test_next_accel(void);
+
 #endif
@@ -202,6 +202,16 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
         monitor_printf(mon, "  aio-max-batch=%" PRId64 "\n",
                        value->aio_max_batch);
+        monitor_printf(mon, "  poll-policy=%s\n",
+                       AioPollPolicy_str(value->poll_policy));
+        monitor_printf(mon, "  poll-budget-ns=%" PRId64 "\n",
+                       value->poll_budget_ns);
+        monitor_printf(mon, "  polled-events=%" PRId64
+                       " notified-events=%" PRId64 "\n",
+                       value->polled_events, value->notified_events);
+        monitor_printf(mon, "  poll-ns=%" PRId64
+                       " poll-wasted-ns=%" PRId64 "\n",
+                       value->poll_ns, value->poll_wasted_ns);
     }
 
     qapi_free_IOThreadInfoList(info_list);
@@ -42,6 +42,20 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * Read payloads smaller than this are copied to the socket even if zero
+ * copy is enabled, because page pinning and completion notification cost
+ * more than the copy.
+ */
+#define NBD_ZERO_COPY_MIN_SIZE (16 * KiB)
+
+/*
+ * Amount of data sent with zero copy whose buffers can be waiting for the
+ * kernel to release them.  Past this, read payloads are copied until the
+ * client catches up.
+ */
+#define NBD_ZERO_COPY_MAX_PENDING (64 * MiB)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -101,6 +115,8 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    bool zero_copy;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -155,8 +171,149 @@ struct NBDClient {
     uint32_t opt; /* Current option being negotiated */
     uint32_t optlen; /* remaining length of data in ioc for the option being
                         negotiated now */
+
+    /*
+     * Zero copy state, only accessed from the export AioContext.
+     * zero_copy_bufs holds the read buffers that may still be referenced
+     * by the kernel, as NBDZeroCopyBuf in the order they were queued.
+     * zero_copy_failed is set when zero copy stopped paying off, because
+     * the kernel refused a write or copied the payload anyway.
+     */
+    bool zero_copy_checked;
+    bool zero_copy_failed;
+    GQueue zero_copy_bufs;
+    size_t zero_copy_pending;
 };
 
+typedef struct NBDZeroCopyBuf {
+    uint8_t *data;
+    uint64_t len;
+    /* Freed once this many zero copy writes have completed */
+    ssize_t seq;
+} NBDZeroCopyBuf;
+
+static void nbd_zero_copy_buf_free(gpointer opaque)
+{
+    NBDZeroCopyBuf *buf = opaque;
+
+    qemu_vfree(buf->data);
+    g_free(buf);
+}
+
+/*
+ * Process the zero copy completions that are available on @sioc and free
+ * the buffers in @bufs that the kernel is done with.  Returns the number
+ * of bytes freed, or -1 if the socket failed.
+ */
+static int64_t nbd_zero_copy_reap(QIOChannelSocket *sioc, GQueue *bufs,
+                                  Error **errp)
+{
+    NBDZeroCopyBuf *buf;
+    int64_t freed = 0;
+
+    if (qio_channel_socket_poll_zero_copy(sioc, errp) < 0) {
+        return -1;
+    }
+
+    while ((buf = g_queue_peek_head(bufs)) &&
+           buf->seq <= sioc->zero_copy_sent) {
+        g_queue_pop_head(bufs);
+        freed += buf->len;
+        nbd_zero_copy_buf_free(buf);
+    }
+    return freed;
+}
+
+/*
+ * Read buffers left by a closed client.  The kernel keeps sending the
+ * data queued on a socket after it is closed, so they must live until
+ * their zero copy writes complete or the connection fails.
+ */
+typedef struct NBDZeroCopyDrain {
+    QIOChannelSocket *sioc;
+    GQueue bufs;
+} NBDZeroCopyDrain;
+
+static void nbd_zero_copy_drain_free(gpointer opaque)
+{
+    NBDZeroCopyDrain *drain = opaque;
+
+    g_queue_clear_full(&drain->bufs, nbd_zero_copy_buf_free);
+    object_unref(OBJECT(drain->sioc));
+    g_free(drain);
+}
+
+/* Runs in the main loop thread, whenever the socket error queue has data */
+static gboolean nbd_zero_copy_drain_poll(QIOChannel *ioc,
+                                         GIOCondition condition,
+                                         gpointer opaque)
+{
+    NBDZeroCopyDrain *drain = opaque;
+    Error *local_err = NULL;
+
+    if (nbd_zero_copy_reap(drain->sioc, &drain->bufs, &local_err) < 0) {
+        /* The connection failed and the kernel dropped the queued data */
+        trace_nbd_zero_copy_drain_failed(error_get_pretty(local_err));
+        error_free(local_err);
+        return G_SOURCE_REMOVE;
+    }
+    return g_queue_is_empty(&drain->bufs) ? G_SOURCE_REMOVE
+                                          : G_SOURCE_CONTINUE;
+}
+
+/*
+ * Take the read buffers of @client that may still be sent with zero copy,
+ * and free them once the kernel is done with them.
+ */
+static void nbd_client_zero_copy_drain(NBDClient *client)
+{
+    NBDZeroCopyDrain *drain;
+
+    if (g_queue_is_empty(&client->zero_copy_bufs)) {
+        return;
+    }
+
+    drain = g_new0(NBDZeroCopyDrain, 1);
+    drain->sioc = client->sioc;
+    object_ref(OBJECT(drain->sioc));
+    drain->bufs = client->zero_copy_bufs;
+    g_queue_init(&client->zero_copy_bufs);
+
+    trace_nbd_client_zero_copy_drain(client->zero_copy_pending);
+    if (nbd_zero_copy_drain_poll(QIO_CHANNEL(drain->sioc), G_IO_ERR,
+                                 drain) == G_SOURCE_REMOVE) {
+        nbd_zero_copy_drain_free(drain);
+        return;
+    }
+    qio_channel_add_watch(QIO_CHANNEL(drain->sioc), G_IO_ERR,
+                          nbd_zero_copy_drain_poll, drain,
+                          nbd_zero_copy_drain_free);
+}
+
+/*
+ * Free the read buffers of @client whose zero copy writes have completed.
+ * Once the kernel reports that it copied a payload anyway, further
+ * payloads are copied right away and freed with their request, instead
+ * of waiting for a completion.
+ */
+static int nbd_client_zero_copy_reap(NBDClient *client, Error **errp)
+{
+    ssize_t copied = client->sioc->zero_copy_copied;
+    int64_t freed;
+
+    freed = nbd_zero_copy_reap(client->sioc, &client->zero_copy_bufs, errp);
+    if (freed < 0) {
+        return -1;
+    }
+    client->zero_copy_pending -= freed;
+
+    if (client->sioc->zero_copy_copied != copied && !client->zero_copy_failed) {
+        trace_nbd_client_zero_copy_copied();
+        client->zero_copy_failed = true;
+    }
+    return 0;
+}
+
 static void nbd_client_receive_next_request(NBDClient *client);
 
 /* Basic flow for negotiation
@@ -1461,6 +1618,14 @@ nbd_read_eof(NBDClient *client, void *buffer, size_t size, Error **errp)
 
         len = qio_channel_readv(client->ioc, &iov, 1, errp);
         if (len == QIO_CHANNEL_ERR_BLOCK) {
+            /*
+             * Zero copy completions make the socket report POLLERR, which
+             * wakes up a coroutine waiting for G_IO_IN.  Consume them here,
+             * or an idle client would keep this coroutine spinning.
+             */
+            if (nbd_client_zero_copy_reap(client, errp) < 0) {
+                return -EIO;
+            }
             WITH_QEMU_LOCK_GUARD(&client->lock) {
                 client->read_yielding = true;
 
@@ -1570,6 +1735,7 @@ void nbd_client_put(NBDClient *client)
          */
         assert(client->closing);
 
+        nbd_client_zero_copy_drain(client);
         object_unref(OBJECT(client->sioc));
         object_unref(OBJECT(client->ioc));
         if (client->tlscreds) {
@@ -1931,6 +2097,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -2049,6 +2216,127 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Zero copy is only used for plain sockets, where the payload that the
+ * client reads goes unchanged to the wire.  SO_ZEROCOPY is enabled when
+ * a client first reads from an export that asked for zero copy.
+ */
+static bool nbd_client_zero_copy(NBDClient *client)
+{
+    if (!client->exp->zero_copy || client->ioc != QIO_CHANNEL(client->sioc)) {
+        return false;
+    }
+
+    if (!client->zero_copy_checked) {
+        client->zero_copy_checked = true;
+        qio_channel_socket_enable_zero_copy(client->sioc);
+    }
+    return qio_channel_has_feature(client->ioc,
+                                   QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+}
+
+/*
+ * Send @iov with zero copy.  If the kernel refuses, typically with ENOBUFS
+ * because of RLIMIT_MEMLOCK or the socket's optmem limit, send the rest
+ * with a normal copying write and stop using zero copy for this client.
+ * If the connection itself failed, the copying write fails as well.
+ */
+static int coroutine_fn nbd_co_write_zero_copy(NBDClient *client,
+                                               struct iovec *iov,
+                                               Error **errp)
+{
+    struct iovec local = *iov;
+    Error *local_err = NULL;
+    ssize_t len;
+
+    while (local.iov_len) {
+        len = qio_channel_writev_full(client->ioc, &local, 1, NULL, 0,
+                                      QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                      &local_err);
+        if (len == QIO_CHANNEL_ERR_BLOCK) {
+            qio_channel_yield(client->ioc, G_IO_OUT);
+            continue;
+        }
+        if (len < 0) {
+            trace_nbd_co_write_zero_copy_fallback(
+                error_get_pretty(local_err));
+            error_free(local_err);
+            client->zero_copy_failed = true;
+            return qio_channel_writev_all(client->ioc, &local, 1, errp);
+        }
+        local.iov_base = (char *)local.iov_base + len;
+        local.iov_len -= len;
+    }
+
+    return 0;
+}
+
+/*
+ * Like nbd_co_send_iov(), but send the read payload in the last element of
+ * @iov without copying it if the client uses zero copy.  In that case
+ * @request->zero_copy is set, and the caller must keep the payload alive
+ * until nbd_client_zero_copy_release().
+ */
+static int coroutine_fn nbd_co_send_iov_read(NBDClient *client,
+                                             NBDRequest *request,
+                                             struct iovec *iov,
+                                             unsigned niov, Error **errp)
+{
+    int ret;
+
+    if (!nbd_client_zero_copy(client) || client->zero_copy_failed ||
+        client->zero_copy_pending >= NBD_ZERO_COPY_MAX_PENDING ||
+        iov[niov - 1].iov_len < NBD_ZERO_COPY_MIN_SIZE) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    /* The headers live on the stack, so they are always copied */
+    ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+    if (ret == 0) {
+        request->zero_copy = true;
+        ret = nbd_co_write_zero_copy(client, &iov[niov - 1], errp);
+    }
+    ret = ret < 0 ? -EIO : 0;
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret;
+}
+
+/*
+ * Take ownership of a read buffer that was sent with zero copy, and free
+ * the buffers whose zero copy writes have completed.
+ *
+ * This never waits for completions: a slow client must not stall the
+ * export AioContext.  Instead, nbd_co_send_iov_read() copies payloads
+ * while too much data is pending, and the completions are consumed here
+ * and whenever nbd_read_eof() finds nothing to read.
+ */
+static void nbd_client_zero_copy_release(NBDClient *client, uint8_t *data,
+                                         uint64_t len)
+{
+    NBDZeroCopyBuf *buf = g_new(NBDZeroCopyBuf, 1);
+    Error *local_err = NULL;
+
+    buf->data = data;
+    buf->len = len;
+    buf->seq = client->sioc->zero_copy_queued;
+    g_queue_push_tail(&client->zero_copy_bufs, buf);
+    client->zero_copy_pending += len;
+
+    if (nbd_client_zero_copy_reap(client, &local_err) < 0) {
+        /* The connection is unusable, keep the buffers until it is freed */
+        error_report_err(local_err);
+        qio_channel_shutdown(client->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+        return;
+    }
+    trace_nbd_client_zero_copy_release(client->zero_copy_pending);
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2080,7 +2368,7 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_iov_read(client, request, iov, 2, errp);
 }
 
 /*
@@ -2161,7 +2449,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+    return nbd_co_send_iov_read(client, request, iov, 3, errp);
 }
 
 static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
@@ -3154,6 +3442,13 @@ static coroutine_fn void nbd_trip(void *opaque)
     }
 
     qio_channel_set_cork(client->ioc, false);
+
+    /* Even a failed reply may have sent part of the payload */
+    if (request.zero_copy) {
+        nbd_client_zero_copy_release(client, req->data, request.len);
+        req->data = NULL;
+    }
+
     qemu_mutex_lock(&client->lock);
 
     if (ret < 0) {
@@ -359,6 +359,31 @@ void plugin_register_inline_op_on_entry(GArray **arr,
     dyn_cb->inline_insn = inline_cb;
 }
 
+void plugin_register_mem_append(GArray **arr,
+                                enum qemu_plugin_mem_rw rw,
+                                struct qemu_plugin_mem_buffer *buf,
+                                uint32_t tag)
+{
+    static TCGHelperInfo info = {
+        .flags = TCG_CALL_NO_RWG,
+        /*
+         * Match qemu_plugin_vcpu_mem_buffer_drain:
+         *   void (*)(uint32_t, void *)
+         */
+        .typemask = (dh_typemask(void, 0) |
+                     dh_typemask(i32, 1) |
+                     dh_typemask(ptr, 2))
+    };
+
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+    struct qemu_plugin_mem_append_cb append_cb = { .buf = buf,
+                                                   .info = &info,
+                                                   .tag = tag,
+                                                   .rw = rw };
+    dyn_cb->type = PLUGIN_CB_INLINE_MEM_APPEND;
+    dyn_cb->mem_append = append_cb;
+}
+
 void plugin_register_dyn_cb__udata(GArray **arr,
                                    qemu_plugin_vcpu_udata_cb_t cb,
                                    enum qemu_plugin_cb_flags flags,
@@ -593,6 +618,62 @@ void exec_inline_op(enum plugin_dyn_cb_type type,
     }
 }
 
+static uint64_t *plugin_mem_buffer_find(struct qemu_plugin_mem_buffer *buf,
+                                        unsigned int cpu_index)
+{
+    char *ptr = buf->score->data->data;
+    size_t elem_size = g_array_get_element_size(buf->score->data);
+
+    return (uint64_t *)(ptr + cpu_index * elem_size);
+}
+
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+void plugin_mem_buffer_drain(struct qemu_plugin_mem_buffer *buf,
+                             unsigned int cpu_index)
+{
+    uint64_t *count = plugin_mem_buffer_find(buf, cpu_index);
+
+    if (*count) {
+        buf->cb(cpu_index, (qemu_plugin_mem_record *)(count + 2), *count,
+                buf->userdata);
+        *count = 0;
+    }
+}
+
+uint64_t plugin_mem_buffer_dropped(struct qemu_plugin_mem_buffer *buf,
+                                   unsigned int cpu_index)
+{
+    return plugin_mem_buffer_find(buf, cpu_index)[1];
+}
+
+void qemu_plugin_vcpu_mem_buffer_drain(uint32_t cpu_index, void *buf)
+{
+    plugin_mem_buffer_drain(buf, cpu_index);
+}
+
+/* Out of line version of the code generated for PLUGIN_CB_INLINE_MEM_APPEND */
+static void exec_mem_append(struct qemu_plugin_mem_append_cb *cb,
+                            int cpu_index, qemu_plugin_meminfo_t info,
+                            uint64_t vaddr)
+{
+    uint64_t *count = plugin_mem_buffer_find(cb->buf, cpu_index);
+    qemu_plugin_mem_record *rec;
+
+    if (*count >= cb->buf->nr_records) {
+        plugin_mem_buffer_drain(cb->buf, cpu_index);
+    }
+    rec = (qemu_plugin_mem_record *)(count + 2) + *count;
+    rec->vaddr = vaddr;
+    rec->info = info;
+    rec->tag = cb->tag;
+    ++*count;
+}
+
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                              uint64_t value_low,
                              uint64_t value_high,
@@ -626,6 +707,12 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                 exec_inline_op(cb->type, &cb->inline_insn, cpu->cpu_index);
             }
             break;
+        case PLUGIN_CB_INLINE_MEM_APPEND:
+            if (rw & cb->mem_append.rw) {
+                exec_mem_append(&cb->mem_append, cpu->cpu_index,
+                                make_plugin_meminfo(oi, rw), vaddr);
+            }
+            break;
         default:
             g_assert_not_reached();
         }
@@ -751,6 +838,34 @@ struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
     return score;
 }
 
+struct qemu_plugin_mem_buffer *
+plugin_mem_buffer_new(size_t nr_records,
+                      qemu_plugin_vcpu_mem_buffer_cb_t cb, void *userdata)
+{
+    struct qemu_plugin_mem_buffer *buf;
+    size_t size;
+
+    /* plugin-gen.c computes record addresses with a shift */
+    QEMU_BUILD_BUG_ON(sizeof(qemu_plugin_mem_record) != 16);
+    g_assert(nr_records > 0);
+
+    /* One more record for the accesses that are dropped */
+    size = 2 * sizeof(uint64_t) +
+           (nr_records + 1) * sizeof(qemu_plugin_mem_record);
+    buf = g_new0(struct qemu_plugin_mem_buffer, 1);
+    buf->nr_records = nr_records;
+    buf->cb = cb;
+    buf->userdata = userdata;
+    buf->score = plugin_scoreboard_new(size);
+    return buf;
+}
+
+void plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf)
+{
+    plugin_scoreboard_free(buf->score);
+    g_free(buf);
+}
+
 void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
 {
     qemu_rec_mutex_lock(&plugin.lock);
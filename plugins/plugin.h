@@ -75,6 +75,11 @@ void plugin_register_inline_op_on_entry(GArray **arr,
                                         qemu_plugin_u64 entry,
                                         uint64_t imm);
 
+void plugin_register_mem_append(GArray **arr,
+                                enum qemu_plugin_mem_rw rw,
+                                struct qemu_plugin_mem_buffer *buf,
+                                uint32_t tag);
+
 void plugin_reset_uninstall(qemu_plugin_id_t id,
                             qemu_plugin_simple_cb_t cb,
                             bool reset);
@@ -119,6 +124,18 @@ struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size);
 
 void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
 
+struct qemu_plugin_mem_buffer *
+plugin_mem_buffer_new(size_t nr_records,
+                      qemu_plugin_vcpu_mem_buffer_cb_t cb, void *userdata);
+
+void plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf);
+
+void plugin_mem_buffer_drain(struct qemu_plugin_mem_buffer *buf,
+                             unsigned int cpu_index);
+
+uint64_t plugin_mem_buffer_dropped(struct qemu_plugin_mem_buffer *buf,
+                                   unsigned int cpu_index);
+
 /**
  * qemu_plugin_fillin_mode_info() - populate mode specific info
  * info: pointer to qemu_info_t structure
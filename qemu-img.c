@@ -1229,6 +1229,35 @@ static int is_allocated_sectors(const uint8_t *buf, int n, int *pnum,
     return !is_zero;
 }
 
+/*
+ * Returns true if the first cluster of buf is not all zeroes, false
+ * otherwise. The number of sectors of the following clusters (in units of
+ * cluster_sectors, the last one may be short) that have the same status is
+ * stored in *pnum.
+ */
+static bool is_allocated_clusters(const uint8_t *buf, int n, int *pnum,
+                                  int cluster_sectors)
+{
+    bool is_zero;
+    int i, len;
+
+    if (n <= 0) {
+        *pnum = 0;
+        return false;
+    }
+    is_zero = buffer_is_zero(buf, MIN(n, cluster_sectors) * BDRV_SECTOR_SIZE);
+    for (i = cluster_sectors; i < n; i += cluster_sectors) {
+        len = MIN(n - i, cluster_sectors);
+        if (is_zero != buffer_is_zero(buf + i * BDRV_SECTOR_SIZE,
+                                      len * BDRV_SECTOR_SIZE)) {
+            break;
+        }
+    }
+
+    *pnum = MIN(i, n);
+    return !is_zero;
+}
+
 /*
  * Like is_allocated_sectors, but if the buffer starts with a used sector,
  * up to 'min' consecutive sectors containing zeros are ignored. This avoids
@@ -1682,6 +1711,7 @@ typedef struct ImgConvertState {
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
+    bool compressed_multi_cluster;
     bool target_is_new;
     bool target_has_backing;
     int64_t target_backing_sectors; /* negative if unknown */
@@ -1897,14 +1927,14 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * is real non-zero data, we must write it. Otherwise we can treat
              * it as zero sectors.
              * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
+             * case we can only save the write for completely zeroed
+             * clusters. */
             if (!s->min_sparse ||
                 (!s->compressed &&
                  is_allocated_sectors_min(buf, n, &n, s->min_sparse,
                                           sector_num, s->alignment)) ||
                 (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                 is_allocated_clusters(buf, n, &n, s->cluster_sectors)))
             {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
@@ -2105,14 +2135,24 @@ static int convert_do_copy(ImgConvertState *s)
         bdrv_graph_rdunlock_main_loop();
     }
 
-    /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+    /*
+     * Allocate buffer for copied data. For compressed images, only one cluster
+     * can be copied at a time, unless the driver accepts compressed writes
+     * spanning multiple clusters. It then compresses them in parallel while
+     * keeping the allocation in request order, so the output stays the same
+     * as with single-cluster writes.
+     */
     if (s->compressed) {
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
             return -EINVAL;
         }
-        s->buf_sectors = s->cluster_sectors;
+        if (s->compressed_multi_cluster) {
+            s->buf_sectors = QEMU_ALIGN_DOWN(s->buf_sectors,
+                                             s->cluster_sectors);
+        } else {
+            s->buf_sectors = s->cluster_sectors;
+        }
     }
 
     while (sector_num < s->total_sectors) {
@@ -2776,6 +2816,7 @@ static int img_convert(int argc, char **argv)
         }
     } else {
         s.compressed = s.compressed || bdi.needs_compressed_writes;
+        s.compressed_multi_cluster = bdi.multi_cluster_compressed_writes;
         s.cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
     }
 
@@ -229,6 +229,7 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-reapers=n (threads harvesting the KVM dirty rings, default 8)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n"
@@ -289,6 +290,11 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-ring-reapers=n``
+        When the KVM dirty ring is used, it sets the maximum number of
+        threads that harvest the rings concurrently.  One thread is used
+        for every 32 vCPUs, up to this limit.  Defaults to 8.
+
     ``eager-split-size=n``
         KVM implements dirty page logging at the PAGE_SIZE granularity and
         enabling dirty-logging on a huge-page requires breaking it into
@@ -5345,6 +5351,16 @@ SRST
     Generate a dump file for Linux perf tools that maps basic blocks to symbol
     names, line numbers and JITted code.
 ERST
+
+DEF("tbprof", 0, QEMU_OPTION_tbprof,
+    "-tbprof         count block executions in /tmp/qemu-tbprof-${pid}\n",
+    QEMU_ARCH_ALL)
+SRST
+``-tbprof``
+    Count the executions and translations of each guest basic block in a
+    shared memory file that can be read while QEMU runs.  The file format
+    is described in ``include/tcg/perf.h``.
+ERST
 #endif
 
 DEFHEADING()
@@ -6097,7 +6113,7 @@ SRST
 
             CN=laptop.example.com,O=Example Home,L=London,ST=London,C=GB
 
-    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,aio-max-batch=aio-max-batch``
+    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,poll-policy=adaptive|latency,poll-budget-ns=poll-budget-ns,aio-max-batch=aio-max-batch``
         Creates a dedicated event loop thread that devices can be
         assigned to. This is known as an IOThread. By default device
         emulation happens in vCPU threads or the main event loop thread.
@@ -6133,6 +6149,20 @@ SRST
         the polling time when the algorithm detects it is spending too
         long polling without encountering events.
 
+        The ``poll-policy`` parameter selects how the polling time is
+        chosen. ``adaptive`` (the default) uses ``poll-grow`` and
+        ``poll-shrink`` as described above. ``latency`` learns the time
+        between events of each file descriptor, and only polls when the
+        next event is expected within ``poll-max-ns``; this reacts faster
+        to bursts and stops spinning sooner when the device goes idle.
+
+        The ``poll-budget-ns`` parameter limits how many nanoseconds of
+        each second the IOThread may spend polling, whatever the policy.
+        It lets dense hosts trade some latency for CPU time. 0, the
+        default, means no limit. ``query-iothreads`` reports how many
+        events were found by polling rather than by waking up, and how
+        much polling time did not find any event.
+
         The ``aio-max-batch`` parameter is the maximum number of requests
         in a batch for the AIO engine, 0 means that the engine will use
         its default.
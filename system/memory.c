@@ -22,6 +22,7 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/qemu-print.h"
+#include "qemu/units.h"
 #include "qom/object.h"
 #include "trace.h"
 #include "system/ram_addr.h"
@@ -49,6 +50,8 @@ static QTAILQ_HEAD(, AddressSpace) address_spaces
     = QTAILQ_HEAD_INITIALIZER(address_spaces);
 
 static GHashTable *flat_views;
+/* The views in flat_views, looked up by their ranges to share them */
+static GHashTable *flat_view_shapes;
 
 typedef struct AddrRange AddrRange;
 
@@ -740,11 +743,60 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
-/* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+/*
+ * Return true if @a and @b have the same ranges, including their dirty
+ * logging state, so that listeners would not see any difference.
+ */
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i]) ||
+            a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static guint flatview_hash(gconstpointer key)
+{
+    const FlatView *view = key;
+    uint64_t h = view->nr;
+    unsigned i;
+
+    for (i = 0; i < view->nr; i++) {
+        const FlatRange *fr = &view->ranges[i];
+
+        h = h * 31 + (uintptr_t)fr->mr;
+        h = h * 31 + int128_getlo(fr->addr.start);
+        h = h * 31 + fr->offset_in_region;
+    }
+    return h ^ (h >> 32);
+}
+
+static gboolean flatview_shape_equal(gconstpointer a, gconstpointer b)
+{
+    return flatview_equal((FlatView *)a, (FlatView *)b);
+}
+
+/*
+ * Render a memory topology into a list of disjoint absolute ranges.
+ *
+ * If the result is the same as @old_view, the view that was previously
+ * rendered for @mr, @old_view is reused instead together with its
+ * dispatch tree.  Otherwise, if another root of this generation rendered
+ * to the same ranges (for example the bus master address spaces of all
+ * devices behind the same IOMMU domain), that view is shared.
+ */
+static FlatView *generate_memory_topology(MemoryRegion *mr, FlatView *old_view)
 {
     int i;
-    FlatView *view;
+    FlatView *view, *shared;
 
     view = flatview_new(mr);
 
@@ -755,6 +807,26 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     flatview_simplify(view);
 
+    /*
+     * Only carry over old views that were rendered for @mr itself: a view
+     * shared from another root keeps that root alive, which must not
+     * outlast the generation in which the other root went away.
+     */
+    shared = g_hash_table_lookup(flat_view_shapes, view);
+    if (!shared && old_view && old_view->root == mr &&
+        flatview_equal(old_view, view)) {
+        shared = old_view;
+    }
+    if (shared) {
+        /* Never published, so it can go away right now */
+        flatview_destroy(view);
+        trace_flatview_reuse(shared, mr);
+        flatview_ref(shared);
+        g_hash_table_replace(flat_views, mr, shared);
+        g_hash_table_add(flat_view_shapes, shared);
+        return shared;
+    }
+
     view->dispatch = address_space_dispatch_new(view);
     for (i = 0; i < view->nr; i++) {
         MemoryRegionSection mrs =
@@ -763,6 +835,7 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     address_space_dispatch_compact(view->dispatch);
     g_hash_table_replace(flat_views, mr, view);
+    g_hash_table_add(flat_view_shapes, view);
 
     return view;
 }
@@ -1043,35 +1116,52 @@ static void flatviews_init(void)
 
     flat_views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
                                        (GDestroyNotify) flatview_unref);
+    /* No references of its own, every view in it is also in flat_views */
+    flat_view_shapes = g_hash_table_new(flatview_hash, flatview_shape_equal);
     if (!empty_view) {
-        empty_view = generate_memory_topology(NULL);
+        empty_view = generate_memory_topology(NULL, NULL);
         /* We keep it alive forever in the global variable.  */
         flatview_ref(empty_view);
     } else {
         g_hash_table_replace(flat_views, NULL, empty_view);
+        g_hash_table_add(flat_view_shapes, empty_view);
         flatview_ref(empty_view);
     }
 }
 
 static void flatviews_reset(void)
 {
+    GHashTable *old_flat_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
+    if (flat_view_shapes) {
+        g_hash_table_unref(flat_view_shapes);
     }
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
+    /*
+     * Render unique FVs.  Views that did not change are carried over
+     * from the previous table, so that only the address spaces affected
+     * by the transaction rebuild their dispatch tree, and roots that
+     * render to the same ranges share one view.
+     */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *old_view = NULL;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
-        generate_memory_topology(physmr);
+        if (old_flat_views) {
+            old_view = g_hash_table_lookup(old_flat_views, physmr);
+        }
+        generate_memory_topology(physmr, old_view);
+    }
+
+    if (old_flat_views) {
+        g_hash_table_unref(old_flat_views);
     }
 }
 
@@ -1084,6 +1174,14 @@ static void address_space_set_flatview(AddressSpace *as)
     assert(new_view);
 
     if (old_view == new_view) {
+        /*
+         * The view was reused because the transaction did not change it.
+         * Listeners still expect to hear about every section between
+         * begin and commit.
+         */
+        if (!QTAILQ_EMPTY(&as->listeners)) {
+            address_space_update_topology_pass(as, new_view, new_view, true);
+        }
         return;
     }
 
@@ -1126,7 +1224,7 @@ static void address_space_update_topology(AddressSpace *as)
 
     flatviews_init();
     if (!g_hash_table_lookup(flat_views, physmr)) {
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr, NULL);
     }
     address_space_set_flatview(as);
 }
@@ -3449,8 +3547,24 @@ struct FlatViewInfo {
     bool dispatch_tree;
     bool owner;
     AccelClass *ac;
+    unsigned nr_as;
+    size_t size;
+    size_t unshared_size;
 };
 
+/* Approximate heap footprint of @view, including its dispatch tree */
+static size_t flatview_size(FlatView *view)
+{
+    size_t size = sizeof(*view) + view->nr_allocated * sizeof(FlatRange);
+
+#if !defined(CONFIG_USER_ONLY)
+    if (view->dispatch) {
+        size += address_space_dispatch_size(view->dispatch);
+    }
+#endif
+    return size;
+}
+
 static void mtree_print_flatview(gpointer key, gpointer value,
                                  gpointer user_data)
 {
@@ -3462,9 +3576,13 @@ static void mtree_print_flatview(gpointer key, gpointer value,
     int n = view->nr;
     int i;
     AddressSpace *as;
+    size_t size = flatview_size(view);
 
     qemu_printf("FlatView #%d\n", fvi->counter);
     ++fvi->counter;
+    fvi->nr_as += fv_address_spaces->len;
+    fvi->size += size;
+    fvi->unshared_size += size * fv_address_spaces->len;
 
     for (i = 0; i < fv_address_spaces->len; ++i) {
         as = g_array_index(fv_address_spaces, AddressSpace*, i);
@@ -3579,6 +3697,13 @@ static void mtree_info_flatview(bool dispatch_tree, bool owner)
 
     /* Print */
     g_hash_table_foreach(views, mtree_print_flatview, &fvi);
+    if (fvi.counter) {
+        qemu_printf("%u address spaces, %d FlatViews (%.1f address spaces "
+                    "per view), %zu KiB used, %zu KiB without sharing\n",
+                    fvi.nr_as, fvi.counter, (double)fvi.nr_as / fvi.counter,
+                    (size_t)DIV_ROUND_UP(fvi.size, KiB),
+                    (size_t)DIV_ROUND_UP(fvi.unshared_size, KiB));
+    }
 
     /* Free */
     g_hash_table_foreach_remove(views, mtree_info_flatview_free, 0);
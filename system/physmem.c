@@ -2716,6 +2716,22 @@ void address_space_dispatch_free(AddressSpaceDispatch *d)
     g_free(d);
 }
 
+/* Approximate heap footprint of @d, for "info mtree -f" */
+size_t address_space_dispatch_size(AddressSpaceDispatch *d)
+{
+    size_t size = sizeof(*d);
+    unsigned i;
+
+    size += d->map.nodes_nb_alloc * sizeof(Node);
+    size += d->map.sections_nb_alloc * sizeof(MemoryRegionSection);
+    for (i = 0; i < d->map.sections_nb; i++) {
+        if (d->map.sections[i].mr->subpage) {
+            size += sizeof(subpage_t) + TARGET_PAGE_SIZE * sizeof(uint16_t);
+        }
+    }
+    return size;
+}
+
 static void do_nothing(CPUState *cpu, run_on_cpu_data d)
 {
 }
@@ -3141,6 +3141,9 @@ void qemu_init(int argc, char **argv)
             case QEMU_OPTION_jitdump:
                 perf_enable_jitdump();
                 break;
+            case QEMU_OPTION_tbprof:
+                perf_enable_tbprof();
+                break;
 #endif
             case QEMU_OPTION_seed:
                 qemu_guest_random_seed_main(optarg, &error_fatal);
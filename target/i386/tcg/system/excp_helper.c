@@ -41,6 +41,8 @@ typedef struct TranslateResult {
     hwaddr paddr;
     int prot;
     int page_size;
+    /* The whole of @page_size is mapped contiguously with @prot. */
+    bool uniform;
 } TranslateResult;
 
 typedef enum TranslateFaultStage2 {
@@ -157,6 +159,7 @@ static bool mmu_translate(CPUX86State *env, const TranslateParams *in,
     hwaddr pte_addr, paddr;
     uint32_t pkr;
     int page_size;
+    bool uniform = true;
     int error_code;
     int prot;
 
@@ -474,8 +477,10 @@ do_check_protect_pse36:
 
         /*
          * Use the larger of stage1 & stage2 page sizes, so that
-         * invalidation works.
+         * invalidation works.  Only pages of the same size on both
+         * stages describe one uniform mapping.
          */
+        uniform = nested_page_size == page_size;
         if (nested_page_size > page_size) {
             page_size = nested_page_size;
         }
@@ -484,6 +489,8 @@ do_check_protect_pse36:
     out->paddr = paddr & x86_get_a20_mask(env);
     out->prot = prot;
     out->page_size = page_size;
+    /* With A20 masked, bit 20 of a large page does not change paddr. */
+    out->uniform = uniform && x86_get_a20_mask(env) == -1;
     return true;
 
  do_fault_rsvd:
@@ -607,6 +614,7 @@ static bool get_physical_address(CPUX86State *env, vaddr addr,
     out->paddr = addr & x86_get_a20_mask(env);
     out->prot = PAGE_READ | PAGE_WRITE | PAGE_EXEC;
     out->page_size = TARGET_PAGE_SIZE;
+    out->uniform = false;
     return true;
 }
 
@@ -624,11 +632,16 @@ bool x86_cpu_tlb_fill(CPUState *cs, vaddr addr, int size,
          * Even if 4MB pages, we map only one 4KB page in the cache to
          * avoid filling it too fast.
          */
+        CPUTLBEntryFull full = {
+            .phys_addr = out.paddr & TARGET_PAGE_MASK,
+            .attrs = cpu_get_mem_attrs(env),
+            .prot = out.prot,
+            .lg_page_size = ctz32(out.page_size),
+            .lg_page_uniform = out.uniform,
+        };
+
         assert(out.prot & (1 << access_type));
-        tlb_set_page_with_attrs(cs, addr & TARGET_PAGE_MASK,
-                                out.paddr & TARGET_PAGE_MASK,
-                                cpu_get_mem_attrs(env),
-                                out.prot, mmu_idx, out.page_size);
+        tlb_set_page_full(cs, mmu_idx, addr & TARGET_PAGE_MASK, &full);
         return true;
     }
 
@@ -13,21 +13,28 @@
 #include "exec/target_page.h"
 #include "exec/translation-block.h"
 #include "qemu/timer.h"
+#include "qemu/thread.h"
+#include "qemu/xxhash.h"
 #include "tcg/debuginfo.h"
 #include "tcg/perf.h"
 #include "tcg/tcg.h"
 
+static int safe_open_w(const char *path)
+{
+    /* Delete the old file, if any. */
+    unlink(path);
+
+    /* Avoid symlink attacks by using O_CREAT | O_EXCL. */
+    return open(path, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+}
+
 static FILE *safe_fopen_w(const char *path)
 {
     int saved_errno;
     FILE *f;
     int fd;
 
-    /* Delete the old file, if any. */
-    unlink(path);
-
-    /* Avoid symlink attacks by using O_CREAT | O_EXCL. */
-    fd = open(path, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    fd = safe_open_w(path);
     if (fd == -1) {
         return NULL;
     }
@@ -309,6 +316,156 @@ static void write_jr_code_load(const void *start, uint16_t host_size,
     fwrite(start, host_size, 1, jitdump);
 }
 
+/*
+ * Never unmapped: generated code may increment the counters until the
+ * very end, and the file stays behind for the final counts.
+ */
+static TBProfHeader *tbprof;
+static QemuMutex tbprof_lock;
+/* The slot returned to this thread by the last perf_tbprof_counter(). */
+static __thread TBProfSlot *tbprof_cur;
+
+#define TBPROF_SLOTS_BITS 16
+#define TBPROF_PROBES 16
+
+void perf_enable_tbprof(void)
+{
+    char tbprof_file[32];
+    TBProfSlot *slots;
+    size_t size;
+    void *p;
+    int fd;
+
+    snprintf(tbprof_file, sizeof(tbprof_file), "/tmp/qemu-tbprof-%d",
+             getpid());
+    fd = safe_open_w(tbprof_file);
+    if (fd == -1) {
+        warn_report("Could not open %s: %s, proceeding without tbprof",
+                    tbprof_file, strerror(errno));
+        return;
+    }
+
+    size = sizeof(TBProfHeader) + (sizeof(TBProfSlot) << TBPROF_SLOTS_BITS);
+    if (ftruncate(fd, size) == -1) {
+        warn_report("Could not resize %s: %s, proceeding without tbprof",
+                    tbprof_file, strerror(errno));
+        close(fd);
+        return;
+    }
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        warn_report("Could not map %s: %s, proceeding without tbprof",
+                    tbprof_file, strerror(errno));
+        return;
+    }
+
+    qemu_mutex_init(&tbprof_lock);
+    tbprof = p;
+    tbprof->version = TBPROF_VERSION;
+    tbprof->nr_slots = 1 << TBPROF_SLOTS_BITS;
+    tbprof->slot_size = sizeof(TBProfSlot);
+
+    slots = (TBProfSlot *)(tbprof + 1);
+    slots[0].pc = -1;
+    slots[0].phys_pc = -1;
+    slots[0].in_use = 1;
+    tbprof->used_slots = 1;
+
+    smp_wmb();
+    tbprof->magic = TBPROF_MAGIC;
+}
+
+/* Called with tbprof_lock held.  */
+static TBProfSlot *tbprof_find(uint64_t guest_pc, uint64_t phys_pc,
+                               bool alloc)
+{
+    TBProfSlot *slots = (TBProfSlot *)(tbprof + 1);
+    uint32_t mask = tbprof->nr_slots - 1;
+    uint32_t h = qemu_xxhash4(guest_pc, phys_pc);
+    int i;
+
+    for (i = 0; i < TBPROF_PROBES; i++) {
+        TBProfSlot *slot = &slots[(h + i) & mask];
+
+        if (!slot->in_use) {
+            if (!alloc) {
+                return NULL;
+            }
+            slot->pc = guest_pc;
+            slot->phys_pc = phys_pc;
+            smp_wmb();
+            slot->in_use = 1;
+            tbprof->used_slots++;
+            return slot;
+        }
+        if (slot != &slots[0] &&
+            slot->pc == guest_pc && slot->phys_pc == phys_pc) {
+            return slot;
+        }
+    }
+    return alloc ? &slots[0] : NULL;
+}
+
+uint64_t *perf_tbprof_counter(uint64_t guest_pc, uint64_t phys_pc)
+{
+    TBProfSlot *slot;
+
+    if (!tbprof) {
+        return NULL;
+    }
+
+    qemu_mutex_lock(&tbprof_lock);
+    slot = tbprof_find(guest_pc, phys_pc, true);
+    qemu_mutex_unlock(&tbprof_lock);
+
+    tbprof_cur = slot;
+    return &slot->exec_count;
+}
+
+/*
+ * Count the translation once it has succeeded; perf_tbprof_counter()
+ * may be called several times for one block when code generation has
+ * to be restarted.
+ */
+static void tbprof_report_code(TranslationBlock *tb)
+{
+    TBProfSlot *slot = tbprof_cur;
+
+    tbprof_cur = NULL;
+    if (!slot) {
+        return;
+    }
+
+    qemu_mutex_lock(&tbprof_lock);
+    slot->translations++;
+    slot->icount = tb->icount;
+    tbprof->translations++;
+    if (slot == (TBProfSlot *)(tbprof + 1)) {
+        tbprof->dropped++;
+    }
+    qemu_mutex_unlock(&tbprof_lock);
+}
+
+void perf_report_io_recompile(uint64_t guest_pc, uint64_t phys_pc)
+{
+    TBProfSlot *slot;
+
+    if (!tbprof) {
+        return;
+    }
+
+    qemu_mutex_lock(&tbprof_lock);
+    tbprof->io_recompiles++;
+    if (guest_pc != -1) {
+        slot = tbprof_find(guest_pc, phys_pc, false);
+        if (slot) {
+            slot->io_recompiles++;
+        }
+    }
+    qemu_mutex_unlock(&tbprof_lock);
+}
+
 void perf_report_code(uint64_t guest_pc, TranslationBlock *tb,
                       const void *start)
 {
@@ -316,6 +473,8 @@ void perf_report_code(uint64_t guest_pc, TranslationBlock *tb,
     size_t insn;
     uint64_t *gen_insn_data;
 
+    tbprof_report_code(tb);
+
     if (!perfmap && !jitdump) {
         return;
     }
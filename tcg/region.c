@@ -72,6 +72,19 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+
+    /*
+     * Once every region has been handed out, code-buffer pressure is
+     * relieved by evicting the oldest region instead of flushing them all.
+     * @order lists the regions handed out since the last flush, oldest
+     * first; @free holds evicted regions that can be handed out again.
+     * @size_full is what each region contributed to @agg_size_full.
+     */
+    size_t *order;
+    size_t n_order;
+    size_t *free;
+    size_t n_free;
+    size_t *size_full;
 };
 
 static struct tcg_region_state region;
@@ -191,10 +204,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* Return the index of the region containing @p, a pointer into the rw buffer */
+static size_t tcg_region_index(const void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
+
+    if (p < region.start_aligned) {
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
+    }
+    return offset / region.stride;
+}
 
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -206,18 +232,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
         }
     }
 
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tcg_region_index(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -359,11 +374,17 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t curr_region;
+
+    if (region.current < region.n) {
+        curr_region = region.current++;
+    } else if (region.n_free) {
+        curr_region = region.free[--region.n_free];
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, curr_region);
+    region.order[region.n_order++] = curr_region;
     return false;
 }
 
@@ -374,12 +395,14 @@ static bool tcg_region_alloc__locked(TCGContext *s)
 bool tcg_region_alloc(TCGContext *s)
 {
     bool err;
-    /* read the region size now; alloc__locked will overwrite it on success */
+    /* read the region now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t full_region = tcg_region_index(s->code_gen_buffer);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
+        region.size_full[full_region] = size_full - TCG_HIGHWATER;
         region.agg_size_full += size_full - TCG_HIGHWATER;
     }
     qemu_mutex_unlock(&region.lock);
@@ -412,6 +435,9 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.n_order = 0;
+    region.n_free = 0;
+    memset(region.size_full, 0, region.n * sizeof(*region.size_full));
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -422,30 +448,121 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+/* Returns true if a region is free, e.g. because it has just been evicted */
+bool tcg_region_has_free(void)
+{
+    bool ret;
+
+    qemu_mutex_lock(&region.lock);
+    ret = region.current < region.n || region.n_free;
+    qemu_mutex_unlock(&region.lock);
+    return ret;
+}
+
+static bool tcg_region_in_use__locked(size_t curr_region)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    unsigned int i;
+
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+        if (tcg_region_index(s->code_gen_buffer) == curr_region) {
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct TCGRegionEvictData {
+    void (*invalidate)(TranslationBlock *tb);
+    size_t nb_tbs;
+} TCGRegionEvictData;
+
+static gboolean tcg_region_evict_iter(gpointer key, gpointer value,
+                                      gpointer data)
+{
+    TCGRegionEvictData *d = data;
+
+    d->invalidate(value);
+    d->nb_tbs++;
+    return false;
+}
+
+/*
+ * Evict the oldest region that no TCGContext is generating code into:
+ * call @invalidate on each of its TBs, then make it available to
+ * tcg_region_alloc() again.  Returns the number of TBs that were in the
+ * region, or -1 if no region could be evicted.
+ *
+ * Call from a safe-work context.
+ */
+ssize_t tcg_region_evict(void (*invalidate)(TranslationBlock *tb))
+{
+    TCGRegionEvictData data = { .invalidate = invalidate };
+    struct tcg_region_tree *rt;
+    size_t curr_region;
+    size_t i;
+
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < region.n_order; i++) {
+        if (!tcg_region_in_use__locked(region.order[i])) {
+            break;
+        }
+    }
+    if (i == region.n_order) {
+        qemu_mutex_unlock(&region.lock);
+        return -1;
+    }
+
+    curr_region = region.order[i];
+    memmove(&region.order[i], &region.order[i + 1],
+            (region.n_order - i - 1) * sizeof(*region.order));
+    region.n_order--;
+
+    rt = region_trees + curr_region * tree_size;
+    qemu_mutex_lock(&rt->lock);
+    q_tree_foreach(rt->tree, tcg_region_evict_iter, &data);
+    /* Increment the refcount first so that destroy acts as a reset */
+    q_tree_ref(rt->tree);
+    q_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    region.agg_size_full -= region.size_full[curr_region];
+    region.size_full[curr_region] = 0;
+    region.free[region.n_free++] = curr_region;
+    qemu_mutex_unlock(&region.lock);
+
+    return data.nb_tbs;
+}
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_threads)
 {
+    size_t n_regions = tb_size / (2 * MiB);
+
 #ifdef CONFIG_USER_ONLY
-    return 1;
+    /*
+     * There is a single TCGContext, but still use a few regions so that
+     * filling the buffer evicts the oldest one instead of flushing it all.
+     */
+    return MAX(MIN(n_regions, 8), 1);
 #else
-    size_t n_regions;
-
     /*
      * It is likely that some vCPUs will translate more code than others,
      * so we first try to set more regions than threads, with those regions
      * being of reasonable size. If that's not possible we make do by evenly
      * dividing the code_gen_buffer among the vCPUs.
      *
-     * Use a single region if all we have is one vCPU thread.
+     * A single vCPU thread still gets a few regions, for eviction's sake.
      */
     if (max_threads == 1) {
-        return 1;
+        return MAX(MIN(n_regions, 8), 1);
     }
 
     /*
      * Try to have more regions than threads, with each region being >= 2 MB.
      * If we can't, then just allocate one region per vCPU thread.
      */
-    n_regions = tb_size / (2 * MiB);
     if (n_regions <= max_threads) {
         return max_threads;
     }
@@ -805,6 +922,9 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_threads)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.order = g_new0(size_t, region.n);
+    region.free = g_new0(size_t, region.n);
+    region.size_full = g_new0(size_t, region.n);
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
@@ -0,0 +1,127 @@
+/*
+ * QEMU hierarchical bitmap speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/hbitmap.h"
+#include "qemu/units.h"
+
+/* 64 TiB disk tracked with 64 KiB granularity */
+#define HBITMAP_BENCH_SIZE      (64 * TiB)
+#define HBITMAP_BENCH_GRAN      16
+
+typedef struct HBitmapBenchData {
+    const char *name;
+    /* Set @len bytes every @stride bytes */
+    uint64_t stride;
+    uint64_t len;
+} HBitmapBenchData;
+
+static const HBitmapBenchData bench_data[] = {
+    /* a handful of writes scattered over the disk */
+    { "sparse", 64 * GiB, 64 * KiB },
+    /* a typical incremental backup */
+    { "medium", 64 * MiB, 1 * MiB },
+    /* most of the disk rewritten */
+    { "dense", 16 * MiB, 15 * MiB },
+};
+
+static HBitmap *alloc_bitmap(const HBitmapBenchData *data, uint64_t offset)
+{
+    HBitmap *hb = hbitmap_alloc(HBITMAP_BENCH_SIZE, HBITMAP_BENCH_GRAN);
+    uint64_t i;
+
+    for (i = offset; i < HBITMAP_BENCH_SIZE; i += data->stride) {
+        hbitmap_set(hb, i, MIN(data->len, HBITMAP_BENCH_SIZE - i));
+    }
+    return hb;
+}
+
+static void bench_merge(const HBitmapBenchData *data)
+{
+    HBitmap *a = alloc_bitmap(data, 0);
+    HBitmap *b = alloc_bitmap(data, data->stride / 2);
+    HBitmap *r = hbitmap_alloc(HBITMAP_BENCH_SIZE, HBITMAP_BENCH_GRAN);
+    uint64_t n;
+
+    n = 0;
+    g_test_timer_start();
+    do {
+        hbitmap_merge(a, b, r);
+        n++;
+    } while (g_test_timer_elapsed() < 0.5);
+    g_test_message("hbitmap_merge:           %-6s %10.0f merges/sec",
+                   data->name, n / g_test_timer_last());
+
+    n = 0;
+    g_test_timer_start();
+    do {
+        hbitmap_merge(a, b, a);
+        n++;
+    } while (g_test_timer_elapsed() < 0.5);
+    g_test_message("hbitmap_merge (inplace): %-6s %10.0f merges/sec",
+                   data->name, n / g_test_timer_last());
+
+    g_assert_cmpint(hbitmap_count(a), ==, hbitmap_count(r));
+    hbitmap_free(a);
+    hbitmap_free(b);
+    hbitmap_free(r);
+}
+
+static void bench_dirty_area(const HBitmapBenchData *data)
+{
+    HBitmap *hb = alloc_bitmap(data, 0);
+    int64_t offset, count;
+    uint64_t n, areas;
+
+    n = 0;
+    g_test_timer_start();
+    do {
+        areas = 0;
+        for (offset = 0;
+             hbitmap_next_dirty_area(hb, offset, HBITMAP_BENCH_SIZE,
+                                     INT64_MAX, &offset, &count);
+             offset += count) {
+            areas++;
+        }
+        n++;
+    } while (g_test_timer_elapsed() < 0.5);
+    g_test_message("hbitmap_next_dirty_area: %-6s %10.0f scans/sec "
+                   "(%" PRIu64 " areas)",
+                   data->name, n / g_test_timer_last(), areas);
+
+    n = 0;
+    g_test_timer_start();
+    do {
+        hbitmap_set(hb, 0, HBITMAP_BENCH_SIZE / 2);
+        hbitmap_reset(hb, 0, HBITMAP_BENCH_SIZE / 2);
+        n++;
+    } while (g_test_timer_elapsed() < 0.5);
+    g_test_message("hbitmap_set/reset half:  %-6s %10.0f pairs/sec",
+                   data->name, n / g_test_timer_last());
+
+    hbitmap_free(hb);
+}
+
+static void test(const void *opaque)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(bench_data); i++) {
+        bench_merge(&bench_data[i]);
+    }
+    g_test_message("%s", "");  /* gnu_printf Werror for simple "" */
+    for (i = 0; i < ARRAY_SIZE(bench_data); i++) {
+        bench_dirty_area(&bench_data[i]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/hbitmap/speed", NULL, test);
+    return g_test_run();
+}
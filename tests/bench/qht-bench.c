@@ -21,6 +21,7 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    size_t cache_rd;
 };
 
 struct thread_info {
@@ -35,6 +36,10 @@ struct thread_info {
     uint64_t seed;
     bool write_op; /* writes alternate between insertions and removals */
     bool resize_down;
+    /* private lookup cache, like a vCPU's tb_jmp_cache in front of the QHT */
+    long **cache;
+    /* first key of this thread's hot set */
+    unsigned long hot_offset;
 } QEMU_ALIGNED(64); /* avoid false sharing among threads */
 
 static struct qht ht;
@@ -66,6 +71,11 @@ static double update_rate; /* 0.0 to 1.0 */
 static uint64_t update_threshold;
 static uint64_t resize_threshold;
 
+static unsigned long cache_size;
+static unsigned long hot_range = DEFAULT_RANGE / 64;
+static double hot_rate; /* 0.0 to 1.0 */
+static uint64_t hot_threshold;
+
 static size_t qht_n_elems = DEFAULT_QHT_N_ELEMS;
 static int qht_mode;
 
@@ -90,6 +100,10 @@ static const char commands_string[] =
     "\n"
     " -u = update rate (0.0 to 100.0), 50/50 split of insertions/removals\n"
     "\n"
+    " -c = per-thread lookup cache entries (will be rounded up to pow2)\n"
+    " -H = hot lookup rate (0.0 to 100.0), lookups in a per-thread hot set\n"
+    " -w = hot set range of keys (will be rounded up to pow2)\n"
+    "\n"
     " -R = enable auto-resize\n"
     " -S = resize rate (0.0 to 100.0)\n"
     " -D = delay (in us) between potential resizes\n"
@@ -156,6 +170,46 @@ static void do_rz(struct thread_info *info)
     g_usleep(resize_delay);
 }
 
+/*
+ * Mimic the two-level TB lookup of MTTCG: each thread first checks its
+ * private cache, indexed by the same hash as the QHT, and only goes to
+ * the shared buckets on a miss.
+ */
+static long *cache_lookup(struct thread_info *info, long *p, uint32_t hash)
+{
+    long **entry = &info->cache[hash & (cache_size - 1)];
+    long *ret;
+
+    ret = qatomic_read(entry);
+    if (ret && is_equal(ret, p)) {
+        info->stats.cache_rd++;
+        return ret;
+    }
+    ret = qht_lookup(&ht, p, hash);
+    if (ret) {
+        qatomic_set(entry, ret);
+    }
+    return ret;
+}
+
+/*
+ * Like tb_jmp_cache_inval_tb(), drop @p from every thread's cache after
+ * its removal.  A concurrent cache_lookup() can still reinstall it; QEMU
+ * catches that with CF_INVALID, here it only skews the hit counts.
+ */
+static void cache_inval(long *p, uint32_t hash)
+{
+    size_t i;
+
+    for (i = 0; i < n_rw_threads; i++) {
+        long **entry = &rw_info[i].cache[hash & (cache_size - 1)];
+
+        if (qatomic_read(entry) == p) {
+            qatomic_set(entry, NULL);
+        }
+    }
+}
+
 static void do_rw(struct thread_info *info)
 {
     struct thread_stats *stats = &info->stats;
@@ -166,9 +220,18 @@ static void do_rw(struct thread_info *info)
     if (r >= update_threshold) {
         bool read;
 
-        p = &keys[r & (lookup_range - 1)];
+        if (xorshift64star(r) - 1 < hot_threshold) {
+            p = &keys[(info->hot_offset + (r & (hot_range - 1))) &
+                      (lookup_range - 1)];
+        } else {
+            p = &keys[r & (lookup_range - 1)];
+        }
         hash = hfunc(*p);
-        read = qht_lookup(&ht, p, hash);
+        if (cache_size) {
+            read = cache_lookup(info, p, hash);
+        } else {
+            read = qht_lookup(&ht, p, hash);
+        }
         if (read) {
             stats->rd++;
         } else {
@@ -195,6 +258,9 @@ static void do_rw(struct thread_info *info)
                 removed = qht_remove(&ht, p, hash);
             }
             if (removed) {
+                if (cache_size) {
+                    cache_inval(p, hash);
+                }
                 stats->rm++;
             } else {
                 stats->not_rm++;
@@ -235,6 +301,9 @@ static void prepare_thread_info(struct thread_info *info, int i)
     info->write_op = true;
     /* the first resize will be down */
     info->resize_down = true;
+    /* spread the hot sets, like vCPUs running different code */
+    info->hot_offset = i * hot_range;
+    info->cache = cache_size ? g_new0(long *, cache_size) : NULL;
 
     memset(&info->stats, 0, sizeof(info->stats));
 }
@@ -286,6 +355,11 @@ static void pr_params(void)
     printf(" initial key range: %zu\n", init_range);
     printf(" lookup range:      %lu\n", lookup_range);
     printf(" update range:      %lu\n", update_range);
+    printf(" lookup cache:      %lu\n", cache_size);
+    if (hot_rate) {
+        printf(" hot lookup rate:   %f%%\n", hot_rate * 100.0);
+        printf(" hot range:         %lu\n", hot_range);
+    }
 }
 
 static void do_threshold(double rate, uint64_t *threshold)
@@ -329,10 +403,12 @@ static void htable_init(void)
 
     /* some sanity checks */
     g_assert_cmpuint(lookup_range, <=, n);
+    hot_range = MIN(hot_range, lookup_range);
 
     /* compute thresholds */
     do_threshold(update_rate, &update_threshold);
     do_threshold(resize_rate, &resize_threshold);
+    do_threshold(hot_rate, &hot_threshold);
 
     if (resize_rate) {
         resize_min = n / 2;
@@ -384,6 +460,8 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 
         s->rz += stats->rz;
         s->not_rz += stats->not_rz;
+
+        s->cache_rd += stats->cache_rd;
     }
 }
 
@@ -406,6 +484,11 @@ static void pr_stats(void)
            (double)s.rd / 1e6,
            (double)s.rd / (s.rd + s.not_rd) * 100,
            (double)(s.rd + s.not_rd) / 1e6);
+    if (cache_size) {
+        printf(" Cached reads:      %.2f M (%.2f%% of reads)\n",
+               (double)s.cache_rd / 1e6,
+               (double)s.cache_rd / (s.rd + s.not_rd) * 100);
+    }
     printf(" Inserted:          %.2f M (%.2f%% of %.2fM)\n",
            (double)s.in / 1e6,
            (double)s.in / (s.in + s.not_in) * 100,
@@ -445,11 +528,14 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:u:");
+        c = getopt(argc, argv, "c:d:D:g:H:k:K:l:hn:N:o:pr:Rs:S:u:w:");
         if (c < 0) {
             break;
         }
         switch (c) {
+        case 'c':
+            cache_size = atol(optarg) ? pow2ceil(atol(optarg)) : 0;
+            break;
         case 'd':
             duration = atoi(optarg);
             break;
@@ -463,6 +549,12 @@ static void parse_args(int argc, char *argv[])
             qht_n_elems = atol(optarg);
             init_size = atol(optarg);
             break;
+        case 'H':
+            hot_rate = atof(optarg) / 100.0;
+            if (hot_rate > 1.0) {
+                hot_rate = 1.0;
+            }
+            break;
         case 'h':
             usage_complete(argc, argv);
             exit(0);
@@ -509,6 +601,9 @@ static void parse_args(int argc, char *argv[])
                 update_rate = 1.0;
             }
             break;
+        case 'w':
+            hot_range = pow2ceil(atol(optarg));
+            break;
         }
     }
 }
@@ -0,0 +1,149 @@
+/*
+ * QEMU XBZRLE encode/decode speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/units.h"
+#include "../migration/xbzrle.h"
+
+#define XBZRLE_PAGE_SIZE 4096
+#define XBZRLE_PAGES 256
+
+typedef struct XbzrleBenchData {
+    const char *name;
+    /* Modify @len bytes every @stride bytes, starting at @offset */
+    int offset;
+    int stride;
+    int len;
+} XbzrleBenchData;
+
+static const XbzrleBenchData bench_data[] = {
+    /* a few counters or pointers updated in a page */
+    { "sparse", 24, 1024, 8 },
+    /* one object rewritten */
+    { "block", 1536, XBZRLE_PAGE_SIZE, 512 },
+    /* every cache line touched */
+    { "dense", 16, 64, 16 },
+};
+
+static void fill_pages(const XbzrleBenchData *data, uint8_t *old_buf,
+                       uint8_t *new_buf)
+{
+    int i, j;
+
+    for (i = 0; i < XBZRLE_PAGE_SIZE * XBZRLE_PAGES; i++) {
+        old_buf[i] = g_test_rand_int_range(0, 256);
+    }
+    memcpy(new_buf, old_buf, XBZRLE_PAGE_SIZE * XBZRLE_PAGES);
+
+    for (i = 0; i < XBZRLE_PAGES; i++) {
+        uint8_t *page = new_buf + i * XBZRLE_PAGE_SIZE;
+
+        for (j = data->offset; j < XBZRLE_PAGE_SIZE; j += data->stride) {
+            int k;
+
+            for (k = j; k < MIN(j + data->len, XBZRLE_PAGE_SIZE); k++) {
+                page[k] = ~page[k];
+            }
+        }
+    }
+}
+
+typedef struct XbzrleBenchPages {
+    uint8_t *old_buf;
+    uint8_t *new_buf;
+    uint8_t *dst;
+    int dlen[XBZRLE_PAGES];
+} XbzrleBenchPages;
+
+static void encode_pages(XbzrleBenchPages *p)
+{
+    int i;
+
+    for (i = 0; i < XBZRLE_PAGES; i++) {
+        p->dlen[i] = xbzrle_encode_buffer(p->old_buf + i * XBZRLE_PAGE_SIZE,
+                                          p->new_buf + i * XBZRLE_PAGE_SIZE,
+                                          XBZRLE_PAGE_SIZE,
+                                          p->dst + i * XBZRLE_PAGE_SIZE,
+                                          XBZRLE_PAGE_SIZE);
+        g_assert(p->dlen[i] >= 0);
+    }
+}
+
+static void decode_pages(XbzrleBenchPages *p)
+{
+    int i;
+
+    for (i = 0; i < XBZRLE_PAGES; i++) {
+        xbzrle_decode_buffer(p->dst + i * XBZRLE_PAGE_SIZE, p->dlen[i],
+                             p->old_buf + i * XBZRLE_PAGE_SIZE,
+                             XBZRLE_PAGE_SIZE);
+    }
+}
+
+static void test(const void *opaque)
+{
+    size_t size = XBZRLE_PAGE_SIZE * XBZRLE_PAGES;
+    XbzrleBenchPages pages[ARRAY_SIZE(bench_data)];
+    int accel_index = 0;
+    double total;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(bench_data); i++) {
+        pages[i].old_buf = g_malloc(size);
+        pages[i].new_buf = g_malloc(size);
+        pages[i].dst = g_malloc(size);
+        fill_pages(&bench_data[i], pages[i].old_buf, pages[i].new_buf);
+    }
+
+    /* The accelerators can only be walked once, so loop over data inside */
+    do {
+        if (accel_index != 0) {
+            g_test_message("%s", "");  /* gnu_printf Werror for simple "" */
+        }
+        for (i = 0; i < ARRAY_SIZE(bench_data); i++) {
+            total = 0.0;
+            g_test_timer_start();
+            do {
+                encode_pages(&pages[i]);
+                total += size;
+            } while (g_test_timer_elapsed() < 0.5);
+
+            total /= MiB;
+            g_test_message("xbzrle_encode_buffer #%d: %-6s %8.0f MB/sec",
+                           accel_index, bench_data[i].name,
+                           total / g_test_timer_last());
+        }
+        accel_index++;
+    } while (xbzrle_test_next_accel());
+
+    g_test_message("%s", "");
+    for (i = 0; i < ARRAY_SIZE(bench_data); i++) {
+        total = 0.0;
+        g_test_timer_start();
+        do {
+            decode_pages(&pages[i]);
+            total += size;
+        } while (g_test_timer_elapsed() < 0.5);
+
+        total /= MiB;
+        g_test_message("xbzrle_decode_buffer:    %-6s %8.0f MB/sec",
+                       bench_data[i].name, total / g_test_timer_last());
+
+        g_assert(memcmp(pages[i].old_buf, pages[i].new_buf, size) == 0);
+        g_free(pages[i].old_buf);
+        g_free(pages[i].new_buf);
+        g_free(pages[i].dst);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/xbzrle/speed", NULL, test);
+    return g_test_run();
+}
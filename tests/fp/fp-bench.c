@@ -78,12 +78,14 @@ static const char * const round_names[] = {
 enum tester {
     TESTER_SOFT,
     TESTER_HOST,
+    TESTER_VEC,
     TESTER_MAX_NR,
 };
 
 static const char * const tester_names[] = {
     [TESTER_SOFT] = "soft",
     [TESTER_HOST] = "host",
+    [TESTER_VEC] = "vec",
     [TESTER_MAX_NR] = NULL,
 };
 
@@ -114,6 +116,9 @@ struct op_desc {
 
 #define DEFAULT_DURATION_SECS 1
 
+/* elements per call for the vec tester, e.g. a 512-bit vector of float32 */
+#define VEC_LEN 16
+
 static uint64_t random_ops[MAX_OPERANDS] = {
     SEED_A, SEED_B, SEED_C,
 };
@@ -423,6 +428,74 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
     }
 }
 
+/* Same as bench(), through the float*_vec functions, VEC_LEN at a time */
+static void bench_vec(enum precision prec, enum op op)
+{
+    int64_t tf = get_clock() + duration * 1000000000LL;
+    static float32 a32[VEC_LEN], b32[VEC_LEN], d32[VEC_LEN];
+    static float64 a64[VEC_LEN], b64[VEC_LEN], d64[VEC_LEN];
+
+    while (get_clock() < tf) {
+        union fp ops[MAX_OPERANDS];
+        int64_t t0;
+        int i;
+
+        for (i = 0; i < VEC_LEN; i++) {
+            update_random_ops(2, prec);
+            fill_random(ops, 2, prec, false);
+            a32[i] = ops[0].f32;
+            b32[i] = ops[1].f32;
+            a64[i] = ops[0].f64;
+            b64[i] = ops[1].f64;
+        }
+        t0 = get_clock();
+        for (i = 0; i < OPS_PER_ITER / VEC_LEN; i++) {
+            switch (prec) {
+            case PREC_FLOAT32:
+                switch (op) {
+                case OP_ADD:
+                    float32_add_vec(VEC_LEN, d32, a32, b32, &soft_status);
+                    break;
+                case OP_SUB:
+                    float32_sub_vec(VEC_LEN, d32, a32, b32, &soft_status);
+                    break;
+                case OP_MUL:
+                    float32_mul_vec(VEC_LEN, d32, a32, b32, &soft_status);
+                    break;
+                case OP_DIV:
+                    float32_div_vec(VEC_LEN, d32, a32, b32, &soft_status);
+                    break;
+                default:
+                    g_assert_not_reached();
+                }
+                break;
+            case PREC_FLOAT64:
+                switch (op) {
+                case OP_ADD:
+                    float64_add_vec(VEC_LEN, d64, a64, b64, &soft_status);
+                    break;
+                case OP_SUB:
+                    float64_sub_vec(VEC_LEN, d64, a64, b64, &soft_status);
+                    break;
+                case OP_MUL:
+                    float64_mul_vec(VEC_LEN, d64, a64, b64, &soft_status);
+                    break;
+                case OP_DIV:
+                    float64_div_vec(VEC_LEN, d64, a64, b64, &soft_status);
+                    break;
+                default:
+                    g_assert_not_reached();
+                }
+                break;
+            default:
+                g_assert_not_reached();
+            }
+        }
+        ns_elapsed += get_clock() - t0;
+        n_completed_ops += OPS_PER_ITER / VEC_LEN * VEC_LEN;
+    }
+}
+
 #define GEN_BENCH(name, type, prec, op, n_ops)          \
     static void __attribute__((flatten)) name(void)     \
     {                                                   \
@@ -498,6 +571,11 @@ static void run_bench(void)
     set_float_default_nan_pattern(0b01000000, &soft_status);
     set_float_ftz_detection(float_ftz_before_rounding, &soft_status);
 
+    if (tester == TESTER_VEC) {
+        bench_vec(precision, operation);
+        return;
+    }
+
     f = bench_funcs[operation][precision];
     g_assert(f);
     f();
@@ -534,6 +612,8 @@ static void usage_complete(int argc, char *argv[])
             "Default: even\n");
     fprintf(stderr, " -t = tester (%s). Default: %s\n",
             tester_list, tester_names[0]);
+    fprintf(stderr, "      'vec' is 'soft', %d elements per call "
+            "(add, sub, mul and div only)\n", VEC_LEN);
     fprintf(stderr, " -z = flush inputs to zero (soft tester only). "
             "Default: disabled\n");
     fprintf(stderr, " -Z = flush output to zero (soft tester only). "
@@ -685,6 +765,12 @@ static void parse_args(int argc, char *argv[])
     case TESTER_HOST:
         set_host_precision(rounding);
         break;
+    case TESTER_VEC:
+        if (operation > OP_DIV || precision == PREC_QUAD) {
+            fprintf(stderr, "Unsupported op or precision for tester 'vec'\n");
+            exit(EXIT_FAILURE);
+        }
+        /* fall through */
     case TESTER_SOFT:
         set_soft_precision(rounding);
         switch (precision) {
@@ -0,0 +1,272 @@
+/*
+ * fp-test-vec.c - test QEMU's softfloat vector helpers
+ *
+ * The float{32,64}_{add,sub,mul,div}_vec functions must produce the
+ * same results and exception flags as calling the scalar function on
+ * each element in turn, including when a block falls back to softfloat
+ * part way through.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef HW_POISON_H
+#error Must define HW_POISON_H to work around TARGET_* poisoning
+#endif
+
+#include "qemu/osdep.h"
+#include "fpu/softfloat.h"
+
+#define MAX_LEN 48
+#define N_TRIALS 200
+
+static const struct {
+    const char *name;
+    void (*vec)(size_t n, float32 *d, const float32 *a, const float32 *b,
+                float_status *s);
+    float32 (*scalar)(float32 a, float32 b, float_status *s);
+} f32_ops[] = {
+    { "float32_add", float32_add_vec, float32_add },
+    { "float32_sub", float32_sub_vec, float32_sub },
+    { "float32_mul", float32_mul_vec, float32_mul },
+    { "float32_div", float32_div_vec, float32_div },
+};
+
+static const struct {
+    const char *name;
+    void (*vec)(size_t n, float64 *d, const float64 *a, const float64 *b,
+                float_status *s);
+    float64 (*scalar)(float64 a, float64 b, float_status *s);
+} f64_ops[] = {
+    { "float64_add", float64_add_vec, float64_add },
+    { "float64_sub", float64_sub_vec, float64_sub },
+    { "float64_mul", float64_mul_vec, float64_mul },
+    { "float64_div", float64_div_vec, float64_div },
+};
+
+static const uint32_t f32_special[] = {
+    0x00000000, 0x80000000,     /* zeros */
+    0x7f800000, 0xff800000,     /* infinities */
+    0x7fc00000, 0x7fa00000,     /* quiet and signalling NaN */
+    0x00000001, 0x807fffff,     /* denormals */
+    0x00800000, 0x7f7fffff,     /* smallest and largest normals */
+    0x3f800000, 0xbf800000,     /* +-1 */
+};
+
+static const uint64_t f64_special[] = {
+    0x0000000000000000ull, 0x8000000000000000ull,
+    0x7ff0000000000000ull, 0xfff0000000000000ull,
+    0x7ff8000000000000ull, 0x7ff4000000000000ull,
+    0x0000000000000001ull, 0x800fffffffffffffull,
+    0x0010000000000000ull, 0x7fefffffffffffffull,
+    0x3ff0000000000000ull, 0xbff0000000000000ull,
+};
+
+static const FloatRoundMode round_modes[] = {
+    float_round_nearest_even,
+    float_round_to_zero,
+    float_round_up,
+    float_round_down,
+};
+
+typedef union {
+    float f;
+    uint32_t i;
+} ufloat32;
+
+typedef union {
+    double d;
+    uint64_t i;
+} ufloat64;
+
+static int errors;
+
+/*
+ * Mostly ordinary operands, so that most blocks stay on the host FPU,
+ * with some specials and operands close to overflow or underflow to
+ * force the fallback in the middle of a block.
+ */
+static float32 rand_f32(GRand *r)
+{
+    uint32_t sign = g_rand_boolean(r) ? 0x80000000 : 0;
+    uint32_t exp;
+    ufloat32 u;
+
+    switch (g_rand_int_range(r, 0, 8)) {
+    case 0:
+        return make_float32(g_rand_int(r));
+    case 1:
+        return make_float32(f32_special[g_rand_int_range(r, 0,
+                                            ARRAY_SIZE(f32_special))]);
+    case 2:
+        exp = g_rand_boolean(r) ? g_rand_int_range(r, 0, 8)
+                                : g_rand_int_range(r, 247, 255);
+        return make_float32(sign | exp << 23 | (g_rand_int(r) & 0x7fffff));
+    case 3:
+        /* Small integers, whose results are often exact. */
+        u.f = g_rand_int_range(r, -64, 64);
+        return make_float32(u.i);
+    default:
+        exp = g_rand_int_range(r, 100, 154);
+        return make_float32(sign | exp << 23 | (g_rand_int(r) & 0x7fffff));
+    }
+}
+
+static float64 rand_f64(GRand *r)
+{
+    uint64_t sign = g_rand_boolean(r) ? 0x8000000000000000ull : 0;
+    uint64_t frac = ((uint64_t)g_rand_int(r) << 32 | g_rand_int(r)) &
+                    0x000fffffffffffffull;
+    uint64_t exp;
+    ufloat64 u;
+
+    switch (g_rand_int_range(r, 0, 8)) {
+    case 0:
+        return make_float64((uint64_t)g_rand_int(r) << 32 | g_rand_int(r));
+    case 1:
+        return make_float64(f64_special[g_rand_int_range(r, 0,
+                                            ARRAY_SIZE(f64_special))]);
+    case 2:
+        exp = g_rand_boolean(r) ? g_rand_int_range(r, 0, 8)
+                                : g_rand_int_range(r, 2039, 2047);
+        return make_float64(sign | exp << 52 | frac);
+    case 3:
+        u.d = g_rand_int_range(r, -64, 64);
+        return make_float64(u.i);
+    default:
+        exp = g_rand_int_range(r, 1000, 1046);
+        return make_float64(sign | exp << 52 | frac);
+    }
+}
+
+static void report(const char *name, const float_status *s, size_t n,
+                   size_t i, uint64_t a, uint64_t b, uint64_t vec,
+                   uint64_t scalar, int vec_flags, int scalar_flags)
+{
+    printf("%s: round %d ftz %d fitz %d len %zu elt %zu\n"
+           "   a: %016" PRIx64 "  b: %016" PRIx64 "\n"
+           " vec: %016" PRIx64 "  flags 0x%x\n"
+           "scal: %016" PRIx64 "  flags 0x%x\n\n",
+           name, s->float_rounding_mode, s->flush_to_zero,
+           s->flush_inputs_to_zero, n, i, a, b,
+           vec, vec_flags, scalar, scalar_flags);
+
+    if (++errors == 20) {
+        exit(1);
+    }
+}
+
+static void test_f32(GRand *r, const float_status *init, bool in_place)
+{
+    float32 a[MAX_LEN], b[MAX_LEN], d[MAX_LEN], ref[MAX_LEN];
+    size_t n = g_rand_int_range(r, 0, MAX_LEN + 1);
+    size_t i, op;
+
+    for (i = 0; i < n; i++) {
+        a[i] = rand_f32(r);
+        b[i] = rand_f32(r);
+    }
+
+    for (op = 0; op < ARRAY_SIZE(f32_ops); op++) {
+        float_status vs = *init, ss = *init;
+
+        for (i = 0; i < n; i++) {
+            ref[i] = f32_ops[op].scalar(a[i], b[i], &ss);
+        }
+        if (in_place) {
+            memcpy(d, a, sizeof(a));
+            f32_ops[op].vec(n, d, d, b, &vs);
+        } else {
+            f32_ops[op].vec(n, d, a, b, &vs);
+        }
+
+        for (i = 0; i < n; i++) {
+            if (float32_val(d[i]) != float32_val(ref[i])) {
+                report(f32_ops[op].name, init, n, i,
+                       float32_val(a[i]), float32_val(b[i]),
+                       float32_val(d[i]), float32_val(ref[i]),
+                       get_float_exception_flags(&vs),
+                       get_float_exception_flags(&ss));
+                break;
+            }
+        }
+        if (i == n &&
+            get_float_exception_flags(&vs) != get_float_exception_flags(&ss)) {
+            report(f32_ops[op].name, init, n, n, 0, 0, 0, 0,
+                   get_float_exception_flags(&vs),
+                   get_float_exception_flags(&ss));
+        }
+    }
+}
+
+static void test_f64(GRand *r, const float_status *init, bool in_place)
+{
+    float64 a[MAX_LEN], b[MAX_LEN], d[MAX_LEN], ref[MAX_LEN];
+    size_t n = g_rand_int_range(r, 0, MAX_LEN + 1);
+    size_t i, op;
+
+    for (i = 0; i < n; i++) {
+        a[i] = rand_f64(r);
+        b[i] = rand_f64(r);
+    }
+
+    for (op = 0; op < ARRAY_SIZE(f64_ops); op++) {
+        float_status vs = *init, ss = *init;
+
+        for (i = 0; i < n; i++) {
+            ref[i] = f64_ops[op].scalar(a[i], b[i], &ss);
+        }
+        if (in_place) {
+            memcpy(d, a, sizeof(a));
+            f64_ops[op].vec(n, d, d, b, &vs);
+        } else {
+            f64_ops[op].vec(n, d, a, b, &vs);
+        }
+
+        for (i = 0; i < n; i++) {
+            if (float64_val(d[i]) != float64_val(ref[i])) {
+                report(f64_ops[op].name, init, n, i,
+                       float64_val(a[i]), float64_val(b[i]),
+                       float64_val(d[i]), float64_val(ref[i]),
+                       get_float_exception_flags(&vs),
+                       get_float_exception_flags(&ss));
+                break;
+            }
+        }
+        if (i == n &&
+            get_float_exception_flags(&vs) != get_float_exception_flags(&ss)) {
+            report(f64_ops[op].name, init, n, n, 0, 0, 0, 0,
+                   get_float_exception_flags(&vs),
+                   get_float_exception_flags(&ss));
+        }
+    }
+}
+
+int main(int ac, char **av)
+{
+    g_autoptr(GRand) r = g_rand_new_with_seed(1);
+    size_t rm;
+    int cfg, i;
+
+    for (rm = 0; rm < ARRAY_SIZE(round_modes); rm++) {
+        /*
+         * Bit 0: flush_to_zero, bit 1: flush_inputs_to_zero,
+         * bit 2: inexact already raised, which enables hardfloat.
+         */
+        for (cfg = 0; cfg < 8; cfg++) {
+            float_status s = {0};
+
+            set_float_2nan_prop_rule(float_2nan_prop_s_ab, &s);
+            set_float_default_nan_pattern(0b01000000, &s);
+            set_float_rounding_mode(round_modes[rm], &s);
+            set_flush_to_zero(cfg & 1, &s);
+            set_flush_inputs_to_zero(cfg & 2, &s);
+            set_float_exception_flags(cfg & 4 ? float_flag_inexact : 0, &s);
+
+            for (i = 0; i < N_TRIALS; i++) {
+                test_f32(r, &s, i & 1);
+                test_f64(r, &s, i & 1);
+            }
+        }
+    }
+
+    return errors ? 1 : 0;
+}
@@ -146,6 +146,7 @@ QVirtQueue *qvirtqueue_setup(QVirtioDevice *d,
 void qvirtqueue_cleanup(const QVirtioBus *bus, QVirtQueue *vq,
                         QGuestAllocator *alloc)
 {
+    g_free(vq->chain_lens);
     return bus->virtqueue_cleanup(vq, alloc);
 }
 
@@ -246,11 +247,37 @@ void qvirtio_wait_config_isr(QVirtioDevice *d, gint64 timeout_us)
     d->bus->wait_config_isr_status(d, timeout_us);
 }
 
+#define QVRING_PACKED_DESC_AVAIL (1 << VRING_PACKED_DESC_F_AVAIL)
+#define QVRING_PACKED_DESC_USED (1 << VRING_PACKED_DESC_F_USED)
+
+static void qvring_packed_init(QTestState *qts, QVirtQueue *vq, uint64_t addr)
+{
+    vq->packed = true;
+    vq->avail_wrap_counter = true;
+    vq->used_wrap_counter = true;
+    vq->chain_len = 0;
+    vq->chain_lens = g_new0(uint16_t, vq->size);
+
+    vq->desc = addr;
+    vq->avail = vq->desc + vq->size * sizeof(struct vring_packed_desc);
+    vq->used = vq->avail + sizeof(struct vring_packed_desc_event);
+
+    qtest_memset(qts, vq->desc, 0, vq->size * sizeof(struct vring_packed_desc));
+    /* Event suppression: notifications are enabled in both directions */
+    qvirtio_writel(vq->vdev, qts, vq->avail, 0);
+    qvirtio_writel(vq->vdev, qts, vq->used, 0);
+}
+
 void qvring_init(QTestState *qts, const QGuestAllocator *alloc, QVirtQueue *vq,
                  uint64_t addr)
 {
     int i;
 
+    if (vq->vdev->features & (1ull << VIRTIO_F_RING_PACKED)) {
+        qvring_packed_init(qts, vq, addr);
+        return;
+    }
+
     vq->desc = addr;
     vq->avail = vq->desc + vq->size * sizeof(struct vring_desc);
     vq->used = (uint64_t)((vq->avail + sizeof(uint16_t) * (3 + vq->size)
@@ -342,12 +369,61 @@ void qvring_indirect_desc_add(QVirtioDevice *d, QTestState *qts,
     indirect->index++;
 }
 
+/*
+ * The head of a chain is made available only by qvirtqueue_kick(), so
+ * that the device does not see a partial chain.
+ */
+static uint32_t qvirtqueue_packed_add(QTestState *qts, QVirtQueue *vq,
+                                      uint64_t data, uint32_t len,
+                                      bool write, bool next)
+{
+    uint32_t idx = vq->free_head;
+    uint64_t addr = vq->desc + sizeof(struct vring_packed_desc) * idx;
+    uint16_t flags = 0;
+
+    if (!vq->chain_len) {
+        vq->chain_head = idx;
+    }
+    vq->chain_len++;
+
+    if (write) {
+        flags |= VRING_DESC_F_WRITE;
+    }
+    if (next) {
+        flags |= VRING_DESC_F_NEXT;
+    } else {
+        vq->chain_lens[vq->chain_head] = vq->chain_len;
+        vq->chain_len = 0;
+    }
+    flags |= vq->avail_wrap_counter ? QVRING_PACKED_DESC_AVAIL
+                                    : QVRING_PACKED_DESC_USED;
+    if (idx == vq->chain_head) {
+        flags ^= QVRING_PACKED_DESC_AVAIL | QVRING_PACKED_DESC_USED;
+    }
+
+    qvirtio_writeq(vq->vdev, qts, addr, data);
+    qvirtio_writel(vq->vdev, qts, addr + 8, len);
+    /* The device reads the buffer id from the last descriptor */
+    qvirtio_writew(vq->vdev, qts, addr + 12, vq->chain_head);
+    qvirtio_writew(vq->vdev, qts, addr + 14, flags);
+
+    if (++vq->free_head == vq->size) {
+        vq->free_head = 0;
+        vq->avail_wrap_counter = !vq->avail_wrap_counter;
+    }
+    return idx;
+}
+
 uint32_t qvirtqueue_add(QTestState *qts, QVirtQueue *vq, uint64_t data,
                         uint32_t len, bool write, bool next)
 {
     uint16_t flags = 0;
     vq->num_free--;
 
+    if (vq->packed) {
+        return qvirtqueue_packed_add(qts, vq, data, len, write, next);
+    }
+
     if (write) {
         flags |= VRING_DESC_F_WRITE;
     }
@@ -370,6 +446,7 @@ uint32_t qvirtqueue_add_indirect(QTestState *qts, QVirtQueue *vq,
                                  QVRingIndirectDesc *indirect)
 {
     g_assert(vq->indirect);
+    g_assert(!vq->packed);
     g_assert_cmpint(vq->size, >=, indirect->elem);
     g_assert_cmpint(indirect->index, ==, indirect->elem);
 
@@ -388,16 +465,40 @@ uint32_t qvirtqueue_add_indirect(QTestState *qts, QVirtQueue *vq,
     return vq->free_head++; /* Return and increase, in this order */
 }
 
+static void qvirtqueue_packed_kick(QTestState *qts, QVirtioDevice *d,
+                                   QVirtQueue *vq, uint32_t free_head)
+{
+    uint64_t addr = vq->desc + sizeof(struct vring_packed_desc) * free_head;
+    uint16_t flags = qvirtio_readw(d, qts, addr + 14);
+
+    /* Make the head available, see qvirtqueue_packed_add() */
+    flags ^= QVRING_PACKED_DESC_AVAIL | QVRING_PACKED_DESC_USED;
+    qvirtio_writew(d, qts, addr + 14, flags);
+
+    /* vq->used->flags */
+    if (qvirtio_readw(d, qts, vq->used + 2) !=
+        VRING_PACKED_EVENT_FLAG_DISABLE) {
+        d->bus->virtqueue_kick(d, vq);
+    }
+}
+
 void qvirtqueue_kick(QTestState *qts, QVirtioDevice *d, QVirtQueue *vq,
                      uint32_t free_head)
 {
     /* vq->avail->idx */
-    uint16_t idx = qvirtio_readw(d, qts, vq->avail + 2);
+    uint16_t idx;
     /* vq->used->flags */
     uint16_t flags;
     /* vq->used->avail_event */
     uint16_t avail_event;
 
+    if (vq->packed) {
+        qvirtqueue_packed_kick(qts, d, vq, free_head);
+        return;
+    }
+
+    idx = qvirtio_readw(d, qts, vq->avail + 2);
+
     /* vq->avail->ring[idx % vq->size] */
     qvirtio_writew(d, qts, vq->avail + 4 + (2 * (idx % vq->size)), free_head);
     /* vq->avail->idx */
@@ -425,12 +526,50 @@ void qvirtqueue_kick(QTestState *qts, QVirtioDevice *d, QVirtQueue *vq,
  *
  * Returns: true if an element was ready, false otherwise
  */
+static bool qvirtqueue_packed_get_buf(QTestState *qts, QVirtQueue *vq,
+                                      uint32_t *desc_idx, uint32_t *len)
+{
+    uint64_t addr = vq->desc +
+        sizeof(struct vring_packed_desc) * vq->last_used_idx;
+    uint16_t flags = qvirtio_readw(vq->vdev, qts, addr + 14);
+    bool avail = flags & QVRING_PACKED_DESC_AVAIL;
+    bool used = flags & QVRING_PACKED_DESC_USED;
+    uint16_t id;
+
+    if (avail != used || used != vq->used_wrap_counter) {
+        return false;
+    }
+
+    id = qvirtio_readw(vq->vdev, qts, addr + 12);
+    g_assert_cmpint(id, <, vq->size);
+    g_assert_cmpint(vq->chain_lens[id], !=, 0);
+    if (desc_idx) {
+        *desc_idx = id;
+    }
+    if (len) {
+        *len = qvirtio_readl(vq->vdev, qts, addr + 8);
+    }
+
+    /* The used descriptor stands for the whole chain */
+    vq->last_used_idx += vq->chain_lens[id];
+    vq->chain_lens[id] = 0;
+    if (vq->last_used_idx >= vq->size) {
+        vq->last_used_idx -= vq->size;
+        vq->used_wrap_counter = !vq->used_wrap_counter;
+    }
+    return true;
+}
+
 bool qvirtqueue_get_buf(QTestState *qts, QVirtQueue *vq, uint32_t *desc_idx,
                         uint32_t *len)
 {
     uint16_t idx;
     uint64_t elem_addr, addr;
 
+    if (vq->packed) {
+        return qvirtqueue_packed_get_buf(qts, vq, desc_idx, len);
+    }
+
     idx = qvirtio_readw(vq->vdev, qts,
                         vq->used + offsetof(struct vring_used, idx));
     if (idx == vq->last_used_idx) {
@@ -459,6 +598,7 @@ bool qvirtqueue_get_buf(QTestState *qts, QVirtQueue *vq, uint32_t *desc_idx,
 void qvirtqueue_set_used_event(QTestState *qts, QVirtQueue *vq, uint16_t idx)
 {
     g_assert(vq->event);
+    g_assert(!vq->packed);
 
     /* vq->avail->used_event */
     qvirtio_writew(vq->vdev, qts, vq->avail + 4 + (2 * vq->size), idx);
@@ -28,6 +28,11 @@ typedef struct QVirtioDevice {
 
 typedef struct QVirtQueue {
     QVirtioDevice *vdev;
+    /*
+     * With VIRTIO_F_RING_PACKED, @desc points to an array of struct
+     * vring_packed_desc, and @avail and @used to the driver and device
+     * event suppression structures.
+     */
     uint64_t desc; /* This points to an array of struct vring_desc */
     uint64_t avail; /* This points to a struct vring_avail */
     uint64_t used; /* This points to a struct vring_used */
@@ -39,6 +44,14 @@ typedef struct QVirtQueue {
     uint16_t last_used_idx;
     bool indirect;
     bool event;
+
+    /* Packed ring state */
+    bool packed;
+    bool avail_wrap_counter;
+    bool used_wrap_counter;
+    uint32_t chain_head; /* First descriptor of the chain being added */
+    uint16_t chain_len;
+    uint16_t *chain_lens; /* Chain length for each buffer id */
 } QVirtQueue;
 
 typedef struct QVRingIndirectDesc {
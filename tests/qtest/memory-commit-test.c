@@ -0,0 +1,169 @@
+/*
+ * QTest testcase for memory transactions with many memory regions
+ *
+ * Toggles the decoding of one PCI device among a few hundred and checks
+ * that the address spaces that did not change keep working.  With -m slow
+ * it also reports how many memory transactions per second are committed,
+ * which mostly measures how fast FlatViews are rebuilt.  Finally it checks
+ * that the bus master address spaces of the devices share their FlatViews.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "libqos/pci-pc.h"
+#include "standard-headers/linux/pci_regs.h"
+
+/* pci-testdev in all functions of these slots of the root bus */
+#define FIRST_SLOT 2
+#define NR_SLOTS   30
+#define NR_FUNCS   8
+
+#define MEMBAR_SIZE 4096
+#define PATTERN     0x5a5aa5a5
+
+typedef struct TestState {
+    QTestState *qts;
+    QPCIBus *bus;
+    QPCIDevice *devs[NR_SLOTS * NR_FUNCS];
+    QPCIBar membar;
+} TestState;
+
+static void test_init(TestState *s)
+{
+    GString *cmd = g_string_new("-M pc -nodefaults");
+    int slot, fn, i;
+
+    for (slot = FIRST_SLOT; slot < FIRST_SLOT + NR_SLOTS; slot++) {
+        for (fn = 0; fn < NR_FUNCS; fn++) {
+            g_string_append_printf(cmd, " -device pci-testdev,addr=%02x.%x,"
+                                   "membar=%d,membar-backed=on%s",
+                                   slot, fn, MEMBAR_SIZE,
+                                   fn ? "" : ",multifunction=on");
+        }
+    }
+
+    s->qts = qtest_init(cmd->str);
+    g_string_free(cmd, true);
+    s->bus = qpci_new_pc(s->qts, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(s->devs); i++) {
+        s->devs[i] = qpci_device_find(s->bus,
+                                      QPCI_DEVFN(FIRST_SLOT + i / NR_FUNCS,
+                                                 i % NR_FUNCS));
+        g_assert(s->devs[i]);
+        qpci_iomap(s->devs[i], 0, NULL);
+        if (i) {
+            qpci_iomap(s->devs[i], 2, NULL);
+            qpci_config_writew(s->devs[i], PCI_COMMAND, PCI_COMMAND_MEMORY);
+        }
+    }
+
+    /* Only the first device decodes I/O, the I/O window is small */
+    qpci_device_enable(s->devs[0]);
+    qpci_iomap(s->devs[0], 1, NULL);
+    s->membar = qpci_iomap(s->devs[0], 2, NULL);
+    qpci_io_writel(s->devs[0], s->membar, 0, PATTERN);
+}
+
+static void test_cleanup(TestState *s)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(s->devs); i++) {
+        g_free(s->devs[i]);
+    }
+    qpci_free_pc(s->bus);
+    qtest_quit(s->qts);
+}
+
+static void toggle_command(TestState *s, uint16_t bit)
+{
+    uint16_t cmd = qpci_config_readw(s->devs[0], PCI_COMMAND);
+
+    qpci_config_writew(s->devs[0], PCI_COMMAND, cmd & ~bit);
+    qpci_config_writew(s->devs[0], PCI_COMMAND, cmd);
+}
+
+static void bench_toggle(TestState *s, uint16_t bit, const char *name)
+{
+    uint64_t n = 0;
+
+    if (!g_test_slow()) {
+        for (n = 0; n < 16; n++) {
+            toggle_command(s, bit);
+        }
+        return;
+    }
+
+    g_test_timer_start();
+    do {
+        toggle_command(s, bit);
+        n++;
+    } while (g_test_timer_elapsed() < 1.0);
+    g_test_message("%-8s %10.0f commits/sec", name,
+                   2 * n / g_test_timer_last());
+}
+
+static void test_toggle_io(void)
+{
+    TestState s;
+
+    test_init(&s);
+
+    /* Only the I/O address space changes, memory is left alone */
+    bench_toggle(&s, PCI_COMMAND_IO, "io");
+    g_assert_cmphex(qpci_io_readl(s.devs[0], s.membar, 0), ==, PATTERN);
+
+    test_cleanup(&s);
+}
+
+static void test_toggle_memory(void)
+{
+    TestState s;
+
+    test_init(&s);
+
+    bench_toggle(&s, PCI_COMMAND_MEMORY, "memory");
+    g_assert_cmphex(qpci_io_readl(s.devs[0], s.membar, 0), ==, PATTERN);
+
+    test_cleanup(&s);
+}
+
+static void test_flatview_sharing(void)
+{
+    TestState s;
+    g_autofree char *mtree = NULL;
+    const char *summary;
+    unsigned nr_as, nr_views;
+
+    test_init(&s);
+
+    mtree = qtest_hmp(s.qts, "info mtree -f");
+    summary = strstr(mtree, " address spaces per view)");
+    g_assert(summary);
+    while (summary > mtree && summary[-1] != '\n') {
+        summary--;
+    }
+    g_assert_cmpint(sscanf(summary, "%u address spaces, %u FlatViews",
+                           &nr_as, &nr_views), ==, 2);
+
+    /* One bus master address space per device, plus a few for the machine */
+    g_assert_cmpuint(nr_as, >, ARRAY_SIZE(s.devs));
+    g_assert_cmpuint(nr_views, <, nr_as / 2);
+
+    test_cleanup(&s);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/memory-commit/toggle-io", test_toggle_io);
+    qtest_add_func("/memory-commit/toggle-memory", test_toggle_memory);
+    qtest_add_func("/memory-commit/flatview-sharing", test_flatview_sharing);
+
+    return g_test_run();
+}
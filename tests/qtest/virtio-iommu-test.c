@@ -16,10 +16,16 @@
 #include "qemu/module.h"
 #include "libqos/qgraph.h"
 #include "libqos/virtio-iommu.h"
+#include "libqos/virtio-pci.h"
 #include "hw/virtio/virtio-iommu.h"
+#include "standard-headers/linux/virtio_net.h"
 
 #define PCI_SLOT_HP             0x06
+#define PCI_SLOT_NET            0x05
 #define QVIRTIO_IOMMU_TIMEOUT_US (30 * 1000 * 1000)
+#define VNET_HDR_SIZE sizeof(struct virtio_net_hdr_mrg_rxbuf)
+#define XLAT_PKT_SIZE 64
+#define XLAT_IOVA 0xf0000000ULL
 
 static QGuestAllocator *alloc;
 
@@ -318,11 +324,146 @@ static void test_map_unmap(void *obj, void *data, QGuestAllocator *t_alloc)
     g_assert_cmpint(ret, ==, VIRTIO_IOMMU_S_INVAL); /* 10-14 still is mapped */
 }
 
+#ifndef _WIN32
+
+/* Send a packet from @iova and check that it is filled with @patt */
+static void xlat_tx_check(QTestState *qts, QVirtioDevice *dev, QVirtQueue *vq,
+                          uint64_t hdr_addr, uint64_t iova,
+                          int socket, uint8_t patt)
+{
+    uint8_t buffer[XLAT_PKT_SIZE];
+    uint32_t free_head;
+    uint32_t len;
+    int ret, i;
+
+    free_head = qvirtqueue_add(qts, vq, hdr_addr, VNET_HDR_SIZE, false, true);
+    qvirtqueue_add(qts, vq, iova, XLAT_PKT_SIZE, false, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_IOMMU_TIMEOUT_US);
+
+    ret = recv(socket, &len, sizeof(len), MSG_WAITALL);
+    g_assert_cmpint(ret, ==, sizeof(len));
+    g_assert_cmpint(ntohl(len), ==, XLAT_PKT_SIZE);
+    ret = recv(socket, buffer, XLAT_PKT_SIZE, MSG_WAITALL);
+    g_assert_cmpint(ret, ==, XLAT_PKT_SIZE);
+    for (i = 0; i < XLAT_PKT_SIZE; i++) {
+        g_assert_cmphex(buffer[i], ==, patt);
+    }
+}
+
+/*
+ * The descriptor translation cache of a device behind the IOMMU must be
+ * dropped on unmap.  Send a packet through an IOVA window, remap the
+ * window to another page and send again.
+ */
+static void test_xlat_unmap(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioIOMMUPCI *iommu_pci = obj;
+    QVirtioIOMMU *v_iommu = &iommu_pci->iommu;
+    QPCIBus *bus = iommu_pci->pci_vdev.pdev->bus;
+    QTestState *qts = global_qtest;
+    uint32_t ep = QPCI_DEVFN(PCI_SLOT_NET, 0);
+    QVirtioPCIDevice *net;
+    QVirtQueue *vq;
+    uint64_t features, hdr_addr, pages, buf[2];
+    int *sv = data;
+    int ret, i;
+
+    alloc = t_alloc;
+
+    /* Everything but the window is identity mapped */
+    ret = send_attach_detach(qts, v_iommu, VIRTIO_IOMMU_T_ATTACH, 1, ep);
+    g_assert_cmpint(ret, ==, 0);
+    ret = send_map(qts, v_iommu, 1, 0, XLAT_IOVA - 1, 0,
+                   VIRTIO_IOMMU_MAP_F_READ | VIRTIO_IOMMU_MAP_F_WRITE);
+    g_assert_cmpint(ret, ==, 0);
+
+    net = virtio_pci_new(bus, &(QPCIAddress) { .devfn = ep });
+    g_assert_nonnull(net);
+    qvirtio_pci_device_enable(net);
+    qvirtio_start_device(&net->vdev);
+
+    features = qvirtio_get_features(&net->vdev);
+    g_assert(features & (1ull << VIRTIO_F_ACCESS_PLATFORM));
+    features &= ~(QVIRTIO_F_BAD_FEATURE |
+                  (1ull << VIRTIO_RING_F_INDIRECT_DESC) |
+                  (1ull << VIRTIO_RING_F_EVENT_IDX));
+    qvirtio_set_features(&net->vdev, features);
+    vq = qvirtqueue_setup(&net->vdev, t_alloc, 1);
+    qvirtio_set_driver_ok(&net->vdev);
+
+    hdr_addr = guest_alloc(t_alloc, VNET_HDR_SIZE);
+    qtest_memset(qts, hdr_addr, 0, VNET_HDR_SIZE);
+    pages = guest_alloc(t_alloc, 3 * 0x1000);
+    for (i = 0; i < 2; i++) {
+        buf[i] = QEMU_ALIGN_UP(pages, 0x1000) + i * 0x1000;
+        qtest_memset(qts, buf[i], i ? 0xbb : 0xaa, XLAT_PKT_SIZE);
+    }
+
+    ret = send_map(qts, v_iommu, 1, XLAT_IOVA, XLAT_IOVA + 0xfff, buf[0],
+                   VIRTIO_IOMMU_MAP_F_READ);
+    g_assert_cmpint(ret, ==, 0);
+    xlat_tx_check(qts, &net->vdev, vq, hdr_addr, XLAT_IOVA, sv[0], 0xaa);
+
+    ret = send_unmap(qts, v_iommu, 1, XLAT_IOVA, XLAT_IOVA + 0xfff);
+    g_assert_cmpint(ret, ==, 0);
+    ret = send_map(qts, v_iommu, 1, XLAT_IOVA, XLAT_IOVA + 0xfff, buf[1],
+                   VIRTIO_IOMMU_MAP_F_READ);
+    g_assert_cmpint(ret, ==, 0);
+    xlat_tx_check(qts, &net->vdev, vq, hdr_addr, XLAT_IOVA, sv[0], 0xbb);
+
+    guest_free(t_alloc, pages);
+    guest_free(t_alloc, hdr_addr);
+    qvirtqueue_cleanup(net->vdev.bus, vq, t_alloc);
+    qvirtio_pci_destructor(&net->obj);
+    g_free(net);
+}
+
+static void xlat_test_cleanup(void *sockets)
+{
+    int *sv = sockets;
+
+    close(sv[0]);
+    qos_invalidate_command_line();
+    close(sv[1]);
+    g_free(sv);
+}
+
+static void *xlat_test_setup(GString *cmd_line, void *arg)
+{
+    int ret;
+    int *sv = g_new(int, 2);
+
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, sv);
+    g_assert_cmpint(ret, !=, -1);
+
+    g_string_append_printf(cmd_line,
+                           " -netdev socket,fd=%d,id=hs0"
+                           " -device virtio-net-pci,netdev=hs0,addr=%02x.0,"
+                           "disable-legacy=on,iommu_platform=on ",
+                           sv[1], PCI_SLOT_NET);
+
+    g_test_queue_destroy(xlat_test_cleanup, sv);
+    return sv;
+}
+
+#endif /* _WIN32 */
+
 static void register_virtio_iommu_test(void)
 {
+#ifndef _WIN32
+    QOSGraphTestOptions opts = {
+        .before = xlat_test_setup,
+    };
+#endif
+
     qos_add_test("config", "virtio-iommu", pci_config, NULL);
     qos_add_test("attach_detach", "virtio-iommu", test_attach_detach, NULL);
     qos_add_test("map_unmap", "virtio-iommu", test_map_unmap, NULL);
+#ifndef _WIN32
+    qos_add_test("xlat_unmap", "virtio-iommu-pci", test_xlat_unmap, &opts);
+#endif
 }
 
 libqos_init(register_virtio_iommu_test);
@@ -12,6 +12,7 @@
 #include "qemu/iov.h"
 #include "qemu/module.h"
 #include "qobject/qdict.h"
+#include "hw/pci/pci_regs.h"
 #include "hw/virtio/virtio-net.h"
 #include "libqos/qgraph.h"
 #include "libqos/virtio-net.h"
@@ -25,6 +26,8 @@
 
 #define QVIRTIO_NET_TIMEOUT_US (30 * 1000 * 1000)
 #define VNET_HDR_SIZE sizeof(struct virtio_net_hdr_mrg_rxbuf)
+#define TX_BATCH_PKT_SIZE (8 * 1024)
+#define XLAT_PKT_SIZE 64
 
 #ifndef _WIN32
 
@@ -166,6 +169,180 @@ static void stop_cont_test(void *obj, void *data, QGuestAllocator *t_alloc)
     rx_stop_cont_test(dev, t_alloc, rx, sv[0]);
 }
 
+/*
+ * Queue more packets than the socket takes at once, so that the device
+ * pops a batch, sends part of it and gives the rest back to the ring.
+ * Each packet must still be sent and completed exactly once, in order.
+ * Packets are chains of two descriptors, which a packed ring has to skip
+ * as a whole when they are given back.
+ */
+static void tx_batch_test(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net_if = obj;
+    QVirtioDevice *dev = net_if->vdev;
+    QVirtQueue *vq = net_if->queues[1];
+    QTestState *qts = global_qtest;
+    unsigned int n = vq->size / 2;
+    g_autofree uint32_t *heads = g_new(uint32_t, n);
+    g_autofree uint8_t *buffer = g_malloc(TX_BATCH_PKT_SIZE);
+    uint64_t hdr_addr, pkt_addr;
+    int *sv = data;
+    unsigned int i;
+    uint32_t len;
+    int ret;
+
+    hdr_addr = guest_alloc(t_alloc, VNET_HDR_SIZE);
+    qtest_memset(qts, hdr_addr, 0, VNET_HDR_SIZE);
+    pkt_addr = guest_alloc(t_alloc, n * TX_BATCH_PKT_SIZE);
+
+    for (i = 0; i < n; i++) {
+        uint64_t addr = pkt_addr + i * TX_BATCH_PKT_SIZE;
+
+        qtest_memset(qts, addr, i, TX_BATCH_PKT_SIZE);
+        heads[i] = qvirtqueue_add(qts, vq, hdr_addr, VNET_HDR_SIZE,
+                                  false, true);
+        qvirtqueue_add(qts, vq, addr, TX_BATCH_PKT_SIZE, false, false);
+        qvirtqueue_kick(qts, dev, vq, heads[i]);
+    }
+
+    for (i = 0; i < n; i++) {
+        ret = recv(sv[0], &len, sizeof(len), MSG_WAITALL);
+        g_assert_cmpint(ret, ==, sizeof(len));
+        g_assert_cmpint(ntohl(len), ==, TX_BATCH_PKT_SIZE);
+
+        ret = recv(sv[0], buffer, TX_BATCH_PKT_SIZE, MSG_WAITALL);
+        g_assert_cmpint(ret, ==, TX_BATCH_PKT_SIZE);
+        g_assert_cmpint(buffer[0], ==, (uint8_t)i);
+        g_assert_cmpint(buffer[TX_BATCH_PKT_SIZE - 1], ==, (uint8_t)i);
+    }
+
+    /*
+     * The device completes a batch with a single interrupt, so look at
+     * the used ring directly instead of waiting for each one.
+     */
+    for (i = 0; i < n; i++) {
+        gint64 start_time = g_get_monotonic_time();
+        uint32_t desc_idx;
+
+        while (!qvirtqueue_get_buf(qts, vq, &desc_idx, NULL)) {
+            g_assert(g_get_monotonic_time() - start_time <=
+                     QVIRTIO_NET_TIMEOUT_US);
+        }
+        g_assert_cmpint(desc_idx, ==, heads[i]);
+    }
+
+    g_assert(!qvirtqueue_get_buf(qts, vq, NULL, NULL));
+    ret = recv(sv[0], &len, sizeof(len), MSG_DONTWAIT);
+    g_assert_cmpint(ret, ==, -1);
+    g_assert_cmpint(errno, ==, EAGAIN);
+
+    guest_free(t_alloc, pkt_addr);
+    guest_free(t_alloc, hdr_addr);
+}
+
+static void tx_batch_packed_test(void *obj, void *data,
+                                 QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net_if = obj;
+
+    if (!net_if->queues[1]->packed) {
+        g_test_skip("packed ring not negotiated");
+        return;
+    }
+    tx_batch_test(obj, data, t_alloc);
+}
+
+/* Send a packet from @data_addr and check that it is filled with @patt */
+static void xlat_tx_check(QTestState *qts, QVirtioDevice *dev, QVirtQueue *vq,
+                          uint64_t hdr_addr, uint64_t data_addr,
+                          int socket, uint8_t patt)
+{
+    uint8_t buffer[XLAT_PKT_SIZE];
+    uint32_t free_head;
+    uint32_t len;
+    int ret, i;
+
+    free_head = qvirtqueue_add(qts, vq, hdr_addr, VNET_HDR_SIZE, false, true);
+    qvirtqueue_add(qts, vq, data_addr, XLAT_PKT_SIZE, false, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_NET_TIMEOUT_US);
+
+    ret = recv(socket, &len, sizeof(len), MSG_WAITALL);
+    g_assert_cmpint(ret, ==, sizeof(len));
+    g_assert_cmpint(ntohl(len), ==, XLAT_PKT_SIZE);
+    ret = recv(socket, buffer, XLAT_PKT_SIZE, MSG_WAITALL);
+    g_assert_cmpint(ret, ==, XLAT_PKT_SIZE);
+    for (i = 0; i < XLAT_PKT_SIZE; i++) {
+        g_assert_cmphex(buffer[i], ==, patt);
+    }
+}
+
+/*
+ * The descriptor translation cache must notice when the memory map
+ * changes.  Send a packet from the RAM BAR of one ivshmem device, then
+ * put the BAR of another one at the same address and send again.
+ */
+static void xlat_commit(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNetPCI *net_pci = obj;
+    QVirtioNet *net_if = &net_pci->net;
+    QPCIBus *bus = net_pci->pci_vdev.pdev->bus;
+    QTestState *qts = bus->qts;
+    QPCIDevice *ivshmem[2];
+    uint64_t hdr_addr;
+    QPCIBar bar;
+    int *sv = data;
+    int i;
+
+    if (bus->not_hotpluggable) {
+        g_test_skip("pci bus does not support hotplug");
+        return;
+    }
+    if (!qtest_has_device("ivshmem-plain")) {
+        g_test_skip("ivshmem-plain not available");
+        return;
+    }
+
+    for (i = 0; i < 2; i++) {
+        g_autofree char *memdev = g_strdup_printf("mb%d", i);
+        g_autofree char *id = g_strdup_printf("iv%d", i);
+        g_autofree char *addr = g_strdup_printf("0x%02x", PCI_SLOT_HP + i);
+
+        qtest_qmp_assert_success(qts, "{ 'execute': 'object-add',"
+                                 "  'arguments': {"
+                                 "    'qom-type': 'memory-backend-ram',"
+                                 "    'id': %s, 'size': 1048576 } }",
+                                 memdev);
+        qtest_qmp_device_add(qts, "ivshmem-plain", id,
+                             "{'memdev': %s, 'addr': %s}", memdev, addr);
+        ivshmem[i] = qpci_device_find(bus, QPCI_DEVFN(PCI_SLOT_HP + i, 0));
+        g_assert_nonnull(ivshmem[i]);
+    }
+
+    hdr_addr = guest_alloc(t_alloc, VNET_HDR_SIZE);
+    qtest_memset(qts, hdr_addr, 0, VNET_HDR_SIZE);
+
+    bar = qpci_iomap(ivshmem[0], 2, NULL);
+    qpci_device_enable(ivshmem[0]);
+    qtest_memset(qts, bar.addr, 0xaa, XLAT_PKT_SIZE);
+    xlat_tx_check(qts, net_if->vdev, net_if->queues[1], hdr_addr, bar.addr,
+                  sv[0], 0xaa);
+
+    qpci_config_writew(ivshmem[0], PCI_COMMAND, 0);
+    qpci_config_writel(ivshmem[1], PCI_BASE_ADDRESS_2, bar.addr);
+    qpci_config_writel(ivshmem[1], PCI_BASE_ADDRESS_3, bar.addr >> 32);
+    qpci_device_enable(ivshmem[1]);
+    qtest_memset(qts, bar.addr, 0xbb, XLAT_PKT_SIZE);
+    xlat_tx_check(qts, net_if->vdev, net_if->queues[1], hdr_addr, bar.addr,
+                  sv[0], 0xbb);
+
+    for (i = 0; i < 2; i++) {
+        g_free(ivshmem[i]);
+    }
+    guest_free(t_alloc, hdr_addr);
+}
+
 static void hotplug(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioPCIDevice *dev = obj;
@@ -325,9 +502,14 @@ static void register_virtio_net_test(void)
 #ifndef _WIN32
     opts.before = virtio_net_test_setup;
     qos_add_test("hotplug", "virtio-net-pci", hotplug, &opts);
+    qos_add_test("xlat_commit", "virtio-net-pci", xlat_commit, &opts);
     qos_add_test("basic", "virtio-net", send_recv_test, &opts);
     qos_add_test("rx_stop_cont", "virtio-net", stop_cont_test, &opts);
     qos_add_test("announce-self", "virtio-net", announce_self, &opts);
+    qos_add_test("tx_batch/split", "virtio-net", tx_batch_test, &opts);
+    opts.edge.extra_device_opts = "packed=on";
+    qos_add_test("tx_batch/packed", "virtio-net", tx_batch_packed_test, &opts);
+    opts.edge.extra_device_opts = NULL;
 #endif
 
     /* These tests do not need a loopback backend.  */
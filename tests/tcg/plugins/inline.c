@@ -20,6 +20,7 @@ typedef struct {
     uint64_t count_insn_inline;
     uint64_t count_mem;
     uint64_t count_mem_inline;
+    uint64_t count_mem_buffered;
     uint64_t tb_cond_num_trigger;
     uint64_t tb_cond_track_count;
     uint64_t insn_cond_num_trigger;
@@ -27,6 +28,8 @@ typedef struct {
 } CPUCount;
 
 static const uint64_t cond_trigger_limit = 100;
+static const size_t mem_buffer_records = 64;
+static const uint32_t mem_buffer_tag = 0xb0ff;
 
 typedef struct {
     uint64_t data_insn;
@@ -41,6 +44,8 @@ static qemu_plugin_u64 count_insn;
 static qemu_plugin_u64 count_insn_inline;
 static qemu_plugin_u64 count_mem;
 static qemu_plugin_u64 count_mem_inline;
+static qemu_plugin_u64 count_mem_buffered;
+static struct qemu_plugin_mem_buffer *mem_buffer;
 static qemu_plugin_u64 tb_cond_num_trigger;
 static qemu_plugin_u64 tb_cond_track_count;
 static qemu_plugin_u64 insn_cond_num_trigger;
@@ -111,14 +116,17 @@ static void stats_mem(void)
     const uint64_t per_vcpu = qemu_plugin_u64_sum(count_mem);
     const uint64_t inl_per_vcpu =
         qemu_plugin_u64_sum(count_mem_inline);
+    const uint64_t buffered = qemu_plugin_u64_sum(count_mem_buffered);
     g_autoptr(GString) stats = g_string_new("");
     g_string_append_printf(stats, "mem: %" PRIu64 "\n", expected);
     g_string_append_printf(stats, "mem: %" PRIu64 " (per vcpu)\n", per_vcpu);
     g_string_append_printf(stats, "mem: %" PRIu64 " (per vcpu inline)\n", inl_per_vcpu);
+    g_string_append_printf(stats, "mem: %" PRIu64 " (buffered)\n", buffered);
     qemu_plugin_outs(stats->str);
     g_assert(expected > 0);
     g_assert(per_vcpu == expected);
     g_assert(inl_per_vcpu == expected);
+    g_assert(buffered == expected);
 }
 
 static void plugin_exit(qemu_plugin_id_t id, void *udata)
@@ -127,6 +135,10 @@ static void plugin_exit(qemu_plugin_id_t id, void *udata)
     g_autoptr(GString) stats = g_string_new("");
     g_assert(num_cpus == max_cpu_index + 1);
 
+    for (int i = 0; i < num_cpus ; ++i) {
+        qemu_plugin_mem_buffer_flush(mem_buffer, i);
+    }
+
     for (int i = 0; i < num_cpus ; ++i) {
         const uint64_t tb = qemu_plugin_u64_get(count_tb, i);
         const uint64_t tb_inline = qemu_plugin_u64_get(count_tb_inline, i);
@@ -134,6 +146,8 @@ static void plugin_exit(qemu_plugin_id_t id, void *udata)
         const uint64_t insn_inline = qemu_plugin_u64_get(count_insn_inline, i);
         const uint64_t mem = qemu_plugin_u64_get(count_mem, i);
         const uint64_t mem_inline = qemu_plugin_u64_get(count_mem_inline, i);
+        const uint64_t mem_buffered =
+            qemu_plugin_u64_get(count_mem_buffered, i);
         const uint64_t tb_cond_trigger =
             qemu_plugin_u64_get(tb_cond_num_trigger, i);
         const uint64_t tb_cond_left =
@@ -148,18 +162,20 @@ static void plugin_exit(qemu_plugin_id_t id, void *udata)
                         "insn (%" PRIu64 ", %" PRIu64
                         ", %" PRIu64 " * %" PRIu64 " + %" PRIu64
                         ") | "
-                        "mem (%" PRIu64 ", %" PRIu64 ")"
+                        "mem (%" PRIu64 ", %" PRIu64 ", %" PRIu64 ")"
                         "\n",
                         i,
                         tb, tb_inline,
                         tb_cond_trigger, cond_trigger_limit, tb_cond_left,
                         insn, insn_inline,
                         insn_cond_trigger, cond_trigger_limit, insn_cond_left,
-                        mem, mem_inline);
+                        mem, mem_inline, mem_buffered);
         qemu_plugin_outs(stats->str);
         g_assert(tb == tb_inline);
         g_assert(insn == insn_inline);
         g_assert(mem == mem_inline);
+        g_assert(mem == mem_buffered);
+        g_assert(qemu_plugin_mem_buffer_dropped(mem_buffer, i) == 0);
         g_assert(tb_cond_trigger == tb / cond_trigger_limit);
         g_assert(tb_cond_left == tb % cond_trigger_limit);
         g_assert(insn_cond_trigger == insn / cond_trigger_limit);
@@ -170,6 +186,7 @@ static void plugin_exit(qemu_plugin_id_t id, void *udata)
     stats_insn();
     stats_mem();
 
+    qemu_plugin_mem_buffer_free(mem_buffer);
     qemu_plugin_scoreboard_free(counts);
     qemu_plugin_scoreboard_free(data);
 }
@@ -223,6 +240,17 @@ static void vcpu_mem_access(unsigned int cpu_index,
     g_mutex_unlock(&mem_lock);
 }
 
+static void vcpu_mem_buffer_drain(unsigned int cpu_index,
+                                  const qemu_plugin_mem_record *records,
+                                  size_t n, void *udata)
+{
+    g_assert(n > 0 && n <= mem_buffer_records);
+    for (size_t i = 0; i < n; i++) {
+        g_assert(records[i].tag == mem_buffer_tag);
+    }
+    qemu_plugin_u64_add(count_mem_buffered, cpu_index, n);
+}
+
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 {
     void *tb_store = tb;
@@ -270,6 +298,8 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
             insn, QEMU_PLUGIN_MEM_RW,
             QEMU_PLUGIN_INLINE_ADD_U64,
             count_mem_inline, 1);
+        qemu_plugin_register_vcpu_mem_inline_append(
+            insn, QEMU_PLUGIN_MEM_RW, mem_buffer, mem_buffer_tag);
     }
 }
 
@@ -298,6 +328,10 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         counts, CPUCount, insn_cond_num_trigger);
     insn_cond_track_count = qemu_plugin_scoreboard_u64_in_struct(
         counts, CPUCount, insn_cond_track_count);
+    count_mem_buffered = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, count_mem_buffered);
+    mem_buffer = qemu_plugin_mem_buffer_new(mem_buffer_records,
+                                            vcpu_mem_buffer_drain, NULL);
     data = qemu_plugin_scoreboard_new(sizeof(CPUData));
     data_insn = qemu_plugin_scoreboard_u64_in_struct(data, CPUData, data_insn);
     data_tb = qemu_plugin_scoreboard_u64_in_struct(data, CPUData, data_tb);
@@ -1042,6 +1042,47 @@ static void test_hbitmap_next_dirty_area_after_truncate(TestHBitmapData *data,
     test_hbitmap_next_dirty_area_check(data, 0, INT64_MAX);
 }
 
+static void test_hbitmap_merge(TestHBitmapData *data,
+                               const void *unused)
+{
+    static const uint64_t ranges[][2] = {
+        { 0, 1 }, { L1 - 1, 2 }, { L2 - 3, L1 + 5 }, { L2 * 5, L2 * 2 },
+        { L3 - L1, L1 },
+    };
+    HBitmap *b, *r;
+    int i;
+
+    hbitmap_test_init(data, L3, 0);
+    hbitmap_test_set(data, 7, L1 * 3);
+    hbitmap_test_set(data, L2 * 6 + 5, L2);
+
+    b = hbitmap_alloc(L3, 0);
+    for (i = 0; i < ARRAY_SIZE(ranges); i++) {
+        hbitmap_set(b, ranges[i][0], ranges[i][1]);
+        bitmap_set(data->bits, ranges[i][0], ranges[i][1]);
+    }
+
+    /* Into a separate result bitmap */
+    r = hbitmap_alloc(L3, 0);
+    hbitmap_set(r, L2 * 3, L1);
+    hbitmap_merge(data->hb, b, r);
+
+    /* In place, walking only the populated part of the source */
+    hbitmap_merge(data->hb, b, data->hb);
+    hbitmap_test_check(data, 0);
+
+    g_assert_cmpint(hbitmap_count(r), ==, hbitmap_count(data->hb));
+    hbitmap_free(data->hb);
+    data->hb = r;
+    hbitmap_test_check(data, 0);
+
+    /* Merging twice must not change the count */
+    hbitmap_merge(data->hb, b, data->hb);
+    hbitmap_test_check(data, 0);
+
+    hbitmap_free(b);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -1113,6 +1154,8 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/next_dirty_area/next_dirty_area_after_truncate",
                      test_hbitmap_next_dirty_area_after_truncate);
 
+    hbitmap_test_add("/hbitmap/merge", test_hbitmap_merge);
+
     g_test_run();
 
     return 0;
@@ -0,0 +1,244 @@
+/*
+ * io_uring block I/O: fixed files, fixed buffers and resubmission
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "block/aio.h"
+#include "block/raw-aio.h"
+#include "qapi/error.h"
+#include "qemu/coroutine.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "qemu/memalign.h"
+
+#define BUF_SIZE (1 * MiB)
+
+static AioContext *ctx;
+static char test_file[] = "/tmp/qtest-io-uring.XXXXXX";
+
+typedef struct {
+    int fd;
+    uint64_t offset;
+    QEMUIOVector *qiov;
+    int type;
+    int ret;
+    bool done;
+} IoUringRequest;
+
+static void coroutine_fn submit_co(void *opaque)
+{
+    IoUringRequest *req = opaque;
+
+    req->ret = luring_co_submit(NULL, req->fd, req->offset, req->qiov,
+                                req->type, 0);
+    req->done = true;
+}
+
+static void start_io(IoUringRequest *req, int fd, uint64_t offset,
+                     void *buf, size_t len, int type, QEMUIOVector *qiov)
+{
+    *req = (IoUringRequest) {
+        .fd = fd,
+        .offset = offset,
+        .qiov = qiov,
+        .type = type,
+    };
+    qemu_iovec_init_buf(qiov, buf, len);
+    qemu_coroutine_enter(qemu_coroutine_create(submit_co, req));
+}
+
+static int do_io(int fd, uint64_t offset, void *buf, size_t len, int type)
+{
+    IoUringRequest req;
+    QEMUIOVector qiov;
+
+    start_io(&req, fd, offset, buf, len, type, &qiov);
+    while (!req.done) {
+        aio_poll(ctx, true);
+    }
+    return req.ret;
+}
+
+static int open_test_file(void)
+{
+    int fd = open(test_file, O_RDWR);
+
+    g_assert_cmpint(fd, >=, 0);
+    return fd;
+}
+
+static void close_test_file(int fd)
+{
+    luring_unregister_fd(fd);
+    close(fd);
+}
+
+/* Reads and writes go through the fixed file table */
+static void test_fixed_file(void)
+{
+    uint8_t *wbuf = qemu_memalign(4096, 64 * KiB);
+    uint8_t *rbuf = qemu_memalign(4096, 64 * KiB);
+    int fd = open_test_file();
+
+    memset(wbuf, 0x5a, 64 * KiB);
+    g_assert_cmpint(do_io(fd, 0, wbuf, 64 * KiB, QEMU_AIO_WRITE), ==, 0);
+    g_assert_cmpint(do_io(fd, 0, rbuf, 64 * KiB, QEMU_AIO_READ), ==, 0);
+    g_assert(!memcmp(wbuf, rbuf, 64 * KiB));
+    close_test_file(fd);
+
+    /* The slot of the closed fd must not be used for a new one */
+    fd = open_test_file();
+    memset(rbuf, 0, 64 * KiB);
+    g_assert_cmpint(do_io(fd, 0, rbuf, 64 * KiB, QEMU_AIO_READ), ==, 0);
+    g_assert(!memcmp(wbuf, rbuf, 64 * KiB));
+    close_test_file(fd);
+
+    qemu_vfree(wbuf);
+    qemu_vfree(rbuf);
+}
+
+/*
+ * I/O inside a registered buffer uses READ_FIXED and WRITE_FIXED; I/O
+ * that crosses its end, or after it is unregistered, falls back to
+ * vectored I/O.  Both must give the same results.
+ */
+static void test_fixed_buf(void)
+{
+    uint8_t *buf = qemu_memalign(4096, BUF_SIZE + 64 * KiB);
+    uint8_t *cmp = g_malloc(BUF_SIZE);
+    int fd = open_test_file();
+    int i;
+
+    luring_register_buf(buf, BUF_SIZE);
+
+    for (i = 0; i < BUF_SIZE; i++) {
+        buf[i] = i * 7;
+    }
+    memcpy(cmp, buf, BUF_SIZE);
+    g_assert_cmpint(do_io(fd, 0, buf, BUF_SIZE, QEMU_AIO_WRITE), ==, 0);
+
+    memset(buf, 0, BUF_SIZE);
+    g_assert_cmpint(do_io(fd, 0, buf, 256 * KiB, QEMU_AIO_READ), ==, 0);
+    g_assert(!memcmp(buf, cmp, 256 * KiB));
+
+    /* Crosses the end of the registered buffer */
+    g_assert_cmpint(do_io(fd, 0, buf + BUF_SIZE - 64 * KiB, 128 * KiB,
+                          QEMU_AIO_READ), ==, 0);
+    g_assert(!memcmp(buf + BUF_SIZE - 64 * KiB, cmp, 128 * KiB));
+
+    /* Registering again only takes a reference */
+    luring_register_buf(buf, BUF_SIZE);
+    luring_unregister_buf(buf, BUF_SIZE);
+    memset(buf, 0, BUF_SIZE);
+    g_assert_cmpint(do_io(fd, 0, buf, BUF_SIZE, QEMU_AIO_READ), ==, 0);
+    g_assert(!memcmp(buf, cmp, BUF_SIZE));
+
+    luring_unregister_buf(buf, BUF_SIZE);
+    memset(buf, 0, BUF_SIZE);
+    g_assert_cmpint(do_io(fd, 0, buf, BUF_SIZE, QEMU_AIO_READ), ==, 0);
+    g_assert(!memcmp(buf, cmp, BUF_SIZE));
+
+    close_test_file(fd);
+    g_free(cmp);
+    qemu_vfree(buf);
+}
+
+/*
+ * A read past the end of the file completes short, is resubmitted for
+ * the rest without a fixed buffer, and the tail is filled with zeroes.
+ */
+static void test_short_read(void)
+{
+    uint8_t *buf = qemu_memalign(4096, 64 * KiB);
+    int fd = open_test_file();
+    int i;
+
+    g_assert_cmpint(ftruncate(fd, 4 * KiB), ==, 0);
+    g_assert_cmpint(pwrite(fd, "short", 5, 0), ==, 5);
+
+    luring_register_buf(buf, 64 * KiB);
+    memset(buf, 0xff, 64 * KiB);
+    g_assert_cmpint(do_io(fd, 0, buf, 64 * KiB, QEMU_AIO_READ), ==, 0);
+    g_assert(!memcmp(buf, "short", 5));
+    for (i = 5; i < 64 * KiB; i++) {
+        g_assert_cmpint(buf[i], ==, 0);
+    }
+    luring_unregister_buf(buf, 64 * KiB);
+
+    close_test_file(fd);
+    qemu_vfree(buf);
+}
+
+/*
+ * A read from an empty non-blocking pipe fails with EAGAIN, or waits for
+ * data on kernels that poll instead.  Either way it must complete once
+ * data arrives.
+ */
+static void test_eagain(void)
+{
+    uint8_t *buf = qemu_memalign(4096, 4 * KiB);
+    IoUringRequest req;
+    QEMUIOVector qiov;
+    int fds[2];
+    int i;
+
+    g_assert(g_unix_open_pipe(fds, FD_CLOEXEC, NULL));
+    g_assert(g_unix_set_fd_nonblocking(fds[0], true, NULL));
+
+    luring_register_buf(buf, 4 * KiB);
+    start_io(&req, fds[0], 0, buf, 4 * KiB, QEMU_AIO_READ, &qiov);
+    for (i = 0; i < 10; i++) {
+        aio_poll(ctx, false);
+    }
+    g_assert(!req.done);
+
+    /*
+     * The read completes short, and is resubmitted without the fixed
+     * buffer until it sees end of file.
+     */
+    g_assert_cmpint(write(fds[1], "data", 4), ==, 4);
+    close(fds[1]);
+    while (!req.done) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(req.ret, ==, 0);
+    g_assert(!memcmp(buf, "data", 4));
+    luring_unregister_buf(buf, 4 * KiB);
+
+    close_test_file(fds[0]);
+    qemu_vfree(buf);
+}
+
+int main(int argc, char **argv)
+{
+    Error *local_err = NULL;
+    int fd, ret;
+
+    qemu_init_main_loop(&error_abort);
+    ctx = qemu_get_current_aio_context();
+
+    g_test_init(&argc, &argv, NULL);
+
+    if (!aio_setup_linux_io_uring(ctx, &local_err)) {
+        g_test_message("io_uring not available: %s",
+                       error_get_pretty(local_err));
+        error_free(local_err);
+        return 0;
+    }
+
+    fd = g_mkstemp(test_file);
+    g_assert_cmpint(fd, >=, 0);
+    g_assert_cmpint(ftruncate(fd, BUF_SIZE), ==, 0);
+    close(fd);
+
+    g_test_add_func("/io-uring/fixed-file", test_fixed_file);
+    g_test_add_func("/io-uring/fixed-buf", test_fixed_buf);
+    g_test_add_func("/io-uring/short-read", test_short_read);
+    g_test_add_func("/io-uring/eagain", test_eagain);
+
+    ret = g_test_run();
+    unlink(test_file);
+    return ret;
+}
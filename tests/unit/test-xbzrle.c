@@ -173,6 +173,55 @@ static void test_encode_decode(void)
     }
 }
 
+static void encode_decode_random(void)
+{
+    uint8_t *buffer = g_malloc0(XBZRLE_PAGE_SIZE);
+    uint8_t *compressed = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *test = g_malloc0(XBZRLE_PAGE_SIZE);
+    int i, rc, dlen;
+
+    /* runs of random length and with random offsets */
+    for (i = g_test_rand_int_range(0, 200); i < XBZRLE_PAGE_SIZE;
+         i += g_test_rand_int_range(1, 200)) {
+        int len = MIN(g_test_rand_int_range(1, 100), XBZRLE_PAGE_SIZE - i);
+
+        memset(buffer + i, g_test_rand_int_range(1, 256), len);
+        i += len;
+    }
+
+    dlen = xbzrle_encode_buffer(test, buffer, XBZRLE_PAGE_SIZE,
+                                compressed, XBZRLE_PAGE_SIZE);
+    if (dlen < 0) {
+        /* overflow is fine, the page would be sent in full */
+        goto out;
+    }
+
+    rc = xbzrle_decode_buffer(compressed, dlen, test, XBZRLE_PAGE_SIZE);
+    g_assert(rc <= XBZRLE_PAGE_SIZE);
+    g_assert(memcmp(test, buffer, XBZRLE_PAGE_SIZE) == 0);
+
+out:
+    g_free(buffer);
+    g_free(compressed);
+    g_free(test);
+}
+
+static void test_encode_decode_accel(void)
+{
+    int i;
+
+    do {
+        test_encode_decode_zero();
+        test_encode_decode_unchanged();
+        test_encode_decode_1_byte();
+        test_encode_decode_overflow();
+        for (i = 0; i < 1000; i++) {
+            encode_decode_range();
+            encode_decode_random();
+        }
+    } while (xbzrle_test_next_accel());
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -185,6 +234,7 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_decode_accel", test_encode_decode_accel);
 
     return g_test_run();
 }
@@ -29,7 +29,7 @@
 #define POLL_IDLE_INTERVAL_NS (7 * NANOSECONDS_PER_SECOND)
 
 static void adjust_polling_time(AioContext *ctx, AioPolledEvent *poll,
-                                int64_t block_ns);
+                                int64_t block_ns, int64_t now);
 
 bool aio_poll_disabled(AioContext *ctx)
 {
@@ -396,13 +396,19 @@ static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
  */
 static bool aio_dispatch_ready_handlers(AioContext *ctx,
                                         AioHandlerList *ready_list,
-                                        int64_t block_ns)
+                                        int64_t block_ns, int64_t now)
 {
     bool progress = false;
     AioHandler *node;
 
     while ((node = QLIST_FIRST(ready_list))) {
         QLIST_REMOVE(node, node_ready);
+
+        if (node->opaque != &ctx->notifier) {
+            stat64_inc(node->poll_ready ? &ctx->poll_stats.polled_events
+                                        : &ctx->poll_stats.notified_events);
+        }
+
         progress = aio_dispatch_handler(ctx, node) || progress;
 
         /*
@@ -410,7 +416,7 @@ static bool aio_dispatch_ready_handlers(AioContext *ctx,
          * add the handler to ctx->poll_aio_handlers.
          */
         if (ctx->poll_max_ns && QLIST_IS_INSERTED(node, node_poll)) {
-            adjust_polling_time(ctx, &node->poll, block_ns);
+            adjust_polling_time(ctx, &node->poll, block_ns, now);
         }
     }
 
@@ -561,6 +567,12 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
         assert(!(max_ns && progress));
     } while (elapsed_time < max_ns && !ctx->fdmon_ops->need_wait(ctx));
 
+    stat64_add(&ctx->poll_stats.poll_ns, elapsed_time);
+    if (!progress) {
+        stat64_add(&ctx->poll_stats.wasted_ns, elapsed_time);
+    }
+    ctx->poll_budget_used += elapsed_time;
+
     if (remove_idle_poll_handlers(ctx, ready_list,
                                   start_time + elapsed_time)) {
         *timeout = 0;
@@ -578,6 +590,28 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
     return progress;
 }
 
+/*
+ * Limit @max_ns so that no more than ctx->poll_budget_ns are spent polling
+ * in each second.
+ */
+static int64_t poll_budget_max_ns(AioContext *ctx, int64_t max_ns)
+{
+    int64_t now;
+
+    if (!ctx->poll_budget_ns || !max_ns) {
+        return max_ns;
+    }
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    if (now - ctx->poll_budget_start >= NANOSECONDS_PER_SECOND) {
+        ctx->poll_budget_start = now;
+        ctx->poll_budget_used = 0;
+    }
+
+    max_ns = MIN(max_ns, ctx->poll_budget_ns - ctx->poll_budget_used);
+    return MAX(max_ns, 0);
+}
+
 /* try_poll_mode:
  * @ctx: the AioContext
  * @ready_list: list to add handlers that need to be run
@@ -603,6 +637,7 @@ static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
         max_ns = MAX(max_ns, node->poll.ns);
     }
     max_ns = qemu_soonest_timeout(*timeout, max_ns);
+    max_ns = poll_budget_max_ns(ctx, max_ns);
 
     if (max_ns && !ctx->fdmon_ops->need_wait(ctx)) {
         /*
@@ -618,10 +653,51 @@ static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
     return false;
 }
 
+/*
+ * Poll for as long as the next event of the handler is expected to take.
+ * The estimator uses the same gains as TCP's retransmission timer (RFC
+ * 6298), so that polling covers most of the jitter of periodic events.
+ */
+static void adjust_polling_time_latency(AioContext *ctx, AioPolledEvent *poll,
+                                        int64_t now)
+{
+    int64_t old = poll->ns;
+
+    if (poll->last_event) {
+        int64_t interval = now - poll->last_event;
+        int64_t err = interval - poll->interval_ns;
+
+        if (!poll->interval_ns) {
+            poll->interval_ns = interval;
+            poll->interval_dev_ns = interval / 2;
+        } else {
+            poll->interval_ns += err / 8;
+            poll->interval_dev_ns += (ABS(err) - poll->interval_dev_ns) / 4;
+        }
+
+        if (poll->interval_ns <= ctx->poll_max_ns) {
+            poll->ns = MIN(poll->interval_ns + 4 * poll->interval_dev_ns,
+                           ctx->poll_max_ns);
+        } else {
+            /* The next event is too far away, don't waste CPU on it */
+            poll->ns = 0;
+        }
+    }
+    poll->last_event = now;
+
+    if (poll->ns > old) {
+        trace_poll_grow(ctx, old, poll->ns);
+    } else if (poll->ns < old) {
+        trace_poll_shrink(ctx, old, poll->ns);
+    }
+}
+
 static void adjust_polling_time(AioContext *ctx, AioPolledEvent *poll,
-                                int64_t block_ns)
+                                int64_t block_ns, int64_t now)
 {
-    if (block_ns <= poll->ns) {
+    if (ctx->poll_policy == AIO_POLL_POLICY_LATENCY) {
+        adjust_polling_time_latency(ctx, poll, now);
+    } else if (block_ns <= poll->ns) {
         /* This is the sweet spot, no adjustment needed */
     } else if (block_ns > ctx->poll_max_ns) {
         /* We'd have to poll for too long, poll less */
@@ -744,7 +820,8 @@ bool aio_poll(AioContext *ctx, bool blocking)
     }
 
     progress |= aio_bh_poll(ctx);
-    progress |= aio_dispatch_ready_handlers(ctx, &ready_list, block_ns);
+    progress |= aio_dispatch_ready_handlers(ctx, &ready_list, block_ns,
+                                            start + block_ns);
 
     aio_free_deleted_handlers(ctx);
 
@@ -808,6 +885,24 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     aio_notify(ctx);
 }
 
+void aio_context_set_poll_policy(AioContext *ctx, AioPollPolicy policy,
+                                 int64_t budget_ns, Error **errp)
+{
+    AioHandler *node;
+
+    qemu_lockcnt_inc(&ctx->list_lock);
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        node->poll = (AioPolledEvent) { 0 };
+    }
+    qemu_lockcnt_dec(&ctx->list_lock);
+
+    /* As above, an incorrect value can be used once. */
+    ctx->poll_policy = policy;
+    ctx->poll_budget_ns = budget_ns;
+
+    aio_notify(ctx);
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch)
 {
     /*
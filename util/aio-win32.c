@@ -439,6 +439,14 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     }
 }
 
+void aio_context_set_poll_policy(AioContext *ctx, AioPollPolicy policy,
+                                 int64_t budget_ns, Error **errp)
+{
+    if (policy != AIO_POLL_POLICY_ADAPTIVE || budget_ns) {
+        error_setg(errp, "AioContext polling is not implemented on Windows");
+    }
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch)
 {
 }
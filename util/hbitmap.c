@@ -217,6 +217,22 @@ int64_t hbitmap_next_dirty(const HBitmap *hb, int64_t start, int64_t count)
     return MAX(start, first_dirty_off);
 }
 
+/* Return the index of the first word in [@pos, @sz) that is not all ones,
+ * or @sz if there is none.  Dense bitmaps have long runs of full words, so
+ * check four at a time before falling back to single words.
+ */
+static size_t hb_find_not_full(const unsigned long *lev, size_t pos, size_t sz)
+{
+    while (pos + 4 <= sz &&
+           (lev[pos] & lev[pos + 1] & lev[pos + 2] & lev[pos + 3]) == ~0UL) {
+        pos += 4;
+    }
+    while (pos < sz && lev[pos] == ~0UL) {
+        pos++;
+    }
+    return pos;
+}
+
 int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
 {
     size_t pos = (start >> hb->granularity) >> BITS_PER_LEVEL;
@@ -245,9 +261,7 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
+        pos = hb_find_not_full(last_lev, pos + 1, sz);
 
         if (pos >= sz) {
             return -1;
@@ -349,62 +363,49 @@ uint64_t hbitmap_count(const HBitmap *hb)
     return hb->count << hb->granularity;
 }
 
-/**
- * hbitmap_iter_next_word:
- * @hbi: HBitmapIter to operate on.
- * @p_cur: Location where to store the next non-zero word.
- *
- * Return the index of the next nonzero word that is set in @hbi's
- * associated HBitmap, and set *p_cur to the content of that word
- * (bits before the index that was passed to hbitmap_iter_init are
- * trimmed on the first call).  Return -1, and set *p_cur to zero,
- * if all remaining words are zero.
+/* Population count of @n words starting at @p.  The loop keeps four
+ * independent accumulators so that the compiler can use vector popcount
+ * instructions, or at least overlap scalar ones.
  */
-static size_t hbitmap_iter_next_word(HBitmapIter *hbi, unsigned long *p_cur)
+static uint64_t hb_count_words(const unsigned long *p, size_t n)
 {
-    unsigned long cur = hbi->cur[HBITMAP_LEVELS - 1];
+    uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+    size_t i;
 
-    if (cur == 0) {
-        cur = hbitmap_iter_skip_words(hbi);
-        if (cur == 0) {
-            *p_cur = 0;
-            return -1;
-        }
+    for (i = 0; i + 4 <= n; i += 4) {
+        c0 += ctpopl(p[i]);
+        c1 += ctpopl(p[i + 1]);
+        c2 += ctpopl(p[i + 2]);
+        c3 += ctpopl(p[i + 3]);
+    }
+    for (; i < n; i++) {
+        c0 += ctpopl(p[i]);
     }
 
-    /* The next call will resume work from the next word.  */
-    hbi->cur[HBITMAP_LEVELS - 1] = 0;
-    *p_cur = cur;
-    return hbi->pos;
+    return c0 + c1 + c2 + c3;
 }
 
 /* Count the number of set bits between start and end, not accounting for
- * the granularity.  Also an example of how to use hbitmap_iter_next_word.
+ * the granularity.  Callers are about to touch every word in the range
+ * anyway, so scanning it linearly is cheaper than walking the upper levels.
  */
 static uint64_t hb_count_between(HBitmap *hb, uint64_t start, uint64_t last)
 {
-    HBitmapIter hbi;
-    uint64_t count = 0;
-    uint64_t end = last + 1;
-    unsigned long cur;
-    size_t pos;
-
-    hbitmap_iter_init(&hbi, hb, start << hb->granularity);
-    for (;;) {
-        pos = hbitmap_iter_next_word(&hbi, &cur);
-        if (pos >= (end >> BITS_PER_LEVEL)) {
-            break;
-        }
-        count += ctpopl(cur);
-    }
+    const unsigned long *lev = hb->levels[HBITMAP_LEVELS - 1];
+    size_t pos = start >> BITS_PER_LEVEL;
+    size_t lastpos = last >> BITS_PER_LEVEL;
+    unsigned long first_mask = ~0UL << (start & (BITS_PER_LONG - 1));
+    unsigned long last_mask = 2UL << (last & (BITS_PER_LONG - 1));
+    uint64_t count;
 
-    if (pos == (end >> BITS_PER_LEVEL)) {
-        /* Drop bits representing the END-th and subsequent items.  */
-        int bit = end & (BITS_PER_LONG - 1);
-        cur &= (1UL << bit) - 1;
-        count += ctpopl(cur);
+    last_mask -= 1;
+    if (pos == lastpos) {
+        return ctpopl(lev[pos] & first_mask & last_mask);
     }
 
+    count = ctpopl(lev[pos] & first_mask);
+    count += hb_count_words(&lev[pos + 1], lastpos - pos - 1);
+    count += ctpopl(lev[lastpos] & last_mask);
     return count;
 }
 
@@ -892,6 +893,51 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
     }
 }
 
+/**
+ * hbitmap_merge_into: performs dst = dst | src
+ * for bitmaps with the same size and granularity.
+ *
+ * The bottom level is only visited where the level above says that @src
+ * has set bits, so the cost is proportional to the populated part of @src
+ * rather than to the size of the bitmap.  The dirty count is adjusted for
+ * the words that change instead of being recomputed from scratch.
+ */
+static void hbitmap_merge_into(HBitmap *dst, const HBitmap *src)
+{
+    const unsigned long *src_last = src->levels[HBITMAP_LEVELS - 1];
+    const unsigned long *src_up = src->levels[HBITMAP_LEVELS - 2];
+    unsigned long *dst_last = dst->levels[HBITMAP_LEVELS - 1];
+    uint64_t i, j;
+    int level;
+
+    if (dst == src) {
+        return;
+    }
+
+    for (i = 0; i < src->sizes[HBITMAP_LEVELS - 2]; i++) {
+        unsigned long up = src_up[i];
+
+        while (up) {
+            size_t pos = (i << BITS_PER_LEVEL) + ctzl(up);
+            unsigned long old = dst_last[pos];
+            unsigned long merged = old | src_last[pos];
+
+            up &= up - 1;
+            if (merged != old) {
+                dst->count += ctpopl(merged) - ctpopl(old);
+                dst_last[pos] = merged;
+            }
+        }
+    }
+
+    /* The upper levels are a fraction of the size of the bottom one.  */
+    for (level = HBITMAP_LEVELS - 2; level >= 0; level--) {
+        for (j = 0; j < src->sizes[level]; j++) {
+            dst->levels[level][j] |= src->levels[level][j];
+        }
+    }
+}
+
 /**
  * Given HBitmaps A and B, let R := A (BITOR) B.
  * Bitmaps A and B will not be modified,
@@ -929,19 +975,29 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
         return;
     }
 
+    assert(a->size == b->size);
+    if (result == a || result == b) {
+        hbitmap_merge_into(result, result == a ? b : a);
+        return;
+    }
+
     /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
-     * It may be possible to improve running times for sparsely populated maps
-     * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+     * The loops are trivially vectorizable, and the count is recomputed with
+     * the unrolled popcount.
      */
-    assert(a->size == b->size);
     for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
+        const unsigned long *pa = a->levels[i];
+        const unsigned long *pb = b->levels[i];
+        unsigned long *pr = result->levels[i];
+
         for (j = 0; j < a->sizes[i]; j++) {
-            result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
+            pr[j] = pa[j] | pb[j];
         }
     }
 
     /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
+    result->count = hb_count_words(result->levels[HBITMAP_LEVELS - 1],
+                                   result->sizes[HBITMAP_LEVELS - 1]);
 }
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)